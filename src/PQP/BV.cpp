@@ -44,6 +44,7 @@
 #include "MatVec.h"
 #include "RectDist.h"
 #include "OBB_Disjoint.h"
+#include "Lanes.h"
 
 BV::BV()
 {
@@ -64,7 +65,7 @@ MaxOfTwo(PQP_REAL a, PQP_REAL b)
 }
 
 void
-BV::FitToTris(PQP_REAL O[3][3], Tri *tris, int num_tris)
+BV::FitToTris(PQP_REAL O[3][3], Tri *tris, int num_tris, OBB *obb)
 {
   // store orientation
 
@@ -106,11 +107,11 @@ BV::FitToTris(PQP_REAL O[3][3], Tri *tris, int num_tris)
   c[0] = (PQP_REAL)0.5*(maxx + minx);
   c[1] = (PQP_REAL)0.5*(maxy + miny);
   c[2] = (PQP_REAL)0.5*(maxz + minz);
-  MxV(To,R,c);
+  MxV(obb->To,R,c);
 
-  d[0] = (PQP_REAL)0.5*(maxx - minx);
-  d[1] = (PQP_REAL)0.5*(maxy - miny);
-  d[2] = (PQP_REAL)0.5*(maxz - minz);
+  obb->d[0] = (PQP_REAL)0.5*(maxx - minx);
+  obb->d[1] = (PQP_REAL)0.5*(maxy - miny);
+  obb->d[2] = (PQP_REAL)0.5*(maxz - minz);
 #endif
   
 #if PQP_BV_TYPE & RSS_TYPE
@@ -299,15 +300,129 @@ BV::FitToTris(PQP_REAL O[3][3], Tri *tris, int num_tris)
 }
 
 int 
-BV_Overlap(PQP_REAL R[3][3], PQP_REAL T[3], BV *b1, BV *b2)
+BV_Overlap(PQP_REAL R[3][3], PQP_REAL T[3], BV *b1, OBB *o1,
+           BV *b2, OBB *o2)
 {
 #if PQP_BV_TYPE & OBB_TYPE
-  return (obb_disjoint(R,T,b1->d,b2->d) == 0);
-#else
+  if (o1 && o2) return (obb_disjoint(R,T,o1->d,o2->d) == 0);
+#endif
+#if PQP_BV_TYPE & RSS_TYPE
   PQP_REAL dist = RectDist(R,T,b1->l,b2->l);
   if (dist <= (b1->r + b2->r)) return 1;
+#endif
   return 0;
+}
+
+#if PQP_SIMD && (PQP_BV_TYPE & OBB_TYPE)
+
+// obb_disjoint() of PQP_LANES box pairs, with the same arithmetic, so
+// that every lane gets the same answer as the scalar test. Returns the
+// mask of the lanes whose boxes overlap.
+
+static int
+obb_overlap_lanes(const Lanes B[3][3], const Lanes T[3],
+                  const Lanes a[3], const Lanes b[3])
+{
+  Lanes Bf[3][3];
+  const Lanes reps = (PQP_REAL)1e-6;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      Bf[i][j] = Abs(B[i][j]) + reps;
+
+  // the axes of box A and box B
+
+  Lanes r = LessEqual(Abs(T[0]),
+                      a[0] + b[0] * Bf[0][0] + b[1] * Bf[0][1] +
+                      b[2] * Bf[0][2]);
+  r = r & LessEqual(Abs(T[0]*B[0][0] + T[1]*B[1][0] + T[2]*B[2][0]),
+                    b[0] + a[0] * Bf[0][0] + a[1] * Bf[1][0] +
+                    a[2] * Bf[2][0]);
+  r = r & LessEqual(Abs(T[1]),
+                    a[1] + b[0] * Bf[1][0] + b[1] * Bf[1][1] +
+                    b[2] * Bf[1][2]);
+  r = r & LessEqual(Abs(T[2]),
+                    a[2] + b[0] * Bf[2][0] + b[1] * Bf[2][1] +
+                    b[2] * Bf[2][2]);
+  r = r & LessEqual(Abs(T[0]*B[0][1] + T[1]*B[1][1] + T[2]*B[2][1]),
+                    b[1] + a[0] * Bf[0][1] + a[1] * Bf[1][1] +
+                    a[2] * Bf[2][1]);
+  r = r & LessEqual(Abs(T[0]*B[0][2] + T[1]*B[1][2] + T[2]*B[2][2]),
+                    b[2] + a[0] * Bf[0][2] + a[1] * Bf[1][2] +
+                    a[2] * Bf[2][2]);
+  if (!LaneBits(r)) return 0;
+
+  // the cross products of the axes
+
+  r = r & LessEqual(Abs(T[2] * B[1][0] - T[1] * B[2][0]),
+                    a[1] * Bf[2][0] + a[2] * Bf[1][0] +
+                    b[1] * Bf[0][2] + b[2] * Bf[0][1]);
+  r = r & LessEqual(Abs(T[2] * B[1][1] - T[1] * B[2][1]),
+                    a[1] * Bf[2][1] + a[2] * Bf[1][1] +
+                    b[0] * Bf[0][2] + b[2] * Bf[0][0]);
+  r = r & LessEqual(Abs(T[2] * B[1][2] - T[1] * B[2][2]),
+                    a[1] * Bf[2][2] + a[2] * Bf[1][2] +
+                    b[0] * Bf[0][1] + b[1] * Bf[0][0]);
+  r = r & LessEqual(Abs(T[0] * B[2][0] - T[2] * B[0][0]),
+                    a[0] * Bf[2][0] + a[2] * Bf[0][0] +
+                    b[1] * Bf[1][2] + b[2] * Bf[1][1]);
+  r = r & LessEqual(Abs(T[0] * B[2][1] - T[2] * B[0][1]),
+                    a[0] * Bf[2][1] + a[2] * Bf[0][1] +
+                    b[0] * Bf[1][2] + b[2] * Bf[1][0]);
+  r = r & LessEqual(Abs(T[0] * B[2][2] - T[2] * B[0][2]),
+                    a[0] * Bf[2][2] + a[2] * Bf[0][2] +
+                    b[0] * Bf[1][1] + b[1] * Bf[1][0]);
+  r = r & LessEqual(Abs(T[1] * B[0][0] - T[0] * B[1][0]),
+                    a[0] * Bf[1][0] + a[1] * Bf[0][0] +
+                    b[1] * Bf[2][2] + b[2] * Bf[2][1]);
+  r = r & LessEqual(Abs(T[1] * B[0][1] - T[0] * B[1][1]),
+                    a[0] * Bf[1][1] + a[1] * Bf[0][1] +
+                    b[0] * Bf[2][2] + b[2] * Bf[2][0]);
+  r = r & LessEqual(Abs(T[1] * B[0][2] - T[0] * B[1][2]),
+                    a[0] * Bf[1][2] + a[1] * Bf[0][2] +
+                    b[0] * Bf[2][1] + b[1] * Bf[2][0]);
+  return LaneBits(r);
+}
+
+#endif
+
+int
+BV_OverlapLanes(PQP_REAL R[][3][3], PQP_REAL T[][3], BV *b1[], OBB *o1[],
+                BV *b2[], OBB *o2[], int n)
+{
+#if PQP_SIMD && (PQP_BV_TYPE & OBB_TYPE)
+  if (o1[0] && o2[0])
+  {
+    // transpose the pairs into lanes, padding with the last one
+
+    PQP_REAL x[18][PQP_LANES];
+    for (int k = 0; k < PQP_LANES; k++)
+    {
+      int m = (k < n) ? k : n - 1;
+      for (int i = 0; i < 3; i++)
+      {
+        for (int j = 0; j < 3; j++) x[3*i + j][k] = R[m][i][j];
+        x[9 + i][k] = T[m][i];
+        x[12 + i][k] = o1[m]->d[i];
+        x[15 + i][k] = o2[m]->d[i];
+      }
+    }
+
+    Lanes B[3][3], Tl[3], a[3], b[3];
+    for (int i = 0; i < 3; i++)
+    {
+      for (int j = 0; j < 3; j++) B[i][j] = LoadLanes(x[3*i + j]);
+      Tl[i] = LoadLanes(x[9 + i]);
+      a[i] = LoadLanes(x[12 + i]);
+      b[i] = LoadLanes(x[15 + i]);
+    }
+
+    return obb_overlap_lanes(B, Tl, a, b) & ((1 << n) - 1);
+  }
 #endif
+  int mask = 0;
+  for (int k = 0; k < n; k++)
+    if (BV_Overlap(R[k], T[k], b1[k], o1[k], b2[k], o2[k])) mask |= 1 << k;
+  return mask;
 }
 
 #if PQP_BV_TYPE & RSS_TYPE
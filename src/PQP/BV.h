@@ -45,6 +45,16 @@
 #include "Tri.h"
 #include "PQP_Compile.h"
 
+// OBB part of a BV. The OBBs are kept in an array of their own, parallel
+// to the BV array, so that the distance and tolerance queries, which only
+// use the RSS, read one cache line per BV.
+
+struct OBB
+{
+  PQP_REAL To[3];       // position of obb
+  PQP_REAL d[3];        // (half) dimensions of obb
+};
+
 struct BV
 {
   PQP_REAL R[3][3];     // orientation of RSS & OBB
@@ -55,34 +65,48 @@ struct BV
   PQP_REAL r;           // radius of sphere summed with rectangle to form RSS
 #endif
 
-#if PQP_BV_TYPE & OBB_TYPE
-  PQP_REAL To[3];       // position of obb
-  PQP_REAL d[3];        // (half) dimensions of obb
-#endif
-
   int first_child;      // positive value is index of first_child bv
                         // negative value is -(index + 1) of triangle
 
   BV();
   ~BV();
   int      Leaf()    { return first_child < 0; }
-  PQP_REAL GetSize(); 
-  void     FitToTris(PQP_REAL O[3][3], Tri *tris, int num_tris);
+  PQP_REAL GetSize(const OBB *obb); 
+  void     FitToTris(PQP_REAL O[3][3], Tri *tris, int num_tris, OBB *obb);
 };
 
+// BV arrays are aligned to cache lines, with PQP_REAL float a BV takes
+// exactly one line
+
+const int PQP_BV_ALIGNMENT = 64;
+
+// in an OBB-only model l and r hold the box half dimensions, which still
+// rank the BVs by size
+
 inline
 PQP_REAL 
-BV::GetSize()
+BV::GetSize(const OBB *obb)
 {
 #if PQP_BV_TYPE & RSS_TYPE
   return (sqrt(l[0]*l[0] + l[1]*l[1]) + 2*r);
 #else
-  return (d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+  return (obb->d[0]*obb->d[0] + obb->d[1]*obb->d[1] + obb->d[2]*obb->d[2]);
 #endif
 }
 
+// tests the OBBs o1, o2 when both are given, otherwise the RSSs of b1, b2
+
+int
+BV_Overlap(PQP_REAL R[3][3], PQP_REAL T[3], BV *b1, OBB *o1,
+           BV *b2, OBB *o2);
+
+// BV_Overlap() of the n <= PQP_LANES pairs b1[k], b2[k], with b2[k] placed
+// by R[k], T[k] relative to b1[k], in SIMD lanes (see Lanes.h); returns
+// the mask of the overlapping pairs
+
 int
-BV_Overlap(PQP_REAL R[3][3], PQP_REAL T[3], BV *b1, BV *b2);
+BV_OverlapLanes(PQP_REAL R[][3][3], PQP_REAL T[][3], BV *b1[], OBB *o1[],
+                BV *b2[], OBB *o2[], int n);
 
 #if PQP_BV_TYPE & RSS_TYPE
 PQP_REAL
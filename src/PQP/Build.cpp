@@ -41,6 +41,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include "PQP.h"
 #include "MatVec.h"
 
@@ -49,6 +50,13 @@
 
 #define RAPID2_FIT 0
 
+// Subtrees over more than PARALLEL_SUBTREE_TRIS triangles are built by
+// concurrent OpenMP tasks. Every subtree of n triangles takes 2n-1 BVs, so
+// the BV indices are the same as those of the serial build.
+
+const int PARALLEL_SUBTREE_TRIS = 4096;
+const int SUM_CHUNK_TRIS = 16384;
+
 #if RAPID2_FIT
 
 struct moment
@@ -275,12 +283,21 @@ get_centroid_triverts(PQP_REAL c[3], Tri *tris, int num_tris)
   c[2] /= n;
 }
 
-void
-get_covariance_triverts(PQP_REAL M[3][3], Tri *tris, int num_tris)
+// sums of the vertex coordinates and of their products, the covariance
+// matrix and the centroid follow from these
+
+struct vertex_sums
 {
-  int i;
   PQP_REAL S1[3];
   PQP_REAL S2[3][3];
+};
+
+void
+sum_triverts(vertex_sums &s, Tri *tris, int num_tris)
+{
+  int i;
+  PQP_REAL (&S1)[3] = s.S1;
+  PQP_REAL (&S2)[3][3] = s.S2;
 
   S1[0] = S1[1] = S1[2] = 0.0;
   S2[0][0] = S2[1][0] = S2[2][0] = 0.0;
@@ -317,6 +334,56 @@ get_covariance_triverts(PQP_REAL M[3][3], Tri *tris, int num_tris)
                  p2[1] * p2[2] +  
                  p3[1] * p3[2]);
   }
+}
+
+// sums over more than SUM_CHUNK_TRIS triangles are split into chunks of
+// that many triangles, summed by concurrent tasks and added up in chunk
+// order, so the result doesn't depend on the number of threads
+
+void
+sum_triverts_chunked(vertex_sums &s, Tri *tris, int num_tris)
+{
+  if (num_tris <= SUM_CHUNK_TRIS)
+  {
+    sum_triverts(s, tris, num_tris);
+    return;
+  }
+
+  int num_chunks = (num_tris + SUM_CHUNK_TRIS - 1) / SUM_CHUNK_TRIS;
+  vertex_sums *chunks = new vertex_sums[num_chunks];
+  int i, j, k;
+  for(i=0; i<num_chunks; i++)
+  {
+    int first = i * SUM_CHUNK_TRIS;
+    int n = (num_tris - first < SUM_CHUNK_TRIS) ? num_tris - first
+                                                 : SUM_CHUNK_TRIS;
+#pragma omp task firstprivate(i, first, n) shared(chunks, tris)
+    sum_triverts(chunks[i], tris + first, n);
+  }
+#pragma omp taskwait
+
+  s = chunks[0];
+  for(i=1; i<num_chunks; i++)
+  {
+    for(j=0; j<3; j++)
+    {
+      s.S1[j] += chunks[i].S1[j];
+      for(k=0; k<3; k++) s.S2[j][k] += chunks[i].S2[j][k];
+    }
+  }
+  delete [] chunks;
+}
+
+// covariance matrix and centroid of the vertices, in one pass over them
+
+void
+get_covariance_centroid_triverts(PQP_REAL M[3][3], PQP_REAL c[3],
+                                 Tri *tris, int num_tris)
+{
+  vertex_sums s;
+  sum_triverts_chunked(s, tris, num_tris);
+  PQP_REAL (&S1)[3] = s.S1;
+  PQP_REAL (&S2)[3][3] = s.S2;
 
   PQP_REAL n = (PQP_REAL)(3 * num_tris);
 
@@ -331,6 +398,19 @@ get_covariance_triverts(PQP_REAL M[3][3], Tri *tris, int num_tris)
   M[1][0] = M[0][1];
   M[2][0] = M[0][2];
   M[2][1] = M[1][2];
+
+  // the same sums as get_centroid_triverts
+
+  c[0] = S1[0] / n;
+  c[1] = S1[1] / n;
+  c[2] = S1[2] / n;
+}
+
+void
+get_covariance_triverts(PQP_REAL M[3][3], Tri *tris, int num_tris)
+{
+  PQP_REAL c[3];
+  get_covariance_centroid_triverts(M, c, tris, num_tris);
 }
 
 #endif
@@ -383,12 +463,170 @@ split_tris(Tri *tris, int num_tris, PQP_REAL a[3], PQP_REAL c)
   return c1;
 }
 
+// orders triangles by the projection of their centroids on an axis
+
+struct centroid_less
+{
+  const PQP_REAL *a;
+
+  PQP_REAL key(const Tri &t) const
+  {
+    return (t.p1[0] + t.p2[0] + t.p3[0]) * a[0] +
+           (t.p1[1] + t.p2[1] + t.p3[1]) * a[1] +
+           (t.p1[2] + t.p2[2] + t.p3[2]) * a[2];
+  }
+  bool operator()(const Tri &t1, const Tri &t2) const
+  {
+    return key(t1) < key(t2);
+  }
+};
+
+// partitions the triangles at the median of their centroids projected
+// on the axis. Returns the number of tris in the first half
+
+int
+split_tris_median(Tri *tris, int num_tris, PQP_REAL a[3])
+{
+  centroid_less less = {a};
+  int c1 = num_tris/2;
+  std::nth_element(tris, tris + c1, tris + num_tris, less);
+  return c1;
+}
+
+// bins the triangle centroids along the first axis of R, and partitions
+// the triangles between the bins with the least surface area heuristic
+// cost: the areas of the two halves' boxes in R coordinates, weighted by
+// their numbers of triangles. Returns the number of tris in the first half
+
+const int SAH_BINS = 16;
+
+PQP_REAL
+box_area(const PQP_REAL lo[3], const PQP_REAL hi[3])
+{
+  PQP_REAL dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+  return 2 * (dx*dy + dy*dz + dz*dx);
+}
+
+void
+grow_box(PQP_REAL lo[3], PQP_REAL hi[3], const PQP_REAL p[3])
+{
+  for(int k = 0; k < 3; k++)
+  {
+    if (p[k] < lo[k]) lo[k] = p[k];
+    if (p[k] > hi[k]) hi[k] = p[k];
+  }
+}
+
+int
+split_tris_sah(Tri *tris, int num_tris, PQP_REAL R[3][3])
+{
+  PQP_REAL a[3];
+  McolcV(a,R,0);
+  centroid_less less = {a};
+
+  int i, k;
+  PQP_REAL cmin = less.key(tris[0]), cmax = cmin;
+  for(i = 1; i < num_tris; i++)
+  {
+    PQP_REAL x = less.key(tris[i]);
+    if (x < cmin) cmin = x;
+    if (x > cmax) cmax = x;
+  }
+  if (!(cmax > cmin)) return split_tris_median(tris, num_tris, a);
+  PQP_REAL scale = SAH_BINS / (cmax - cmin);
+
+  int count[SAH_BINS];
+  PQP_REAL lo[SAH_BINS][3], hi[SAH_BINS][3];
+  for(k = 0; k < SAH_BINS; k++)
+  {
+    count[k] = 0;
+    lo[k][0] = lo[k][1] = lo[k][2] = 1e30f;
+    hi[k][0] = hi[k][1] = hi[k][2] = -1e30f;
+  }
+
+  int *bin = new int[num_tris];
+  for(i = 0; i < num_tris; i++)
+  {
+    k = (int)((less.key(tris[i]) - cmin) * scale);
+    if (k > SAH_BINS - 1) k = SAH_BINS - 1;
+    bin[i] = k;
+    count[k]++;
+    PQP_REAL p[3];
+    MTxV(p,R,tris[i].p1);
+    grow_box(lo[k],hi[k],p);
+    MTxV(p,R,tris[i].p2);
+    grow_box(lo[k],hi[k],p);
+    MTxV(p,R,tris[i].p3);
+    grow_box(lo[k],hi[k],p);
+  }
+
+  // cost of the second half starting at each bin
+
+  PQP_REAL right_cost[SAH_BINS];
+  PQP_REAL blo[3] = {1e30f, 1e30f, 1e30f}, bhi[3] = {-1e30f, -1e30f, -1e30f};
+  int n = 0;
+  for(k = SAH_BINS - 1; k > 0; k--)
+  {
+    if (count[k])
+    {
+      grow_box(blo,bhi,lo[k]);
+      grow_box(blo,bhi,hi[k]);
+      n += count[k];
+    }
+    right_cost[k] = n ? box_area(blo,bhi) * n : 0;
+  }
+
+  // first half takes the bins before the best split
+
+  int best = 0;
+  PQP_REAL best_cost = 0;
+  blo[0] = blo[1] = blo[2] = 1e30f;
+  bhi[0] = bhi[1] = bhi[2] = -1e30f;
+  n = 0;
+  for(k = 1; k < SAH_BINS; k++)
+  {
+    if (count[k - 1])
+    {
+      grow_box(blo,bhi,lo[k - 1]);
+      grow_box(blo,bhi,hi[k - 1]);
+      n += count[k - 1];
+    }
+    if (n == 0 || n == num_tris) continue;
+    PQP_REAL cost = box_area(blo,bhi) * n + right_cost[k];
+    if (best == 0 || cost < best_cost)
+    {
+      best = k;
+      best_cost = cost;
+    }
+  }
+
+  int c1 = 0;
+  for(i = 0; i < num_tris; i++)
+  {
+    if (bin[i] < best)
+    {
+      Tri temp = tris[i];
+      tris[i] = tris[c1];
+      tris[c1] = temp;
+      bin[i] = bin[c1];
+      c1++;
+    }
+  }
+  delete [] bin;
+
+  // cmax > cmin puts triangles in the first and in the last bin
+
+  return c1;
+}
+
 // Fits m->child(bn) to the num_tris triangles starting at first_tri
 // Then, if num_tris is greater than one, partitions the tris into two
-// sets, and recursively builds two children of m->child(bn)
+// sets by split_rule, and recursively builds two children of
+// m->child(bn), taking the BVs from first_free_bv on
 
 int
-build_recurse(PQP_Model *m, int bn, int first_tri, int num_tris)
+build_recurse(PQP_Model *m, int bn, int first_tri, int num_tris,
+              int first_free_bv, int split_rule)
 {
   BV *b = m->child(bn);
 
@@ -405,7 +643,7 @@ build_recurse(PQP_Model *m, int bn, int first_tri, int num_tris)
   delete [] tri_moment;
   covariance_from_accum(C,acc);
 #else
-  get_covariance_triverts(C,&m->tris[first_tri],num_tris);
+  get_covariance_centroid_triverts(C,mean,&m->tris[first_tri],num_tris);
 #endif
 
   Meigen(E, s, C);
@@ -424,9 +662,12 @@ build_recurse(PQP_Model *m, int bn, int first_tri, int num_tris)
   R[1][2] = E[0][mid]*E[2][max] - E[0][max]*E[2][mid];
   R[2][2] = E[0][max]*E[1][mid] - E[0][mid]*E[1][max];
 
-  // fit the BV
+  // fit the BV, the box is only kept when the model has OBBs, and goes
+  // after the RSS, which it overwrites in an OBB-only model
 
-  b->FitToTris(R, &m->tris[first_tri], num_tris);
+  OBB box;
+  b->FitToTris(R, &m->tris[first_tri], num_tris, &box);
+  if (m->obb) *m->child_obb(bn) = box;
 
   if (num_tris == 1)
   {
@@ -438,8 +679,7 @@ build_recurse(PQP_Model *m, int bn, int first_tri, int num_tris)
   {
     // BV not a leaf - first_child will index a BV
 
-    b->first_child = m->num_bvs;
-    m->num_bvs+=2;
+    b->first_child = first_free_bv;
 
     // choose splitting axis and splitting coord
 
@@ -447,21 +687,32 @@ build_recurse(PQP_Model *m, int bn, int first_tri, int num_tris)
 
 #if RAPID2_FIT
     mean_from_accum(mean,acc);
-#else
-    get_centroid_triverts(mean,&m->tris[first_tri],num_tris);
 #endif
     coord = VdotV(axis, mean);
 
     // now split
 
-    int num_first_half = split_tris(&m->tris[first_tri], num_tris, 
-                                    axis, coord);
+    int num_first_half;
+    if (split_rule == PQP_SPLIT_MEDIAN)
+      num_first_half = split_tris_median(&m->tris[first_tri], num_tris, axis);
+    else if (split_rule == PQP_SPLIT_SAH)
+      num_first_half = split_tris_sah(&m->tris[first_tri], num_tris, R);
+    else
+      num_first_half = split_tris(&m->tris[first_tri], num_tris, 
+                                  axis, coord);
+
+    // recursively build the children, the descendants of the first
+    // child take the 2*(num_first_half-1) BVs following both children
 
-    // recursively build the children
+    int first_child = b->first_child;
+    int second_free_bv = first_free_bv + 2*num_first_half;
 
-    build_recurse(m, m->child(bn)->first_child, first_tri, num_first_half); 
-    build_recurse(m, m->child(bn)->first_child + 1,
-                  first_tri + num_first_half, num_tris - num_first_half); 
+#pragma omp task if(num_first_half > PARALLEL_SUBTREE_TRIS)
+    build_recurse(m, first_child, first_tri, num_first_half,
+                  first_free_bv + 2, split_rule);
+    build_recurse(m, first_child + 1, first_tri + num_first_half,
+                  num_tris - num_first_half, second_free_bv, split_rule);
+#pragma omp taskwait
   }
   return PQP_OK;
 }
@@ -484,6 +735,10 @@ make_parent_relative(PQP_Model *m, int bn,
 
   if (!m->child(bn)->Leaf())
   {
+#if PQP_BV_TYPE & OBB_TYPE
+    const PQP_REAL *To = m->obb ? m->child_obb(bn)->To : 0;
+#endif
+
     // make children parent-relative
 
     make_parent_relative(m,m->child(bn)->first_child, 
@@ -492,7 +747,7 @@ make_parent_relative(PQP_Model *m, int bn,
                          ,m->child(bn)->Tr
 #endif
 #if PQP_BV_TYPE & OBB_TYPE
-                         ,m->child(bn)->To
+                         ,To
 #endif
                          );
     make_parent_relative(m,m->child(bn)->first_child+1, 
@@ -501,7 +756,7 @@ make_parent_relative(PQP_Model *m, int bn,
                          ,m->child(bn)->Tr
 #endif
 #if PQP_BV_TYPE & OBB_TYPE
-                         ,m->child(bn)->To
+                         ,To
 #endif
                          );
   }
@@ -511,26 +766,32 @@ make_parent_relative(PQP_Model *m, int bn,
   MTxM(Rpc,parentR,m->child(bn)->R);
   McM(m->child(bn)->R,Rpc);
 #if PQP_BV_TYPE & RSS_TYPE
-  VmV(Tpc,m->child(bn)->Tr,parentTr);
-  MTxV(m->child(bn)->Tr,parentR,Tpc);
+  if (m->bv_type & RSS_TYPE)
+  {
+    VmV(Tpc,m->child(bn)->Tr,parentTr);
+    MTxV(m->child(bn)->Tr,parentR,Tpc);
+  }
 #endif
 #if PQP_BV_TYPE & OBB_TYPE
-  VmV(Tpc,m->child(bn)->To,parentTo);
-  MTxV(m->child(bn)->To,parentR,Tpc);
+  if (m->bv_type & OBB_TYPE)
+  {
+    VmV(Tpc,m->child_obb(bn)->To,parentTo);
+    MTxV(m->child_obb(bn)->To,parentR,Tpc);
+  }
 #endif
 
 }
 
 int
-build_model(PQP_Model *m)
+build_model(PQP_Model *m, int split_rule)
 {
-  // set num_bvs to 1, the first index for a child bv
-
-  m->num_bvs = 1;
+  // build recursively, the first index for a child bv is 1
 
-  // build recursively
+#pragma omp parallel if(m->num_tris > PARALLEL_SUBTREE_TRIS)
+#pragma omp single
+  build_recurse(m, 0, 0, m->num_tris, 1, split_rule);
 
-  build_recurse(m, 0, 0, m->num_tris);
+  m->num_bvs = 2*m->num_tris - 1;
 
   // change BV orientations from world-relative to parent-relative
 
@@ -44,6 +44,6 @@
 #include "PQP.h"
 
 int
-build_model(PQP_Model *m);
+build_model(PQP_Model *m, int split_rule = PQP_SPLIT_MEAN);
 
 #endif
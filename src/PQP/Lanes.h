@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef PQP_LANES_H
+#define PQP_LANES_H
+
+#include "PQP_Compile.h"
+
+// Lanes holds PQP_LANES PQP_REALs processed together by SIMD instructions:
+// 8 with AVX, 4 with SSE2 and 1 otherwise or if PQP_NO_SIMD is defined.
+// Comparisons give masks, all bits set in the lanes where they hold,
+// which Select() and LaneBits() consume.
+
+#if !defined(PQP_NO_SIMD) && defined(__AVX__)
+#define PQP_SIMD 2
+#define PQP_LANES 8
+#elif !defined(PQP_NO_SIMD) && defined(__SSE2__)
+#define PQP_SIMD 1
+#define PQP_LANES 4
+#else
+#define PQP_SIMD 0
+#define PQP_LANES 1
+#endif
+
+#if PQP_SIMD
+static_assert(sizeof(PQP_REAL) == sizeof(float),
+              "SIMD lanes need float PQP_REAL, define PQP_NO_SIMD");
+#endif
+
+#if PQP_SIMD == 2
+
+#include <immintrin.h>
+
+struct Lanes
+{
+  __m256 v;
+  Lanes() {}
+  Lanes(__m256 x) : v(x) {}
+  Lanes(PQP_REAL x) : v(_mm256_set1_ps(x)) {}
+};
+
+inline Lanes operator+(Lanes a, Lanes b) { return _mm256_add_ps(a.v,b.v); }
+inline Lanes operator-(Lanes a, Lanes b) { return _mm256_sub_ps(a.v,b.v); }
+inline Lanes operator*(Lanes a, Lanes b) { return _mm256_mul_ps(a.v,b.v); }
+inline Lanes operator/(Lanes a, Lanes b) { return _mm256_div_ps(a.v,b.v); }
+inline Lanes operator&(Lanes a, Lanes b) { return _mm256_and_ps(a.v,b.v); }
+inline Lanes operator|(Lanes a, Lanes b) { return _mm256_or_ps(a.v,b.v); }
+inline Lanes Min(Lanes a, Lanes b) { return _mm256_min_ps(a.v,b.v); }
+inline Lanes Max(Lanes a, Lanes b) { return _mm256_max_ps(a.v,b.v); }
+inline Lanes Less(Lanes a, Lanes b)
+{ return _mm256_cmp_ps(a.v,b.v,_CMP_LT_OQ); }
+inline Lanes LessEqual(Lanes a, Lanes b)
+{ return _mm256_cmp_ps(a.v,b.v,_CMP_LE_OQ); }
+inline Lanes Select(Lanes mask, Lanes a, Lanes b)
+{ return _mm256_blendv_ps(b.v,a.v,mask.v); }
+inline Lanes LoadLanes(const PQP_REAL *x) { return _mm256_loadu_ps(x); }
+inline void StoreLanes(PQP_REAL *x, Lanes a) { _mm256_storeu_ps(x,a.v); }
+inline Lanes Abs(Lanes a)
+{ return _mm256_andnot_ps(_mm256_set1_ps(-0.0f),a.v); }
+inline int LaneBits(Lanes mask) { return _mm256_movemask_ps(mask.v); }
+
+#elif PQP_SIMD == 1
+
+#include <emmintrin.h>
+
+struct Lanes
+{
+  __m128 v;
+  Lanes() {}
+  Lanes(__m128 x) : v(x) {}
+  Lanes(PQP_REAL x) : v(_mm_set1_ps(x)) {}
+};
+
+inline Lanes operator+(Lanes a, Lanes b) { return _mm_add_ps(a.v,b.v); }
+inline Lanes operator-(Lanes a, Lanes b) { return _mm_sub_ps(a.v,b.v); }
+inline Lanes operator*(Lanes a, Lanes b) { return _mm_mul_ps(a.v,b.v); }
+inline Lanes operator/(Lanes a, Lanes b) { return _mm_div_ps(a.v,b.v); }
+inline Lanes operator&(Lanes a, Lanes b) { return _mm_and_ps(a.v,b.v); }
+inline Lanes operator|(Lanes a, Lanes b) { return _mm_or_ps(a.v,b.v); }
+inline Lanes Min(Lanes a, Lanes b) { return _mm_min_ps(a.v,b.v); }
+inline Lanes Max(Lanes a, Lanes b) { return _mm_max_ps(a.v,b.v); }
+inline Lanes Less(Lanes a, Lanes b) { return _mm_cmplt_ps(a.v,b.v); }
+inline Lanes LessEqual(Lanes a, Lanes b) { return _mm_cmple_ps(a.v,b.v); }
+inline Lanes Select(Lanes mask, Lanes a, Lanes b)
+{ return _mm_or_ps(_mm_and_ps(mask.v,a.v),_mm_andnot_ps(mask.v,b.v)); }
+inline Lanes LoadLanes(const PQP_REAL *x) { return _mm_loadu_ps(x); }
+inline void StoreLanes(PQP_REAL *x, Lanes a) { _mm_storeu_ps(x,a.v); }
+inline Lanes Abs(Lanes a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f),a.v); }
+inline int LaneBits(Lanes mask) { return _mm_movemask_ps(mask.v); }
+
+#else
+
+// scalar fallback, one lane; masks are all ones or all zeros floats
+
+struct Lanes
+{
+  PQP_REAL v;
+  Lanes() {}
+  Lanes(PQP_REAL x) : v(x) {}
+};
+
+inline Lanes operator+(Lanes a, Lanes b) { return a.v + b.v; }
+inline Lanes operator-(Lanes a, Lanes b) { return a.v - b.v; }
+inline Lanes operator*(Lanes a, Lanes b) { return a.v * b.v; }
+inline Lanes operator/(Lanes a, Lanes b) { return a.v / b.v; }
+inline Lanes operator&(Lanes a, Lanes b) { return (a.v != 0) && (b.v != 0); }
+inline Lanes operator|(Lanes a, Lanes b) { return (a.v != 0) || (b.v != 0); }
+inline Lanes Min(Lanes a, Lanes b) { return (a.v < b.v) ? a : b; }
+inline Lanes Max(Lanes a, Lanes b) { return (a.v > b.v) ? a : b; }
+inline Lanes Less(Lanes a, Lanes b) { return a.v < b.v; }
+inline Lanes LessEqual(Lanes a, Lanes b) { return a.v <= b.v; }
+inline Lanes Select(Lanes mask, Lanes a, Lanes b)
+{ return (mask.v != 0) ? a : b; }
+inline Lanes LoadLanes(const PQP_REAL *x) { return *x; }
+inline void StoreLanes(PQP_REAL *x, Lanes a) { *x = a.v; }
+inline Lanes Abs(Lanes a) { return (a.v < 0) ? -a.v : a.v; }
+inline int LaneBits(Lanes mask) { return mask.v != 0; }
+
+#endif
+
+#endif
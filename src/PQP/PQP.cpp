@@ -39,7 +39,11 @@
 \**************************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <new>
+#include <vector>
 #include "PQP.h"
 #include "BVTQ.h"
 #include "Build.h"
@@ -54,13 +58,77 @@ enum BUILD_STATE
   PQP_BUILD_STATE_PROCESSED  // after tree has been built, ready to use
 };
 
+// BV arrays are allocated aligned to PQP_BV_ALIGNMENT, so that no BV
+// straddles two cache lines
+
+static BV *
+NewBVs(int n)
+{
+  void *mem = 0;
+  if (posix_memalign(&mem, PQP_BV_ALIGNMENT, sizeof(BV)*n) != 0)
+    return 0;
+  BV *bvs = static_cast<BV *>(mem);
+  for (int i = 0; i < n; i++) new (&bvs[i]) BV;
+  return bvs;
+}
+
+static void
+DeleteBVs(BV *bvs, int n)
+{
+  if (bvs == NULL) return;
+  for (int i = 0; i < n; i++) bvs[i].~BV();
+  free(bvs);
+}
+
+// OBB storage of a model with BV array b of n BVs. With both types the
+// boxes get an array of their own; an OBB-only model stores each box in
+// the RSS fields of its BV, which it has no other use for.
+
+#if PQP_BV_TYPE & RSS_TYPE
+static_assert(sizeof(OBB) == sizeof(BV::Tr) + sizeof(BV::l) + sizeof(BV::r),
+              "an OBB must fit the RSS fields of a BV");
+#endif
+
+static int
+NewOBBs(PQP_Model *m, int n)
+{
+  m->obb = 0;
+  m->obb_stride = 0;
+  if (!(m->bv_type & OBB_TYPE)) return 1;
+
+#if PQP_BV_TYPE & RSS_TYPE
+  if (!(m->bv_type & RSS_TYPE))
+  {
+    m->obb = reinterpret_cast<OBB *>(m->b[0].Tr);
+    m->obb_stride = sizeof(BV);
+    return 1;
+  }
+#endif
+
+  m->obb = new OBB[n];
+  m->obb_stride = sizeof(OBB);
+  return m->obb != 0;
+}
+
+static void
+DeleteOBBs(PQP_Model *m)
+{
+  if (m->obb_stride == sizeof(OBB))
+    delete [] m->obb;
+  m->obb = 0;
+  m->obb_stride = 0;
+}
+
 PQP_Model::PQP_Model()
 {
   // no bounding volume tree yet
 
   b = 0;
+  obb = 0;
+  obb_stride = 0;
   num_bvs_alloced = 0;
   num_bvs = 0;
+  bv_type = PQP_BV_TYPE;
 
   // no tri list yet
 
@@ -75,8 +143,8 @@ PQP_Model::PQP_Model()
 
 PQP_Model::~PQP_Model()
 {
-  if (b != NULL)
-    delete [] b;
+  DeleteOBBs(this);
+  DeleteBVs(b, num_bvs_alloced);
   if (tris != NULL)
     delete [] tris;
 }
@@ -88,8 +156,10 @@ PQP_Model::BeginModel(int n)
 
   if (build_state != PQP_BUILD_STATE_EMPTY)
   {
-    delete [] b;
+    DeleteOBBs(this);
+    DeleteBVs(b, num_bvs_alloced);
     delete [] tris;
+    b = 0;
 
     num_tris = num_bvs = num_tris_alloced = num_bvs_alloced = 0;
   }
@@ -181,7 +251,7 @@ PQP_Model::AddTri(const PQP_REAL *p1,
 }
 
 int
-PQP_Model::EndModel()
+PQP_Model::EndModel(int split_rule, int bv_type)
 {
   if (build_state == PQP_BUILD_STATE_PROCESSED)
   {
@@ -192,6 +262,13 @@ PQP_Model::EndModel()
     return PQP_ERR_BUILD_OUT_OF_SEQUENCE;
   }
 
+  if (bv_type == 0 || (bv_type & ~(PQP_BV_TYPE)) != 0)
+  {
+    fprintf(stderr,"PQP Error! EndModel() called with BV types %d,"
+                   " only %d are compiled in\n", bv_type, (PQP_BV_TYPE));
+    return PQP_ERR_UNSUPPORTED_BV_TYPE;
+  }
+
   // report error is no tris
 
   if (num_tris == 0)
@@ -220,8 +297,9 @@ PQP_Model::EndModel()
 
   // create an array of BVs for the model
 
-  b = new BV[2*num_tris - 1];
-  if (!b)
+  this->bv_type = bv_type;
+  b = NewBVs(2*num_tris - 1);
+  if (!b || !NewOBBs(this, 2*num_tris - 1))
   {
     fprintf(stderr,"PQP Error! out of memory for BV array "
                    "in EndModel()\n");
@@ -232,7 +310,53 @@ PQP_Model::EndModel()
 
   // we should build the model now.
 
-  build_model(this);
+  build_model(this, split_rule);
+  build_state = PQP_BUILD_STATE_PROCESSED;
+
+  last_tri = tris;
+
+  return PQP_OK;
+}
+
+int
+PQP_Model::LoadBuiltModel(const Tri *t, int nt, const BV *bvs,
+                          const OBB *obbs, int nb, int bv_type)
+{
+  if (build_state != PQP_BUILD_STATE_EMPTY)
+  {
+    fprintf(stderr,"PQP Error! LoadBuiltModel() called on a PQP_Model \n"
+                   "that was not empty.\n");
+    return PQP_ERR_BUILD_OUT_OF_SEQUENCE;
+  }
+
+  if (bv_type == 0 || (bv_type & ~(PQP_BV_TYPE)) != 0)
+  {
+    fprintf(stderr,"PQP Error! LoadBuiltModel() called with BV types %d,"
+                   " only %d are compiled in\n", bv_type, (PQP_BV_TYPE));
+    return PQP_ERR_UNSUPPORTED_BV_TYPE;
+  }
+
+  if (nt <= 0 || nb <= 0)
+  {
+    fprintf(stderr,"PQP Error! LoadBuiltModel() called with no triangles\n");
+    return PQP_ERR_BUILD_EMPTY_MODEL;
+  }
+
+  this->bv_type = bv_type;
+  tris = new Tri[nt];
+  b = NewBVs(nb);
+  if (!tris || !b || !NewOBBs(this, nb))
+  {
+    fprintf(stderr,"PQP Error! Out of memory in LoadBuiltModel()\n");
+    return PQP_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  memcpy(tris, t, sizeof(Tri)*nt);
+  std::copy(bvs, bvs + nb, b);
+  if (obb_stride == sizeof(OBB))
+    memcpy(obb, obbs, sizeof(OBB)*nb);
+  num_tris = num_tris_alloced = nt;
+  num_bvs = num_bvs_alloced = nb;
+
   build_state = PQP_BUILD_STATE_PROCESSED;
 
   last_tri = tris;
@@ -243,16 +367,18 @@ PQP_Model::EndModel()
 int
 PQP_Model::MemUsage(int msg)
 {
-  int mem_bv_list = sizeof(BV)*num_bvs;
+  int bv_size = sizeof(BV);
+  if (obb_stride == sizeof(OBB)) bv_size += sizeof(OBB);
+  int mem_bv_list = bv_size*num_bvs;
   int mem_tri_list = sizeof(Tri)*num_tris;
 
   int total_mem = mem_bv_list + mem_tri_list + sizeof(PQP_Model);
 
   if (msg)
   {
-    fprintf(stderr,"Total for model %x: %d bytes\n", this, total_mem);
-    fprintf(stderr,"BVs: %d alloced, take %lu bytes each\n",
-            num_bvs, sizeof(BV));
+    fprintf(stderr,"Total for model %p: %d bytes\n", (void*)this, total_mem);
+    fprintf(stderr,"BVs: %d alloced, take %d bytes each\n",
+            num_bvs, bv_size);
     fprintf(stderr,"Tris: %d alloced, take %lu bytes each\n",
             num_tris, sizeof(Tri));
   }
@@ -270,6 +396,7 @@ PQP_CollideResult::PQP_CollideResult()
   num_pairs = num_pairs_alloced = 0;
   num_bv_tests = 0;
   num_tri_tests = 0;
+  obb_tests = 0;
 }
 
 PQP_CollideResult::~PQP_CollideResult()
@@ -478,6 +605,98 @@ TriDistance(PQP_REAL R[3][3], PQP_REAL T[3], Tri *t1, Tri *t2,
 }
 
 
+// tests the triangles of leaves b1 and b2, adding them to the result
+// if they touch
+
+inline
+void
+CollideTris(PQP_CollideResult *res,
+            PQP_Model *o1, int b1, PQP_Model *o2, int b2)
+{
+  res->num_tri_tests++;
+
+#if 1
+  // transform the points in b2 into space of b1, then compare
+
+  Tri *t1 = &o1->tris[-o1->child(b1)->first_child - 1];
+  Tri *t2 = &o2->tris[-o2->child(b2)->first_child - 1];
+  PQP_REAL q1[3], q2[3], q3[3];
+  PQP_REAL *p1 = t1->p1;
+  PQP_REAL *p2 = t1->p2;
+  PQP_REAL *p3 = t1->p3;
+  MxVpV(q1, res->R, t2->p1, res->T);
+  MxVpV(q2, res->R, t2->p2, res->T);
+  MxVpV(q3, res->R, t2->p3, res->T);
+  if (TriContact(p1, p2, p3, q1, q2, q3))
+  {
+    // add this to result
+
+    res->Add(t1->id, t2->id);
+  }
+#else
+  PQP_REAL p[3], q[3];
+
+  Tri *t1 = &o1->tris[-o1->child(b1)->first_child - 1];
+  Tri *t2 = &o2->tris[-o2->child(b2)->first_child - 1];
+
+  if (TriDistance(res->R,res->T,t1,t2,p,q) == 0.0)
+  {
+    // add this to result
+
+    res->Add(t1->id, t2->id);
+  }
+#endif
+}
+
+// box of BV n of model o for the overlap tests of res, or none when the
+// RSSs are tested
+
+inline
+OBB *
+CollideBox(PQP_CollideResult *res, PQP_Model *o, int n)
+{
+  return res->obb_tests ? o->child_obb(n) : 0;
+}
+
+// origin of the frame of BV n of model o for the overlap tests of res
+
+inline
+PQP_REAL *
+CollideOrigin(PQP_CollideResult *res, PQP_Model *o, int n)
+{
+#if PQP_BV_TYPE & RSS_TYPE
+  if (!res->obb_tests) return o->child(n)->Tr;
+#endif
+  return o->child_obb(n)->To;
+}
+
+// transform [Rc,Tc] of b2 relative to child c of b1, from the transform
+// [R,T] of b2 relative to b1
+
+inline
+void
+ChildTransform1(PQP_CollideResult *res, PQP_REAL Rc[3][3], PQP_REAL Tc[3],
+                PQP_REAL R[3][3], PQP_REAL T[3], PQP_Model *o1, int c)
+{
+  PQP_REAL Ttemp[3];
+
+  MTxM(Rc,o1->child(c)->R,R);
+  VmV(Ttemp,T,CollideOrigin(res,o1,c));
+  MTxV(Tc,o1->child(c)->R,Ttemp);
+}
+
+// transform [Rc,Tc] of child c of b2 relative to b1, from the transform
+// [R,T] of b2 relative to b1
+
+inline
+void
+ChildTransform2(PQP_CollideResult *res, PQP_REAL Rc[3][3], PQP_REAL Tc[3],
+                PQP_REAL R[3][3], PQP_REAL T[3], PQP_Model *o2, int c)
+{
+  MxM(Rc,R,o2->child(c)->R);
+  MxVpV(Tc,R,CollideOrigin(res,o2,c),T);
+}
+
 void
 CollideRecurse(PQP_CollideResult *res,
                PQP_REAL R[3][3], PQP_REAL T[3], // b2 relative to b1
@@ -488,7 +707,10 @@ CollideRecurse(PQP_CollideResult *res,
 
   res->num_bv_tests++;
 
-  if (!BV_Overlap(R, T, o1->child(b1), o2->child(b2))) return;
+  OBB *obb1 = CollideBox(res, o1, b1);
+  OBB *obb2 = CollideBox(res, o2, b2);
+
+  if (!BV_Overlap(R, T, o1->child(b1), obb1, o2->child(b2), obb2)) return;
 
   // if we are, see if we test triangles next
 
@@ -497,73 +719,28 @@ CollideRecurse(PQP_CollideResult *res,
 
   if (l1 && l2)
   {
-    res->num_tri_tests++;
-
-#if 1
-    // transform the points in b2 into space of b1, then compare
-
-    Tri *t1 = &o1->tris[-o1->child(b1)->first_child - 1];
-    Tri *t2 = &o2->tris[-o2->child(b2)->first_child - 1];
-    PQP_REAL q1[3], q2[3], q3[3];
-    PQP_REAL *p1 = t1->p1;
-    PQP_REAL *p2 = t1->p2;
-    PQP_REAL *p3 = t1->p3;
-    MxVpV(q1, res->R, t2->p1, res->T);
-    MxVpV(q2, res->R, t2->p2, res->T);
-    MxVpV(q3, res->R, t2->p3, res->T);
-    if (TriContact(p1, p2, p3, q1, q2, q3))
-    {
-      // add this to result
-
-      res->Add(t1->id, t2->id);
-    }
-#else
-    PQP_REAL p[3], q[3];
-
-    Tri *t1 = &o1->tris[-o1->child(b1)->first_child - 1];
-    Tri *t2 = &o2->tris[-o2->child(b2)->first_child - 1];
-
-    if (TriDistance(res->R,res->T,t1,t2,p,q) == 0.0)
-    {
-      // add this to result
-
-      res->Add(t1->id, t2->id);
-    }
-#endif
-
+    CollideTris(res, o1, b1, o2, b2);
     return;
   }
 
   // we dont, so decide whose children to visit next
 
-  PQP_REAL sz1 = o1->child(b1)->GetSize();
-  PQP_REAL sz2 = o2->child(b2)->GetSize();
+  PQP_REAL sz1 = o1->child(b1)->GetSize(obb1);
+  PQP_REAL sz2 = o2->child(b2)->GetSize(obb2);
 
-  PQP_REAL Rc[3][3],Tc[3],Ttemp[3];
+  PQP_REAL Rc[3][3],Tc[3];
 
   if (l2 || (!l1 && (sz1 > sz2)))
   {
     int c1 = o1->child(b1)->first_child;
     int c2 = c1 + 1;
 
-    MTxM(Rc,o1->child(c1)->R,R);
-#if PQP_BV_TYPE & OBB_TYPE
-    VmV(Ttemp,T,o1->child(c1)->To);
-#else
-    VmV(Ttemp,T,o1->child(c1)->Tr);
-#endif
-    MTxV(Tc,o1->child(c1)->R,Ttemp);
+    ChildTransform1(res,Rc,Tc,R,T,o1,c1);
     CollideRecurse(res,Rc,Tc,o1,c1,o2,b2,flag);
 
     if ((flag == PQP_FIRST_CONTACT) && (res->num_pairs > 0)) return;
 
-    MTxM(Rc,o1->child(c2)->R,R);
-#if PQP_BV_TYPE & OBB_TYPE
-    VmV(Ttemp,T,o1->child(c2)->To);
-#else
-    VmV(Ttemp,T,o1->child(c2)->Tr);
-#endif
-    MTxV(Tc,o1->child(c2)->R,Ttemp);
+    ChildTransform1(res,Rc,Tc,R,T,o1,c2);
     CollideRecurse(res,Rc,Tc,o1,c2,o2,b2,flag);
   }
   else
@@ -571,26 +748,115 @@ CollideRecurse(PQP_CollideResult *res,
     int c1 = o2->child(b2)->first_child;
     int c2 = c1 + 1;
 
-    MxM(Rc,R,o2->child(c1)->R);
-#if PQP_BV_TYPE & OBB_TYPE
-    MxVpV(Tc,R,o2->child(c1)->To,T);
-#else
-    MxVpV(Tc,R,o2->child(c1)->Tr,T);
-#endif
+    ChildTransform2(res,Rc,Tc,R,T,o2,c1);
     CollideRecurse(res,Rc,Tc,o1,b1,o2,c1,flag);
 
     if ((flag == PQP_FIRST_CONTACT) && (res->num_pairs > 0)) return;
 
-    MxM(Rc,R,o2->child(c2)->R);
-#if PQP_BV_TYPE & OBB_TYPE
-    MxVpV(Tc,R,o2->child(c2)->To,T);
-#else
-    MxVpV(Tc,R,o2->child(c2)->Tr,T);
-#endif
+    ChildTransform2(res,Rc,Tc,R,T,o2,c2);
     CollideRecurse(res,Rc,Tc,o1,b1,o2,c2,flag);
   }
 }
 
+#if PQP_SIMD
+
+// BV pair waiting for its overlap test, b2 placed by R, T relative to b1
+
+struct CollidePair
+{
+  PQP_REAL R[3][3];
+  PQP_REAL T[3];
+  int b1, b2;
+};
+
+// the traversal of CollideRecurse(), but with the pairs waiting for their
+// overlap test kept on a stack, so that PQP_LANES of them are tested at
+// once in SIMD lanes
+
+void
+CollideLanes(PQP_CollideResult *res,
+             PQP_REAL R[3][3], PQP_REAL T[3], // o2 root relative to o1 root
+             PQP_Model *o1, PQP_Model *o2, int flag)
+{
+  std::vector<CollidePair> stack(1);
+  McM(stack[0].R,R);
+  VcV(stack[0].T,T);
+  stack[0].b1 = 0;
+  stack[0].b2 = 0;
+
+  CollidePair pairs[PQP_LANES];
+  PQP_REAL Rs[PQP_LANES][3][3], Ts[PQP_LANES][3];
+  BV *bv1[PQP_LANES], *bv2[PQP_LANES];
+  OBB *obb1[PQP_LANES], *obb2[PQP_LANES];
+
+  while (!stack.empty())
+  {
+    int n = 0;
+    while (n < PQP_LANES && !stack.empty())
+    {
+      pairs[n] = stack.back();
+      stack.pop_back();
+      McM(Rs[n],pairs[n].R);
+      VcV(Ts[n],pairs[n].T);
+      bv1[n] = o1->child(pairs[n].b1);
+      obb1[n] = CollideBox(res, o1, pairs[n].b1);
+      bv2[n] = o2->child(pairs[n].b2);
+      obb2[n] = CollideBox(res, o2, pairs[n].b2);
+      n++;
+    }
+
+    res->num_bv_tests += n;
+    int overlap = BV_OverlapLanes(Rs, Ts, bv1, obb1, bv2, obb2, n);
+
+    // the children of the first pair popped end up on top of the stack
+
+    for (int k = n - 1; k >= 0; k--)
+    {
+      if (!(overlap & (1 << k))) continue;
+
+      int b1 = pairs[k].b1, b2 = pairs[k].b2;
+      int l1 = bv1[k]->Leaf();
+      int l2 = bv2[k]->Leaf();
+
+      if (l1 && l2)
+      {
+        CollideTris(res, o1, b1, o2, b2);
+        if ((flag == PQP_FIRST_CONTACT) && (res->num_pairs > 0)) return;
+        continue;
+      }
+
+      PQP_REAL sz1 = bv1[k]->GetSize(obb1[k]);
+      PQP_REAL sz2 = bv2[k]->GetSize(obb2[k]);
+
+      CollidePair child[2];
+      if (l2 || (!l1 && (sz1 > sz2)))
+      {
+        for (int i = 0; i < 2; i++)
+        {
+          child[i].b1 = bv1[k]->first_child + i;
+          child[i].b2 = b2;
+          ChildTransform1(res,child[i].R,child[i].T,
+                          pairs[k].R,pairs[k].T,o1,child[i].b1);
+        }
+      }
+      else
+      {
+        for (int i = 0; i < 2; i++)
+        {
+          child[i].b1 = b1;
+          child[i].b2 = bv2[k]->first_child + i;
+          ChildTransform2(res,child[i].R,child[i].T,
+                          pairs[k].R,pairs[k].T,o2,child[i].b2);
+        }
+      }
+      stack.push_back(child[1]);
+      stack.push_back(child[0]);
+    }
+  }
+}
+
+#endif
+
 int
 PQP_Collide(PQP_CollideResult *res,
             PQP_REAL R1[3][3], PQP_REAL T1[3], PQP_Model *o1,
@@ -606,6 +872,12 @@ PQP_Collide(PQP_CollideResult *res,
   if (o2->build_state != PQP_BUILD_STATE_PROCESSED)
     return PQP_ERR_UNPROCESSED_MODEL;
 
+  // test OBBs when both models have them, RSSs otherwise
+
+  res->obb_tests = (o1->bv_type & o2->bv_type & OBB_TYPE) != 0;
+  if (!res->obb_tests && !(o1->bv_type & o2->bv_type & RSS_TYPE))
+    return PQP_ERR_UNSUPPORTED_BV_TYPE;
+
   // clear the stats
 
   res->num_bv_tests = 0;
@@ -631,19 +903,18 @@ PQP_Collide(PQP_CollideResult *res,
   MxM(Rtemp,res->R,o2->child(0)->R);
   MTxM(R,o1->child(0)->R,Rtemp);
 
-#if PQP_BV_TYPE & OBB_TYPE
-  MxVpV(Ttemp,res->R,o2->child(0)->To,res->T);
-  VmV(Ttemp,Ttemp,o1->child(0)->To);
-#else
-  MxVpV(Ttemp,res->R,o2->child(0)->Tr,res->T);
-  VmV(Ttemp,Ttemp,o1->child(0)->Tr);
-#endif
+  MxVpV(Ttemp,res->R,CollideOrigin(res,o2,0),res->T);
+  VmV(Ttemp,Ttemp,CollideOrigin(res,o1,0));
 
   MTxV(T,o1->child(0)->R,Ttemp);
 
   // now start with both top level BVs
 
+#if PQP_SIMD
+  CollideLanes(res,R,T,o1,o2,flag);
+#else
   CollideRecurse(res,R,T,o1,0,o2,0,flag);
+#endif
 
   double t2 = GetTime();
   res->query_time_secs = t2 - t1;
@@ -659,14 +930,130 @@ PQP_Collide(PQP_CollideResult *res,
 //
 //--------------------------------------------------------------------------
 
+PQP_DistanceResult::PQP_DistanceResult()
+{
+  last_tri1 = 0;
+  last_tri2 = 0;
+  upper_bound = -1;
+}
+
+// remember the closest tri pair, either in the result (if the caller
+// keeps its own warm start there) or in the models
+
+inline
+void
+SetLastTris(PQP_DistanceResult *res,
+            PQP_Model *o1, Tri *t1, PQP_Model *o2, Tri *t2)
+{
+  if (res->last_tri1 && res->last_tri2)
+  {
+    res->last_tri1 = t1;
+    res->last_tri2 = t2;
+  }
+  else
+  {
+    o1->last_tri = t1;
+    o2->last_tri = t2;
+  }
+}
+
+#if PQP_SIMD
+
+// collects the triangles of the subtree at BV b of o, if there are at
+// most TRIDIST_BATCH of them; returns their count, or 0 if there are more
+
+inline
+int
+SubtreeTris(PQP_Model *o, int b, Tri *tris[TRIDIST_BATCH])
+{
+  int stack[TRIDIST_BATCH];
+  int size = 1, n = 0;
+  stack[0] = b;
+  while (size > 0)
+  {
+    BV *bv = o->child(stack[--size]);
+    if (bv->Leaf())
+      tris[n++] = &o->tris[-bv->first_child - 1];
+    else
+    {
+      // every pending BV holds at least one triangle
+      if (n + size + 2 > TRIDIST_BATCH) return 0;
+      stack[size++] = bv->first_child + 1;
+      stack[size++] = bv->first_child;
+    }
+  }
+  return n;
+}
+
+// distance of the triangle of leaf b1 to the n triangles beneath b2, or
+// of the triangle of leaf b2 to the n triangles beneath b1 if swap,
+// computed at once instead of descending to the leaf pairs
+
+void
+BatchDistance(PQP_DistanceResult *res,
+              PQP_Model *o1, int b1, PQP_Model *o2, int b2,
+              Tri *batch[TRIDIST_BATCH], int n, int swap)
+{
+  res->num_tri_tests += n;
+
+  PQP_REAL s[3][3], t[TRIDIST_BATCH][3][3], p[3], q[3], d;
+
+  if (!swap)
+  {
+    Tri *t1 = &o1->tris[-o1->child(b1)->first_child - 1];
+    VcV(s[0], t1->p1);
+    VcV(s[1], t1->p2);
+    VcV(s[2], t1->p3);
+    for (int k = 0; k < n; k++)
+    {
+      MxVpV(t[k][0], res->R, batch[k]->p1, res->T);
+      MxVpV(t[k][1], res->R, batch[k]->p2, res->T);
+      MxVpV(t[k][2], res->R, batch[k]->p3, res->T);
+    }
+
+    int k = TriDistBatch(&d, p, q, s, t, n);
+    if (d < res->distance)
+    {
+      res->distance = d;
+      VcV(res->p1, p);
+      VcV(res->p2, q);
+      SetLastTris(res,o1,t1,o2,batch[k]);
+    }
+  }
+  else
+  {
+    Tri *t2 = &o2->tris[-o2->child(b2)->first_child - 1];
+    MxVpV(s[0], res->R, t2->p1, res->T);
+    MxVpV(s[1], res->R, t2->p2, res->T);
+    MxVpV(s[2], res->R, t2->p3, res->T);
+    for (int k = 0; k < n; k++)
+    {
+      VcV(t[k][0], batch[k]->p1);
+      VcV(t[k][1], batch[k]->p2);
+      VcV(t[k][2], batch[k]->p3);
+    }
+
+    int k = TriDistBatch(&d, p, q, s, t, n);
+    if (d < res->distance)
+    {
+      res->distance = d;
+      VcV(res->p1, q);
+      VcV(res->p2, p);
+      SetLastTris(res,o1,batch[k],o2,t2);
+    }
+  }
+}
+
+#endif
+
 void
 DistanceRecurse(PQP_DistanceResult *res,
                 PQP_REAL R[3][3], PQP_REAL T[3], // b2 relative to b1
                 PQP_Model *o1, int b1,
                 PQP_Model *o2, int b2)
 {
-  PQP_REAL sz1 = o1->child(b1)->GetSize();
-  PQP_REAL sz2 = o2->child(b2)->GetSize();
+  PQP_REAL sz1 = o1->child(b1)->GetSize(o1->child_obb(b1));
+  PQP_REAL sz2 = o2->child(b2)->GetSize(o2->child_obb(b2));
   int l1 = o1->child(b1)->Leaf();
   int l2 = o2->child(b2)->Leaf();
 
@@ -690,13 +1077,28 @@ DistanceRecurse(PQP_DistanceResult *res,
       VcV(res->p1, p);         // p already in c.s. 1
       VcV(res->p2, q);         // q must be transformed
                                // into c.s. 2 later
-      o1->last_tri = t1;
-      o2->last_tri = t2;
+      SetLastTris(res,o1,t1,o2,t2);
     }
 
     return;
   }
 
+#if PQP_SIMD
+  if (l1 != l2)
+  {
+    // a leaf against a subtree with a few triangles, which fill most of
+    // the lanes of a batched triangle test
+
+    Tri *batch[TRIDIST_BATCH];
+    int n = l1 ? SubtreeTris(o2, b2, batch) : SubtreeTris(o1, b1, batch);
+    if (2*n > TRIDIST_BATCH)
+    {
+      BatchDistance(res, o1, b1, o2, b2, batch, n, l2);
+      return;
+    }
+  }
+#endif
+
   // First, perform distance tests on the children. Then traverse
   // them recursively, but test the closer pair first, the further
   // pair second.
@@ -717,7 +1119,7 @@ DistanceRecurse(PQP_DistanceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
     VmV(Ttemp,T,o1->child(a1)->Tr);
 #else
-    VmV(Ttemp,T,o1->child(a1)->To);
+    VmV(Ttemp,T,o1->child_obb(a1)->To);
 #endif
     MTxV(T1,o1->child(a1)->R,Ttemp);
 
@@ -725,7 +1127,7 @@ DistanceRecurse(PQP_DistanceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
     VmV(Ttemp,T,o1->child(c1)->Tr);
 #else
-    VmV(Ttemp,T,o1->child(c1)->To);
+    VmV(Ttemp,T,o1->child_obb(c1)->To);
 #endif
     MTxV(T2,o1->child(c1)->R,Ttemp);
   }
@@ -742,14 +1144,14 @@ DistanceRecurse(PQP_DistanceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
     MxVpV(T1,R,o2->child(a2)->Tr,T);
 #else
-    MxVpV(T1,R,o2->child(a2)->To,T);
+    MxVpV(T1,R,o2->child_obb(a2)->To,T);
 #endif
 
     MxM(R2,R,o2->child(c2)->R);
 #if PQP_BV_TYPE & RSS_TYPE
     MxVpV(T2,R,o2->child(c2)->Tr,T);
 #else
-    MxVpV(T2,R,o2->child(c2)->To,T);
+    MxVpV(T2,R,o2->child_obb(c2)->To,T);
 #endif
   }
 
@@ -827,8 +1229,7 @@ DistanceQueueRecurse(PQP_DistanceResult *res,
         VcV(res->p1, p);         // p already in c.s. 1
         VcV(res->p2, q);         // q must be transformed
                                  // into c.s. 2 later
-        o1->last_tri = t1;
-        o2->last_tri = t2;
+        SetLastTris(res,o1,t1,o2,t2);
       }
     }
     else if (bvtq.GetNumTests() == bvtq.GetSize() - 1)
@@ -842,8 +1243,10 @@ DistanceQueueRecurse(PQP_DistanceResult *res,
     {
       // decide how to descend to children
 
-      PQP_REAL sz1 = o1->child(min_test.b1)->GetSize();
-      PQP_REAL sz2 = o2->child(min_test.b2)->GetSize();
+      PQP_REAL sz1 =
+        o1->child(min_test.b1)->GetSize(o1->child_obb(min_test.b1));
+      PQP_REAL sz2 =
+        o2->child(min_test.b2)->GetSize(o2->child_obb(min_test.b2));
 
       res->num_bv_tests += 2;
 
@@ -866,7 +1269,7 @@ DistanceQueueRecurse(PQP_DistanceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
         VmV(Ttemp,min_test.T,o1->child(c1)->Tr);
 #else
-        VmV(Ttemp,min_test.T,o1->child(c1)->To);
+        VmV(Ttemp,min_test.T,o1->child_obb(c1)->To);
 #endif
         MTxV(bvt1.T,o1->child(c1)->R,Ttemp);
         bvt1.d = BV_Distance(bvt1.R,bvt1.T,
@@ -880,7 +1283,7 @@ DistanceQueueRecurse(PQP_DistanceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
         VmV(Ttemp,min_test.T,o1->child(c2)->Tr);
 #else
-        VmV(Ttemp,min_test.T,o1->child(c2)->To);
+        VmV(Ttemp,min_test.T,o1->child_obb(c2)->To);
 #endif
         MTxV(bvt2.T,o1->child(c2)->R,Ttemp);
         bvt2.d = BV_Distance(bvt2.R,bvt2.T,
@@ -902,7 +1305,7 @@ DistanceQueueRecurse(PQP_DistanceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
         MxVpV(bvt1.T,min_test.R,o2->child(c1)->Tr,min_test.T);
 #else
-        MxVpV(bvt1.T,min_test.R,o2->child(c1)->To,min_test.T);
+        MxVpV(bvt1.T,min_test.R,o2->child_obb(c1)->To,min_test.T);
 #endif
         bvt1.d = BV_Distance(bvt1.R,bvt1.T,
                             o1->child(bvt1.b1),o2->child(bvt1.b2));
@@ -915,7 +1318,7 @@ DistanceQueueRecurse(PQP_DistanceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
         MxVpV(bvt2.T,min_test.R,o2->child(c2)->Tr,min_test.T);
 #else
-        MxVpV(bvt2.T,min_test.R,o2->child(c2)->To,min_test.T);
+        MxVpV(bvt2.T,min_test.R,o2->child_obb(c2)->To,min_test.T);
 #endif
         bvt2.d = BV_Distance(bvt2.R,bvt2.T,
                             o1->child(bvt2.b1),o2->child(bvt2.b2));
@@ -958,6 +1361,8 @@ PQP_Distance(PQP_DistanceResult *res,
     return PQP_ERR_UNPROCESSED_MODEL;
   if (o2->build_state != PQP_BUILD_STATE_PROCESSED)
     return PQP_ERR_UNPROCESSED_MODEL;
+  if (!(o1->bv_type & o2->bv_type & RSS_TYPE))
+    return PQP_ERR_UNSUPPORTED_BV_TYPE;
 
   // Okay, compute what transform [R,T] that takes us from cs2 to cs1.
   // [R,T] = [R1,T1]'[R2,T2] = [R1',-R1'T][R2,T2] = [R1'R2, R1'(T2-T1)]
@@ -972,10 +1377,21 @@ PQP_Distance(PQP_DistanceResult *res,
   // provided the minimum distance
 
   PQP_REAL p[3],q[3];
-  res->distance = TriDistance(res->R,res->T,o1->last_tri,o2->last_tri,p,q);
+  Tri *seed1 = o1->last_tri, *seed2 = o2->last_tri;
+  if (res->last_tri1 && res->last_tri2)
+  {
+    seed1 = res->last_tri1;
+    seed2 = res->last_tri2;
+  }
+  res->distance = TriDistance(res->R,res->T,seed1,seed2,p,q);
   VcV(res->p1,p);
   VcV(res->p2,q);
 
+  // a tighter upper bound known by the caller prunes more of the traversal
+
+  if (res->upper_bound > 0 && res->upper_bound < res->distance)
+    res->distance = res->upper_bound;
+
   // initialize error bounds
 
   res->abs_err = abs_err;
@@ -997,8 +1413,8 @@ PQP_Distance(PQP_DistanceResult *res,
   MxVpV(Ttemp,res->R,o2->child(0)->Tr,res->T);
   VmV(Ttemp,Ttemp,o1->child(0)->Tr);
 #else
-  MxVpV(Ttemp,res->R,o2->child(0)->To,res->T);
-  VmV(Ttemp,Ttemp,o1->child(0)->To);
+  MxVpV(Ttemp,res->R,o2->child_obb(0)->To,res->T);
+  VmV(Ttemp,Ttemp,o1->child_obb(0)->To);
 #endif
   MTxV(T,o1->child(0)->R,Ttemp);
 
@@ -1035,8 +1451,8 @@ ToleranceRecurse(PQP_ToleranceResult *res,
                  PQP_REAL R[3][3], PQP_REAL T[3],
                  PQP_Model *o1, int b1, PQP_Model *o2, int b2)
 {
-  PQP_REAL sz1 = o1->child(b1)->GetSize();
-  PQP_REAL sz2 = o2->child(b2)->GetSize();
+  PQP_REAL sz1 = o1->child(b1)->GetSize(o1->child_obb(b1));
+  PQP_REAL sz2 = o2->child(b2)->GetSize(o2->child_obb(b2));
   int l1 = o1->child(b1)->Leaf();
   int l2 = o2->child(b2)->Leaf();
 
@@ -1083,7 +1499,7 @@ ToleranceRecurse(PQP_ToleranceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
     VmV(Ttemp,T,o1->child(a1)->Tr);
 #else
-    VmV(Ttemp,T,o1->child(a1)->To);
+    VmV(Ttemp,T,o1->child_obb(a1)->To);
 #endif
     MTxV(T1,o1->child(a1)->R,Ttemp);
 
@@ -1091,7 +1507,7 @@ ToleranceRecurse(PQP_ToleranceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
     VmV(Ttemp,T,o1->child(c1)->Tr);
 #else
-    VmV(Ttemp,T,o1->child(c1)->To);
+    VmV(Ttemp,T,o1->child_obb(c1)->To);
 #endif
     MTxV(T2,o1->child(c1)->R,Ttemp);
   }
@@ -1108,13 +1524,13 @@ ToleranceRecurse(PQP_ToleranceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
     MxVpV(T1,R,o2->child(a2)->Tr,T);
 #else
-    MxVpV(T1,R,o2->child(a2)->To,T);
+    MxVpV(T1,R,o2->child_obb(a2)->To,T);
 #endif
     MxM(R2,R,o2->child(c2)->R);
 #if PQP_BV_TYPE & RSS_TYPE
     MxVpV(T2,R,o2->child(c2)->Tr,T);
 #else
-    MxVpV(T2,R,o2->child(c2)->To,T);
+    MxVpV(T2,R,o2->child_obb(c2)->To,T);
 #endif
   }
 
@@ -1192,8 +1608,10 @@ ToleranceQueueRecurse(PQP_ToleranceResult *res,
     {
       // decide how to descend to children
 
-      PQP_REAL sz1 = o1->child(min_test.b1)->GetSize();
-      PQP_REAL sz2 = o2->child(min_test.b2)->GetSize();
+      PQP_REAL sz1 =
+        o1->child(min_test.b1)->GetSize(o1->child_obb(min_test.b1));
+      PQP_REAL sz2 =
+        o2->child(min_test.b2)->GetSize(o2->child_obb(min_test.b2));
 
       res->num_bv_tests += 2;
 
@@ -1216,7 +1634,7 @@ ToleranceQueueRecurse(PQP_ToleranceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
         VmV(Ttemp,min_test.T,o1->child(c1)->Tr);
 #else
-        VmV(Ttemp,min_test.T,o1->child(c1)->To);
+        VmV(Ttemp,min_test.T,o1->child_obb(c1)->To);
 #endif
         MTxV(bvt1.T,o1->child(c1)->R,Ttemp);
         bvt1.d = BV_Distance(bvt1.R,bvt1.T,
@@ -1230,7 +1648,7 @@ ToleranceQueueRecurse(PQP_ToleranceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
 	      VmV(Ttemp,min_test.T,o1->child(c2)->Tr);
 #else
-	      VmV(Ttemp,min_test.T,o1->child(c2)->To);
+	      VmV(Ttemp,min_test.T,o1->child_obb(c2)->To);
 #endif
 	      MTxV(bvt2.T,o1->child(c2)->R,Ttemp);
         bvt2.d = BV_Distance(bvt2.R,bvt2.T,
@@ -1252,7 +1670,7 @@ ToleranceQueueRecurse(PQP_ToleranceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
         MxVpV(bvt1.T,min_test.R,o2->child(c1)->Tr,min_test.T);
 #else
-        MxVpV(bvt1.T,min_test.R,o2->child(c1)->To,min_test.T);
+        MxVpV(bvt1.T,min_test.R,o2->child_obb(c1)->To,min_test.T);
 #endif
         bvt1.d = BV_Distance(bvt1.R,bvt1.T,
                             o1->child(bvt1.b1),o2->child(bvt1.b2));
@@ -1265,7 +1683,7 @@ ToleranceQueueRecurse(PQP_ToleranceResult *res,
 #if PQP_BV_TYPE & RSS_TYPE
         MxVpV(bvt2.T,min_test.R,o2->child(c2)->Tr,min_test.T);
 #else
-        MxVpV(bvt2.T,min_test.R,o2->child(c2)->To,min_test.T);
+        MxVpV(bvt2.T,min_test.R,o2->child_obb(c2)->To,min_test.T);
 #endif
         bvt2.d = BV_Distance(bvt2.R,bvt2.T,
                             o1->child(bvt2.b1),o2->child(bvt2.b2));
@@ -1304,6 +1722,8 @@ PQP_Tolerance(PQP_ToleranceResult *res,
     return PQP_ERR_UNPROCESSED_MODEL;
   if (o2->build_state != PQP_BUILD_STATE_PROCESSED)
     return PQP_ERR_UNPROCESSED_MODEL;
+  if (!(o1->bv_type & o2->bv_type & RSS_TYPE))
+    return PQP_ERR_UNSUPPORTED_BV_TYPE;
 
   // Compute the transform [R,T] that takes us from cs2 to cs1.
   // [R,T] = [R1,T1]'[R2,T2] = [R1',-R1'T][R2,T2] = [R1'R2, R1'(T2-T1)]
@@ -1337,8 +1757,8 @@ PQP_Tolerance(PQP_ToleranceResult *res,
   MxVpV(Ttemp,res->R,o2->child(0)->Tr,res->T);
   VmV(Ttemp,Ttemp,o1->child(0)->Tr);
 #else
-  MxVpV(Ttemp,res->R,o2->child(0)->To,res->T);
-  VmV(Ttemp,Ttemp,o1->child(0)->To);
+  MxVpV(Ttemp,res->R,o2->child_obb(0)->To,res->T);
+  VmV(Ttemp,Ttemp,o1->child_obb(0)->To);
 #endif
   MTxV(T,o1->child(0)->R,Ttemp);
 
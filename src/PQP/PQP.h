@@ -84,6 +84,13 @@ const int PQP_ERR_BUILD_EMPTY_MODEL = -5;
   // has FAILED -- the model remains "unprocessed", and the client may
   // NOT use it in queries.
 
+const int PQP_ERR_UNSUPPORTED_BV_TYPE = -6;
+  // Returned when EndModel() is asked for BV types that are not compiled
+  // in (see PQP_BV_TYPE in PQP_Compile.h), or when a query is passed a
+  // model that was built without the BV type the query needs: distance
+  // and tolerance queries need RSS in both models, collision queries
+  // need the same type in both models.
+
 //----------------------------------------------------------------------------
 //
 //  PQP_REAL 
@@ -138,7 +145,8 @@ const int PQP_ERR_BUILD_EMPTY_MODEL = -5;
 //    int AddTri(const PQP_REAL *p1, const PQP_REAL *p2, const PQP_REAL *p3, 
 //               int id);
 //
-//    int EndModel();
+//    int EndModel(int split_rule = PQP_SPLIT_MEAN,  // see PQP_Internal.h
+//                 int bv_type = PQP_BV_TYPE);
 //    int MemUsage(int msg);  // returns model mem usage in bytes
 //                            // prints message to stderr if msg == TRUE
 //  };
@@ -236,6 +244,13 @@ PQP_Collide(PQP_CollideResult *result,
 //    PQP_REAL Distance();
 //    const PQP_REAL *P1();  // pointers to three PQP_REALs
 //    const PQP_REAL *P2();  
+//
+//    // Closest tris of the last query.  Null by default, in which case
+//    // the models' own last_tri is used and updated.  Set them to tris
+//    // of o1 and o2 to keep the warm start in the result instead.
+//
+//    Tri *last_tri1;
+//    Tri *last_tri2;
 //  };
 
 //----------------------------------------------------------------------------
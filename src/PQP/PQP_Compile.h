@@ -41,13 +41,14 @@
 #ifndef PQP_COMPILE_H
 #define PQP_COMPILE_H
 
-// prevents compiler warnings when PQP_REAL is float
-
-#include <math.h>
-inline float sqrt(float x) { return (float)sqrt((double)x); }
-inline float cos(float x) { return (float)cos((double)x); }
-inline float sin(float x) { return (float)sin((double)x); }
-inline float fabs(float x) { return (float)fabs((double)x); }
+// prevents compiler warnings when PQP_REAL is float, the float overloads
+// of <cmath> are used rather than the double functions
+
+#include <cmath>
+using std::sqrt;
+using std::cos;
+using std::sin;
+using std::fabs;
 
 //-------------------------------------------------------------------------
 //
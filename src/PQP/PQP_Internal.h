@@ -41,6 +41,14 @@
 #include "Tri.h"
 #include "BV.h"
 
+// Rules for splitting the triangles of a BV between its two children,
+// all of them along the principal axis of the triangles' vertices
+
+const int PQP_SPLIT_MEAN = 0;    // at the mean of the vertices
+const int PQP_SPLIT_MEDIAN = 1;  // at the median of the triangle centroids
+const int PQP_SPLIT_SAH = 2;     // at the least surface area heuristic cost,
+                                 // of 16 centroid bins
+
 class PQP_Model
 {
 
@@ -52,13 +60,22 @@ public:
   int num_tris;
   int num_tris_alloced;
 
-  BV *b;
+  BV *b;              // aligned to PQP_BV_ALIGNMENT, read by all queries
+  OBB *obb;            // OBB boxes of b, only read by collision queries
+  int obb_stride;      // bytes between consecutive boxes of obb
   int num_bvs;
   int num_bvs_alloced;
 
+  int bv_type;         // BV types built for this model, a subset of
+                       // PQP_BV_TYPE; with a single type the model keeps
+                       // no storage for the other one, see EndModel()
+
   Tri *last_tri;       // closest tri on this model in last distance test
   
   BV *child(int n) { return &b[n]; }
+  OBB *child_obb(int n) { return (OBB*)((char*)obb + n*obb_stride); }
+  const OBB *child_obb(int n) const
+    { return (const OBB*)((const char*)obb + n*obb_stride); }
 
   PQP_Model();
   ~PQP_Model();
@@ -68,7 +85,18 @@ public:
                                     // arrays are reallocated as needed
   int AddTri(const PQP_REAL *p1, const PQP_REAL *p2, const PQP_REAL *p3, 
              int id);
-  int EndModel();
+  // bv_type selects the BV types to build.  An RSS_TYPE model drops the
+  // OBB array, and its collision queries test RSSs; an OBB_TYPE model only
+  // supports collision queries, and keeps its boxes in the RSS fields of
+  // the BVs.  Either way a BV takes one cache line instead of one plus an
+  // OBB.
+
+  int EndModel(int split_rule = PQP_SPLIT_MEAN, int bv_type = PQP_BV_TYPE);
+  int LoadBuiltModel(const Tri *t, int nt,   // copies tris and BVs of an
+                     const BV *bvs,          // already built model, instead
+                     const OBB *obbs,        // of BeginModel() ... EndModel()
+                     int nb,                 // obbs is only read when the
+                     int bv_type = PQP_BV_TYPE); // model has both types
   int MemUsage(int msg);  // returns model mem usage.  
                           // prints message to stderr if msg == TRUE
 };
@@ -96,6 +124,8 @@ struct PQP_CollideResult
   int num_pairs;
   CollisionPair *pairs;
 
+  int obb_tests;         // overlap tests use OBBs, otherwise RSSs
+
   void SizeTo(int n);    
   void Add(int i1, int i2); 
 
@@ -143,6 +173,22 @@ struct PQP_DistanceResult
   PQP_REAL p1[3]; 
   PQP_REAL p2[3];
   int qsize;
+
+  // closest tris of the last query.  If both are set before a query,
+  // they seed the initial upper bound instead of the models' last_tri,
+  // and the models themselves are left untouched, so that a model can
+  // be queried concurrently with one result struct per thread.
+
+  Tri *last_tri1;
+  Tri *last_tri2;
+
+  // upper bound of the distance known by the caller, used if positive.
+  // If the models are further apart, the distance is reported as the
+  // upper bound and the closest points are not computed.
+
+  PQP_REAL upper_bound;
+
+  PQP_DistanceResult();
   
   // statistics
 
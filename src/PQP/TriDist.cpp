@@ -47,6 +47,8 @@
 //--------------------------------------------------------------------------
 
 #include "MatVec.h"
+#include "TriDist.h"
+#include "Lanes.h"
 #ifdef _WIN32
 #include <float.h>
 #define isnan _isnan
@@ -211,7 +213,7 @@ TriDist(PQP_REAL P[3], PQP_REAL Q[3],
 
   PQP_REAL V[3];
   PQP_REAL Z[3];
-  PQP_REAL minP[3], minQ[3], mindd;
+  PQP_REAL minP[3] = {0, 0, 0}, minQ[3] = {0, 0, 0}, mindd;
   int shown_disjoint = 0;
 
   mindd = VdistV2(S[0],T[0]) + 1;  // Set first minimum safely high
@@ -405,3 +407,248 @@ TriDist(PQP_REAL P[3], PQP_REAL Q[3],
   }
   else return 0;
 }
+
+//--------------------------------------------------------------------------
+// TriDistBatch()
+//
+// Same as TriDist() for triangle S against each of the triangles T[0..n-1],
+// keeping only the closest pair. The triangles T are processed in SIMD
+// lanes, so instead of the early outs of TriDist() every lane evaluates
+// all the candidates for the closest points: the 9 edge pairs, the 6
+// vertices over the other triangle's face and the 6 edges crossing the
+// other triangle, the latter giving distance 0 and P = Q on the
+// intersection of overlapping triangles.
+//--------------------------------------------------------------------------
+
+struct LaneVec
+{
+  Lanes x, y, z;
+  LaneVec() {}
+  LaneVec(Lanes a, Lanes b, Lanes c) : x(a), y(b), z(c) {}
+  LaneVec(const PQP_REAL v[3]) : x(v[0]), y(v[1]), z(v[2]) {}
+};
+
+inline LaneVec operator+(const LaneVec &a, const LaneVec &b)
+{ return LaneVec(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline LaneVec operator-(const LaneVec &a, const LaneVec &b)
+{ return LaneVec(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline LaneVec operator*(const LaneVec &a, Lanes s)
+{ return LaneVec(a.x * s, a.y * s, a.z * s); }
+inline Lanes Dot(const LaneVec &a, const LaneVec &b)
+{ return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline LaneVec Cross(const LaneVec &a, const LaneVec &b)
+{
+  return LaneVec(a.y * b.z - a.z * b.y,
+                 a.z * b.x - a.x * b.z,
+                 a.x * b.y - a.y * b.x);
+}
+inline LaneVec Select(Lanes mask, const LaneVec &a, const LaneVec &b)
+{
+  return LaneVec(Select(mask,a.x,b.x), Select(mask,a.y,b.y),
+                 Select(mask,a.z,b.z));
+}
+
+// x/y, or 0 where y is not positive
+
+inline Lanes
+SafeDiv(Lanes x, Lanes y)
+{
+  Lanes positive = Less(Lanes(0),y);
+  return Select(positive, x / Select(positive,y,Lanes(1)), Lanes(0));
+}
+
+inline Lanes
+Clamp01(Lanes x)
+{
+  return Min(Max(x,Lanes(0)),Lanes(1));
+}
+
+// Closest pair found so far in each lane
+
+struct LaneClosest
+{
+  Lanes dd;
+  LaneVec p, q;
+
+  void Update(Lanes d, const LaneVec &pc, const LaneVec &qc)
+  {
+    Take(Less(d,dd),d,pc,qc);
+  }
+
+  void Update(Lanes mask, Lanes d, const LaneVec &pc, const LaneVec &qc)
+  {
+    Take(mask & Less(d,dd),d,pc,qc);
+  }
+
+  void Take(Lanes closer, Lanes d, const LaneVec &pc, const LaneVec &qc)
+  {
+    dd = Select(closer,d,dd);
+    p = Select(closer,pc,p);
+    q = Select(closer,qc,q);
+  }
+};
+
+// Edges of a triangle, with the reciprocals of their squared lengths
+
+struct LaneEdges
+{
+  LaneVec O[3], A[3];   // edge i is O[i] + s A[i], s in [0,1]
+  Lanes AA[3], inv_AA[3];
+
+  LaneEdges(const LaneVec V[3])
+  {
+    for (int i = 0; i < 3; i++)
+    {
+      O[i] = V[i];
+      A[i] = V[(i+1)%3] - V[i];
+      AA[i] = Dot(A[i],A[i]);
+      inv_AA[i] = SafeDiv(Lanes(1),AA[i]);
+    }
+  }
+};
+
+// closest points of edge i of S and edge j of T
+
+inline void
+LaneSegPoints(LaneClosest &c, const LaneEdges &S, int i,
+              const LaneEdges &T, int j)
+{
+  const LaneVec &P = S.O[i], &A = S.A[i], &Q = T.O[j], &B = T.A[j];
+  LaneVec r = P - Q;
+  Lanes a = S.AA[i], e = T.AA[j], b = Dot(A,B);
+  Lanes cc = Dot(A,r), f = Dot(B,r);
+
+  // closest point of the lines, then clamped to the segments
+
+  Lanes s = Clamp01(SafeDiv(b*f - cc*e, a*e - b*b));
+  Lanes s0 = Clamp01((Lanes(0) - cc)*S.inv_AA[i]);
+  s = Select(LessEqual(e,Lanes(0)), s0, s);
+  Lanes t = (b*s + f)*T.inv_AA[j];
+  s = Select(Less(t,Lanes(0)), s0, s);
+  s = Select(Less(Lanes(1),t), Clamp01((b - cc)*S.inv_AA[i]), s);
+  t = Clamp01(t);
+
+  LaneVec X = P + A*s, Y = Q + B*t, V = Y - X;
+  c.Update(Dot(V,V), X, Y);
+}
+
+// vertices of U over the face of V, and edges of U crossing V. Points
+// on V go into q of the closest pair if onto_q, else into p.
+
+inline void
+LaneFaceTests(LaneClosest &c, const LaneEdges &U, const LaneEdges &V,
+              bool onto_q)
+{
+  LaneVec N = Cross(V.A[0],V.A[1]);
+  Lanes Nl = Dot(N,N);
+  Lanes valid = Less(Lanes((PQP_REAL)1e-15),Nl);
+  Lanes inv_Nl = SafeDiv(Lanes(1),Nl);
+
+  // a point projects into V where it is on the inner side of all the
+  // planes through the edges along N
+
+  LaneVec M[3];
+  Lanes m[3];
+  for (int k = 0; k < 3; k++)
+  {
+    M[k] = Cross(N,V.A[k]);
+    m[k] = Dot(V.O[k],M[k]);
+  }
+
+  Lanes h[3], inside[3];
+  for (int i = 0; i < 3; i++)
+  {
+    h[i] = Dot(U.O[i] - V.O[0],N);
+    inside[i] = Dot(U.O[i],M[0]) - m[0];
+    inside[i] = Min(inside[i],Dot(U.O[i],M[1]) - m[1]);
+    inside[i] = Min(inside[i],Dot(U.O[i],M[2]) - m[2]);
+
+    // vertex over the face; its projection is the closest point
+
+    LaneVec X = U.O[i] - N*(h[i]*inv_Nl);
+    Lanes mask = valid & LessEqual(Lanes(0),inside[i]);
+    if (onto_q) c.Update(mask, h[i]*h[i]*inv_Nl, U.O[i], X);
+    else c.Update(mask, h[i]*h[i]*inv_Nl, X, U.O[i]);
+  }
+
+  for (int i = 0; i < 3; i++)
+  {
+    int j = (i + 1) % 3;
+
+    // edge crossing the plane of V, at X
+
+    Lanes crossing = Less(h[i]*h[j],Lanes(0));
+    Lanes w = h[i]/Select(crossing,h[i] - h[j],Lanes(1));
+    LaneVec X = U.O[i] + U.A[i]*w;
+    Lanes in = Dot(X,M[0]) - m[0];
+    in = Min(in,Dot(X,M[1]) - m[1]);
+    in = Min(in,Dot(X,M[2]) - m[2]);
+    Lanes mask = valid & crossing & LessEqual(Lanes(0),in);
+    c.Update(mask, Lanes(0), X, X);
+  }
+}
+
+int
+TriDistBatch(PQP_REAL *dist, PQP_REAL P[3], PQP_REAL Q[3],
+             const PQP_REAL S[3][3], const PQP_REAL T[][3][3], int n)
+{
+  int best = -1;
+  PQP_REAL best_dd = 0;
+
+  LaneVec Sv[3];
+  for (int v = 0; v < 3; v++) Sv[v] = LaneVec(S[v]);
+  LaneEdges Se(Sv);
+
+  for (int first = 0; first < n; first += TRIDIST_BATCH)
+  {
+    // transpose the triangles into lanes, padding with the last one
+
+    PQP_REAL coords[3][3][TRIDIST_BATCH];
+    for (int k = 0; k < TRIDIST_BATCH; k++)
+    {
+      int tri = (first + k < n) ? first + k : n - 1;
+      for (int v = 0; v < 3; v++)
+        for (int d = 0; d < 3; d++)
+          coords[v][d][k] = T[tri][v][d];
+    }
+
+    LaneVec Tv[3];
+    for (int v = 0; v < 3; v++)
+      Tv[v] = LaneVec(LoadLanes(coords[v][0]), LoadLanes(coords[v][1]),
+                      LoadLanes(coords[v][2]));
+    LaneEdges Te(Tv);
+
+    LaneClosest c;
+    c.dd = Lanes((PQP_REAL)HUGE_VAL);
+    c.p = Sv[0];
+    c.q = Tv[0];
+
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+        LaneSegPoints(c, Se, i, Te, j);
+    LaneFaceTests(c, Te, Se, false);
+    LaneFaceTests(c, Se, Te, true);
+
+    PQP_REAL dd[TRIDIST_BATCH], p[3][TRIDIST_BATCH], q[3][TRIDIST_BATCH];
+    StoreLanes(dd, c.dd);
+    StoreLanes(p[0], c.p.x); StoreLanes(p[1], c.p.y); StoreLanes(p[2], c.p.z);
+    StoreLanes(q[0], c.q.x); StoreLanes(q[1], c.q.y); StoreLanes(q[2], c.q.z);
+
+    for (int k = 0; k < TRIDIST_BATCH && first + k < n; k++)
+    {
+      if (best < 0 || dd[k] < best_dd)
+      {
+        best = first + k;
+        best_dd = dd[k];
+        for (int d = 0; d < 3; d++)
+        {
+          P[d] = p[d][k];
+          Q[d] = q[d][k];
+        }
+      }
+    }
+  }
+
+  *dist = sqrt(best_dd);
+  return best;
+}
@@ -42,6 +42,7 @@
 #define PQP_TRIDIST_H
 
 #include "PQP_Compile.h"
+#include "Lanes.h"
 
 // TriDist()
 //
@@ -60,4 +61,19 @@ PQP_REAL
 TriDist(PQP_REAL p[3], PQP_REAL q[3], 
         const PQP_REAL s[3][3], const PQP_REAL t[3][3]);
 
+// TriDistBatch()
+//
+// computes the distances of triangle s to the n triangles t, like
+// TriDist() does for each pair, TRIDIST_BATCH triangles at a time in SIMD
+// lanes. Returns the index of the closest triangle, with its distance in
+// dist and the closest points in p and q. Unlike TriDist(), p and q of
+// overlapping triangles are a common point. The lanes are SIMD
+// instructions if PQP_SIMD is set, see Lanes.h.
+
+#define TRIDIST_BATCH PQP_LANES
+
+int
+TriDistBatch(PQP_REAL *dist, PQP_REAL p[3], PQP_REAL q[3],
+             const PQP_REAL s[3][3], const PQP_REAL t[][3][3], int n);
+
 #endif
@@ -23,39 +23,47 @@
 #include <utility>
 #include <memory>
 
-class Bubble {
+// Diamond shaped free region of the configuration space. N is the
+// compile-time dimension, Eigen::Dynamic if known only at runtime.
+template <int N>
+class BubbleT {
  public:
-  typedef Eigen::VectorXd EVectorXd;
-  Bubble() : distance_(INFINITY), parent_(nullptr) {}
-  explicit Bubble(const EVectorXd& coordinates)
+  typedef Eigen::Matrix<double, N, 1> EVectorNd;
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  BubbleT() : distance_(INFINITY), parent_(nullptr) {}
+  explicit BubbleT(const EVectorNd& coordinates)
       : coordinates_(coordinates),
-        dimensions_(INFINITY * EVectorXd::Ones(coordinates_.size())),
+        dimensions_(EVectorNd::Constant(coordinates_.size(), INFINITY)),
         distance_(INFINITY),
         parent_(nullptr) {}
 
-  const EVectorXd& coordinates() const { return coordinates_; }
-  const EVectorXd& dimensions() const { return dimensions_; }
-  std::shared_ptr<Bubble>& parent() { return parent_; }
+  const EVectorNd& coordinates() const { return coordinates_; }
+  const EVectorNd& dimensions() const { return dimensions_; }
+  EVectorNd& dimensions() { return dimensions_; }
+  std::shared_ptr<BubbleT>& parent() { return parent_; }
   double& distance() { return distance_; }
   const double GetCoordinate(size_t i) const { return coordinates_[i]; }
   const double GetDimension(size_t i) const { return dimensions_[i]; }
   void SetDimension(size_t i, double value) { dimensions_[i] = value; }
-  void SetParent(const std::shared_ptr<Bubble>& parent) {
+  void SetParent(const std::shared_ptr<BubbleT>& parent) {
     parent_ = parent; }
 
   void Resize(size_t dimension) {
     coordinates_.resize(dimension);
     dimensions_.resize(dimension);
   }
-  EVectorXd HullIntersection(const EVectorXd& direction) {
+  EVectorNd HullIntersection(const EVectorNd& direction) {
     return coordinates() +
       direction / ((direction.cwiseQuotient(dimensions())).cwiseAbs()).sum();
   }
 
  private:
-  EVectorXd coordinates_, dimensions_;
+  EVectorNd coordinates_, dimensions_;
   double distance_;
-  std::shared_ptr<Bubble> parent_;
+  std::shared_ptr<BubbleT> parent_;
 };
 
+typedef BubbleT<Eigen::Dynamic> Bubble;
+
 #endif  // BUBBLE_H_INCLUDED
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef BUBBLE_ARENA_H_INCLUDED
+#define BUBBLE_ARENA_H_INCLUDED
+
+#include <cmath>
+#include <Eigen/Dense>
+#include <vector>
+#include <algorithm>
+
+// Bubbles of a planning query stored as structure of arrays. Bubbles are
+// referenced by integer handles, which stay valid until the arena is shrunk
+// below them. N is the compile-time dimension, Eigen::Dynamic if known only
+// at runtime.
+template <int N>
+class BubbleArena {
+ public:
+  typedef Eigen::Matrix<double, N, 1> EVectorNd;
+  typedef Eigen::Map<EVectorNd> EMapNd;
+  typedef Eigen::Map<const EVectorNd> EConstMapNd;
+  static const int kNull = -1;  // Handle of no bubble
+
+  explicit BubbleArena(size_t dimension = N == Eigen::Dynamic ? 0 : N)
+      : dimension_(dimension) {}
+
+  size_t size() const { return distances_.size(); }
+  size_t dimension() const { return dimension_; }
+
+  // Adds a bubble without a parent and with infinite extent - returns handle
+  int Add(const EVectorNd& coordinates) {
+    coordinates_.insert(coordinates_.end(), coordinates.data(),
+                        coordinates.data() + dimension_);
+    dimensions_.resize(dimensions_.size() + dimension_, INFINITY);
+    distances_.push_back(INFINITY);
+    parents_.push_back(kNull);
+    return static_cast<int>(distances_.size()) - 1;
+  }
+  // Overwrites bubble to with bubble from
+  void Move(int from, int to) {
+    std::copy_n(&coordinates_[from * dimension_], dimension_,
+                &coordinates_[to * dimension_]);
+    std::copy_n(&dimensions_[from * dimension_], dimension_,
+                &dimensions_[to * dimension_]);
+    distances_[to] = distances_[from];
+    parents_[to] = parents_[from];
+  }
+  // Drops the bubbles with handles from size onwards
+  void Resize(size_t size) {
+    if (size >= this->size()) return;
+    coordinates_.resize(size * dimension_);
+    dimensions_.resize(size * dimension_);
+    distances_.resize(size);
+    parents_.resize(size);
+  }
+  // Appends all bubbles of other, with parent handles mapped by remap
+  template <typename Remap>
+  void Append(const BubbleArena& other, Remap remap) {
+    coordinates_.insert(coordinates_.end(), other.coordinates_.begin(),
+                        other.coordinates_.end());
+    dimensions_.insert(dimensions_.end(), other.dimensions_.begin(),
+                       other.dimensions_.end());
+    distances_.insert(distances_.end(), other.distances_.begin(),
+                      other.distances_.end());
+    for (int parent : other.parents_)
+      parents_.push_back(remap(parent));
+  }
+  void PopBack() { Resize(size() - 1); }
+  void Clear() { Resize(0); }
+  void Reserve(size_t size) {
+    coordinates_.reserve(size * dimension_);
+    dimensions_.reserve(size * dimension_);
+    distances_.reserve(size);
+    parents_.reserve(size);
+  }
+
+  EConstMapNd coordinates(int bubble) const {
+    return EConstMapNd(&coordinates_[bubble * dimension_], dimension_);
+  }
+  EConstMapNd dimensions(int bubble) const {
+    return EConstMapNd(&dimensions_[bubble * dimension_], dimension_);
+  }
+  EMapNd dimensions(int bubble) {
+    return EMapNd(&dimensions_[bubble * dimension_], dimension_);
+  }
+  double& distance(int bubble) { return distances_[bubble]; }
+  double distance(int bubble) const { return distances_[bubble]; }
+  int& parent(int bubble) { return parents_[bubble]; }
+  int parent(int bubble) const { return parents_[bubble]; }
+
+  // Distance of point from the bubble centre in the bubble's norm - point is
+  // inside the bubble if it is at most 1
+  double Fill(int bubble, const EVectorNd& point) const {
+    return ((point - coordinates(bubble)).cwiseQuotient(dimensions(bubble)))
+        .cwiseAbs().sum();
+  }
+  EVectorNd HullIntersection(int bubble, const EVectorNd& direction) const {
+    return coordinates(bubble) + direction /
+      ((direction.cwiseQuotient(dimensions(bubble))).cwiseAbs()).sum();
+  }
+
+ private:
+  size_t dimension_;
+  std::vector<double> coordinates_, dimensions_, distances_;
+  std::vector<int> parents_;
+};
+
+template <int N> const int BubbleArena<N>::kNull;
+
+// Read only arena extended by bubbles stored aside, with handles following
+// the arena ones
+template <int N>
+class BubbleArenaOverlay {
+ public:
+  typedef typename BubbleArena<N>::EVectorNd EVectorNd;
+  typedef typename BubbleArena<N>::EConstMapNd EConstMapNd;
+
+  BubbleArenaOverlay(const BubbleArena<N>& base, BubbleArena<N>& extension)
+      : base_(base), extension_(extension),
+        base_size_(static_cast<int>(base.size())) {}
+
+  int base_size() const { return base_size_; }
+  BubbleArena<N>& extension() { return extension_; }
+  // Adds bubble to the extension - returns its overlay handle
+  int Add(const EVectorNd& coordinates) {
+    return base_size_ + extension_.Add(coordinates);
+  }
+
+  EConstMapNd coordinates(int bubble) const {
+    return bubble < base_size_ ? base_.coordinates(bubble) :
+      const_cast<const BubbleArena<N>&>(extension_).coordinates(
+          bubble - base_size_);
+  }
+  double Fill(int bubble, const EVectorNd& point) const {
+    return bubble < base_size_ ? base_.Fill(bubble, point) :
+      extension_.Fill(bubble - base_size_, point);
+  }
+  EVectorNd HullIntersection(int bubble, const EVectorNd& direction) const {
+    return bubble < base_size_ ? base_.HullIntersection(bubble, direction) :
+      extension_.HullIntersection(bubble - base_size_, direction);
+  }
+
+ private:
+  const BubbleArena<N>& base_;
+  BubbleArena<N>& extension_;
+  int base_size_;
+};
+
+#endif  // BUBBLE_ARENA_H_INCLUDED
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef BUBBLE_CACHE_H_INCLUDED
+#define BUBBLE_CACHE_H_INCLUDED
+
+#include <cmath>
+#include <Eigen/Dense>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <utility>
+
+#include "bubble_arena.h"
+
+// Hashed grid over the centres of arena bubbles, used to find an existing
+// bubble covering a segment before making a new one. A cache can be layered
+// over a read only base cache, e.g. to collect the bubbles of a speculative
+// evaluation.
+template <int N>
+class BubbleCache {
+ public:
+  typedef Eigen::Matrix<double, N, 1> EVectorNd;
+  // Searched base cells along with their sizes at the time
+  typedef std::vector<std::pair<size_t, size_t>> CellSizes;
+
+  explicit BubbleCache(double cell_size)
+      : cell_size_(cell_size), queries_(0), hits_(0) {}
+
+  size_t queries() const { return queries_; }
+  size_t hits() const { return hits_; }
+
+  template <typename Arena>
+  void Insert(const Arena& arena, int bubble) {
+    cells_[CellKey(arena.coordinates(bubble))].push_back(bubble);
+  }
+  // Inserts bubbles of other, shifted by handle_offset, and its statistics
+  void Insert(const BubbleCache& other, int handle_offset) {
+    for (const auto& cell : other.cells_) {
+      std::vector<int>& bubbles = cells_[cell.first];
+      for (int bubble : cell.second)
+        bubbles.push_back(bubble + handle_offset);
+    }
+    queries_ += other.queries_;
+    hits_ += other.hits_;
+  }
+  // Returns a bubble containing segment begin-end and sets covers, else the
+  // bubble containing its mid point with the lowest fill of at most max_fill,
+  // else kNull. Bubbles centred in the cells of the endpoints and mid are
+  // searched, in every cell those of base first.
+  template <typename Arena>
+  int Find(const Arena& arena, const EVectorNd& begin, const EVectorNd& end,
+           double max_fill, bool& covers, const BubbleCache* base = nullptr,
+           CellSizes* base_cells = nullptr) {
+    ++queries_;
+    covers = false;
+    const EVectorNd mid = (begin + end) / 2;
+    const size_t keys[] = {CellKey(mid), CellKey(begin), CellKey(end)};
+    int best = BubbleArena<N>::kNull;
+    double best_fill = max_fill;
+    for (size_t i = 0; i < 3; ++i) {
+      if ((i == 1 && keys[1] == keys[0]) ||
+          (i == 2 && (keys[2] == keys[0] || keys[2] == keys[1])))
+        continue;  // Cell already searched
+
+      const std::vector<int>* layers[] = {
+          base ? base->Cell(keys[i]) : nullptr, Cell(keys[i])};
+      if (base_cells)
+        base_cells->emplace_back(keys[i], layers[0] ? layers[0]->size() : 0);
+      for (const std::vector<int>* cell : layers) {
+        if (!cell) continue;
+        for (int bubble : *cell) {
+          // Bubbles are convex, so containing the endpoints is enough
+          if (arena.Fill(bubble, begin) <= 1.0 &&
+              arena.Fill(bubble, end) <= 1.0) {
+            covers = true;
+            ++hits_;
+            return bubble;
+          }
+          double fill = arena.Fill(bubble, mid);
+          if (fill <= best_fill) {
+            best = bubble;
+            best_fill = fill;
+          }
+        }
+      }
+    }
+    if (best != BubbleArena<N>::kNull) ++hits_;
+    return best;
+  }
+  // Checks whether cells searched as base still hold the same bubbles
+  bool Unchanged(const CellSizes& cells) const {
+    for (const auto& cell : cells) {
+      const std::vector<int>* bubbles = Cell(cell.first);
+      if ((bubbles ? bubbles->size() : 0) != cell.second) return false;
+    }
+    return true;
+  }
+
+ private:
+  const std::vector<int>* Cell(size_t key) const {
+    auto cell = cells_.find(key);
+    return cell == cells_.end() ? nullptr : &cell->second;
+  }
+  // Colliding keys only add candidates, which are checked anyway
+  template <typename Derived>
+  size_t CellKey(const Eigen::MatrixBase<Derived>& point) const {
+    size_t key = 0;
+    for (int i = 0; i < point.size(); ++i) {
+      long cell = static_cast<long>(std::floor(point[i] / cell_size_));
+      key ^= std::hash<long>()(cell) + 0x9e3779b9 + (key << 6) + (key >> 2);
+    }
+    return key;
+  }
+
+  double cell_size_;
+  size_t queries_, hits_;
+  std::unordered_map<size_t, std::vector<int>> cells_;
+};
+
+#endif  // BUBBLE_CACHE_H_INCLUDED
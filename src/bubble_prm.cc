@@ -18,62 +18,114 @@
 #include <cmath>
 #include <memory>
 #include <queue>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <omp.h>
 
 namespace bubbleprm {
 
+template <int N>
 struct QueueConnectorBubbleContainer {
-  QueueConnectorBubbleContainer(const std::shared_ptr<Bubble>& bubble1,
-                                const BubblePrm::EVectorXd& hull_intersect1,
-                                const std::shared_ptr<Bubble>& bubble2,
-                                const BubblePrm::EVectorXd& hull_intersect2)
+  typedef typename BubblePrmT<N>::EVectorNd EVectorNd;
+  QueueConnectorBubbleContainer(int bubble1, const EVectorNd& hull_intersect1,
+                                int bubble2, const EVectorNd& hull_intersect2)
       : bubble1(bubble1), bubble2(bubble2), hull_intersect1(hull_intersect1),
         hull_intersect2(hull_intersect2) {}
 
-  std::shared_ptr<Bubble> bubble1, bubble2;
-  BubblePrm::EVectorXd hull_intersect1, hull_intersect2;
+  int bubble1, bubble2;
+  EVectorNd hull_intersect1, hull_intersect2;
 };
 
-bool BubblePrm::ConnectPoints(int point1_index, int point2_index) {
-  ++connects_;
-  std::shared_ptr<Bubble> b1 = bubbles_.at(point1_index),
-                          b2 = bubbles_.at(point2_index);
+template <int N>
+BubblePrmT<N>::BubblePrmT(PqpEnvironment* pqp_environment,
+                          const EVectorNd& start, const EVectorNd& end,
+                          int knn_num, int max_connect_param,
+                          double cache_cell_size, int speculated_edges,
+                          bool relaxed_order)
+    : PrmTreeT<N>(pqp_environment, start, end, knn_num),
+      arena_(pqp_environment->dimension()),
+      bubbles_(this->space_size_, BubbleArena<N>::kNull),
+      cache_(cache_cell_size), cache_cell_size_(cache_cell_size),
+      use_cache_(cache_cell_size > 0),
+      speculated_edges_(std::max(speculated_edges, 1)),
+      relaxed_order_(relaxed_order),
+      max_connect_param_(max_connect_param),
+      connects_(0), adds_(0) {
+  const int threads_num = speculated_edges_ > 1 ? omp_get_max_threads() : 1;
+  for (int i = 0; i < threads_num; ++i)
+    contexts_.push_back(pqp_environment_->NewQueryContext());
+}
+
+template <int N>
+bool BubblePrmT<N>::ConnectPoints(int point1_index, int point2_index) {
+  ConnectResult<N> result (arena_.dimension(), cache_cell_size_);
+  EvaluateConnect(point1_index, point2_index, *contexts_.front(), result);
+  return CommitConnect(point2_index, result);
+}
+
+template <int N>
+void BubblePrmT<N>::EvaluateConnect(int point1_index, int point2_index,
+                                    PqpQueryContext& context,
+                                    ConnectResult<N>& result) {
+  typedef QueueConnectorBubbleContainer<N> Container;
+  const int b1 = bubbles_.at(point1_index), b2 = bubbles_.at(point2_index);
+  // New bubbles are kept in the result, the arena is only read
+  BubbleArenaOverlay<N> arena (arena_, result.bubbles);
+  result.snapshot = arena.base_size();
 
   // Bubble intersections are stored, because they can be computed only once,
-  // along with bubble pointers in order to be able to connect the bubbles
-  std::queue<QueueConnectorBubbleContainer> q_connector;
-
-  EVectorXd left_endpoint = b1->HullIntersection(
-        b2->coordinates() - b1->coordinates()),
-    right_endpoint = b2->HullIntersection(
-        b1->coordinates() - b2->coordinates());
-
-  if ((left_endpoint - b1->coordinates()).norm() +
-      (right_endpoint - b2->coordinates()).norm() >
-      (b2->coordinates() - b1->coordinates()).norm()) {
-    b2->SetParent(b1);
-    return true;
+  // along with bubble handles in order to be able to connect the bubbles
+  std::queue<Container, std::deque<Container,
+      Eigen::aligned_allocator<Container>>> q_connector;
+
+  EVectorNd b1_coordinates = arena.coordinates(b1),
+            b2_coordinates = arena.coordinates(b2);
+  EVectorNd left_endpoint = arena.HullIntersection(b1,
+        b2_coordinates - b1_coordinates),
+    right_endpoint = arena.HullIntersection(b2,
+        b1_coordinates - b2_coordinates);
+
+  if ((left_endpoint - b1_coordinates).norm() +
+      (right_endpoint - b2_coordinates).norm() >
+      (b2_coordinates - b1_coordinates).norm()) {
+    result.parent = b1;
+    result.connected = true;
+    return;
   }
   q_connector.emplace(b1, left_endpoint, b2, right_endpoint);
 
+  // Only the second point's bubble and new bubbles get parents
+  auto set_parent = [&](int bubble, int parent) {
+    if (bubble == b2)
+      result.parent = parent;
+    else
+      result.bubbles.parent(bubble - result.snapshot) = parent;
+  };
+
   int counter = 0;
   while (!q_connector.empty() && counter++ < max_connect_param_) {
-    auto q_edge = q_connector.front(); q_connector.pop();
+    Container q_edge = q_connector.front(); q_connector.pop();
 
-    EVectorXd mid_coordinates =
+    EVectorNd mid_coordinates =
         (q_edge.hull_intersect1 + q_edge.hull_intersect2) / 2;
-    std::shared_ptr<Bubble> mid_bubble;
-
-    if (!pqp_environment_->MakeBubble(mid_coordinates, mid_bubble)) {
-      b2->parent().reset();  // Still no parents
-      return false;
+    int mid_bubble;
+    bool covered;
+
+    if (!MakeMidBubble(q_edge.hull_intersect1, q_edge.hull_intersect2,
+                       context, arena, result, mid_bubble, covered))
+      return;  // Still no parents
+    if (covered) {
+      // Segment inside an already computed bubble is free
+      set_parent(q_edge.bubble2, q_edge.bubble1);
+      continue;
     }
 
-    EVectorXd left_intersect = mid_bubble->HullIntersection(
+    EVectorNd left_intersect = arena.HullIntersection(mid_bubble,
           q_edge.hull_intersect1 - mid_coordinates),
-      right_intersect = mid_bubble->HullIntersection(
+      right_intersect = arena.HullIntersection(mid_bubble,
           q_edge.hull_intersect2 - mid_coordinates);
 
     if ((left_intersect - mid_coordinates).norm() <
@@ -83,41 +135,142 @@ bool BubblePrm::ConnectPoints(int point1_index, int point2_index) {
       q_connector.emplace(mid_bubble, right_intersect, q_edge.bubble2,
           q_edge.hull_intersect2);
     } else {
-      q_edge.bubble2->SetParent(mid_bubble);
-      mid_bubble->SetParent(q_edge.bubble1);
+      set_parent(q_edge.bubble2, mid_bubble);
+      set_parent(mid_bubble, q_edge.bubble1);
+    }
+  }
+  result.connected = counter < max_connect_param_;
+}
+
+template <int N>
+bool BubblePrmT<N>::CommitConnect(int point2_index,
+                                  ConnectResult<N>& result) {
+  ++connects_;
+  // Arena may have grown since the evaluation
+  const int offset = static_cast<int>(arena_.size()) - result.snapshot;
+  auto remap = [&](int bubble) {
+    return bubble >= result.snapshot ? bubble + offset : bubble;
+  };
+
+  // Mid bubbles of a failed connection are dropped, unless they are cached
+  if (result.connected || use_cache_)
+    arena_.Append(result.bubbles, remap);
+  if (use_cache_)
+    cache_.Insert(result.cache, offset);
+
+  arena_.parent(bubbles_.at(point2_index)) = result.connected ?
+    remap(result.parent) : BubbleArena<N>::kNull;
+  return result.connected;
+}
+
+template <int N>
+void BubblePrmT<N>::EvaluateConnects(const std::vector<Edge>& edges,
+                                     std::vector<ConnectResult<N>>& results) {
+  results.clear();
+  std::vector<int> evaluated;
+  for (size_t i = 0; i < edges.size(); ++i) {
+    auto kept = speculated_results_.find(
+        EdgeKey(edges[i].point1_index, edges[i].point2_index));
+    if (kept != speculated_results_.end()) {
+      results.push_back(std::move(kept->second));
+      speculated_results_.erase(kept);
+    } else {
+      results.emplace_back(arena_.dimension(), cache_cell_size_);
+      evaluated.push_back(i);
+    }
+  }
+
+  const int evaluated_num = static_cast<int>(evaluated.size());
+  #pragma omp parallel for schedule(dynamic) num_threads(contexts_.size())
+  for (int i = 0; i < evaluated_num; ++i) {
+    const Edge& edge = edges[evaluated[i]];
+    EvaluateConnect(edge.point1_index, edge.point2_index,
+                    *contexts_.at(omp_get_thread_num()),
+                    results[evaluated[i]]);
+  }
+}
+
+template <int N>
+bool BubblePrmT<N>::MakeMidBubble(const EVectorNd& begin, const EVectorNd& end,
+                                  PqpQueryContext& context,
+                                  BubbleArenaOverlay<N>& arena,
+                                  ConnectResult<N>& result, int& bubble,
+                                  bool& covered) {
+  covered = false;
+  const EVectorNd mid = (begin + end) / 2;
+  if (use_cache_) {
+    int cached = result.cache.Find(arena, begin, end, kMaxCacheFill, covered,
+                                   &cache_, &result.cache_cells);
+    if (covered) return true;
+    if (cached != BubbleArena<N>::kNull) {
+      // Shrunk by the fill at mid, the bubble stays inside the cached one
+      const double scale = 1.0 - arena.Fill(cached, mid);
+      bubble = arena.Add(mid);
+      BubbleArena<N>& bubbles = arena.extension();
+      const int cached_local = cached - result.snapshot;
+      bubbles.distance(bubble - result.snapshot) = scale *
+        (cached_local >= 0 ? bubbles.distance(cached_local) :
+         arena_.distance(cached));
+      bubbles.dimensions(bubble - result.snapshot) = scale *
+        (cached_local >= 0 ? EVectorNd(bubbles.dimensions(cached_local)) :
+         EVectorNd(arena_.dimensions(cached)));
+      return true;
     }
   }
-  if (counter >= max_connect_param_) {
-    b2->parent().reset();
+
+  bubble = arena.Add(mid);
+  if (!context.MakeBubble(arena.extension(), bubble - result.snapshot)) {
+    arena.extension().PopBack();
     return false;
   }
+  if (use_cache_) result.cache.Insert(arena, bubble);
   return true;
 }
 
-bool BubblePrm::AddPointToTree(int point_index, double extra_weight) {
+template <int N>
+bool BubblePrmT<N>::AddPointToTree(int point_index, double extra_weight) {
   if (visited_.at(point_index)) return false;
   ++adds_;
   visited_.at(point_index) = true;
   pqp_environment_->RemovePoint(point_index);
 
-  EVectorXd current_point_coordinates = GetCoordinates(point_index);
+  EVectorNd current_point_coordinates = GetCoordinates(point_index);
   std::vector<int> query_indices = pqp_environment_->KnnQuery(
       current_point_coordinates, knn_num_);
 
+  // Missing bubbles of the neighbours are created in a single batch
+  std::vector<int> batch_indices;
+  std::vector<EVectorNd, Eigen::aligned_allocator<EVectorNd>>
+      batch_coordinates;
+  for (auto& query_index : query_indices) {
+    if (!visited_.at(query_index) &&
+        bubbles_.at(query_index) == BubbleArena<N>::kNull) {
+      batch_indices.push_back(query_index);
+      batch_coordinates.push_back(GetCoordinates(query_index));
+    }
+  }
+  std::vector<int> batch_bubbles;
+  pqp_environment_->MakeBubbles(batch_coordinates, arena_, batch_bubbles);
+  for (size_t i = 0; i < batch_indices.size(); ++i) {
+    bubbles_.at(batch_indices[i]) = batch_bubbles[i];
+    if (use_cache_ && batch_bubbles[i] != BubbleArena<N>::kNull)
+      cache_.Insert(arena_, batch_bubbles[i]);
+  }
+
   for (auto& query_index : query_indices) {
     if (visited_.at(query_index))
       // Skips visited points
       continue;
 
-    EVectorXd query_cords = GetCoordinates(query_index);
+    EVectorNd query_cords = GetCoordinates(query_index);
 
-    if (bubbles_.at(query_index) != nullptr ||
-        pqp_environment_->MakeBubble(query_cords, bubbles_.at(query_index)))
+    // Bubbles connect the raw coordinates, so do their edge weights
+    if (bubbles_.at(query_index) != BubbleArena<N>::kNull)
       pq_.emplace(point_index, query_index,
-          (end_ - query_cords).norm() +
-          (start_ - query_cords).norm()
+          pqp_environment_->metric().UnwrappedDistance(end_, query_cords) +
+          pqp_environment_->metric().UnwrappedDistance(start_, query_cords)
           /*((end_ - query_cords).cwiseQuotient(
-          (4 * bubbles_.at(query_index)->dimensions() +
+          (4 * arena_.dimensions(bubbles_.at(query_index)) +
           current_point_coordinates) / 5)).norm() +
           (start_ - query_cords).norm() * 0.1*/
           /*+ extra_weight + 0.25*/,
@@ -131,17 +284,22 @@ bool BubblePrm::AddPointToTree(int point_index, double extra_weight) {
   return true;
 }
 
-bool BubblePrm::BuildTree(const std::string& log_filename) {
+template <int N>
+bool BubblePrmT<N>::BuildTree(const std::string& log_filename) {
   std::cout << "**********BUILD STARTED**********" << std::endl;
-  if (!pqp_environment_->MakeBubble(start_, bubbles_.at(start_index_))) {
+  if (!pqp_environment_->MakeBubble(start_, arena_,
+                                    bubbles_.at(start_index_))) {
     std::cout << "Collision at the initial configuration!" << std::endl;
     return false;
   }
-  if (!pqp_environment_->MakeBubble(end_, bubbles_.at(end_index_))) {
+  if (!pqp_environment_->MakeBubble(end_, arena_, bubbles_.at(end_index_))) {
     std::cout << "Collision at the final configuration!" << std::endl;
     return false;
   }
-  bubbles_.at(end_index_).reset();
+  // The final bubble is created again once it is reached
+  arena_.PopBack();
+  bubbles_.at(end_index_) = BubbleArena<N>::kNull;
+  if (use_cache_) cache_.Insert(arena_, bubbles_.at(start_index_));
 
   std::ofstream log (log_filename);
 
@@ -152,28 +310,75 @@ bool BubblePrm::BuildTree(const std::string& log_filename) {
   log << std::chrono::duration<double, std::milli> (duration).count() <<
       std::endl;
 
+  std::vector<Edge> edges;
+  std::vector<ConnectResult<N>> results;
   while (!visited_.at(end_index_) && !pq_.empty()) {
-    Edge temp = pq_.top(); pq_.pop();
-    if (visited_.at(temp.point2_index))
-      continue;
-
+    // Top edges are evaluated concurrently, then committed in order
     start_t = std::chrono::steady_clock::now();
-    if (ConnectPoints(temp.point1_index, temp.point2_index))
-      AddPointToTree(temp.point2_index, temp.extra_weight);
-
-    end_t = std::chrono::steady_clock::now();
-    duration = end_t - start_t;
-    log << std::chrono::duration<double, std::milli> (duration).count() <<
-        std::endl;
+    edges.clear();
+    while (edges.size() < speculated_edges_ && !pq_.empty()) {
+      Edge temp = pq_.top(); pq_.pop();
+      if (!visited_.at(temp.point2_index))
+        edges.push_back(temp);
+      else  // Drops the kept evaluation of a discarded edge
+        speculated_results_.erase(EdgeKey(temp.point1_index,
+                                          temp.point2_index));
+    }
+    EvaluateConnects(edges, results);
+
+    for (size_t i = 0; i < edges.size(); ++i) {
+      const Edge& temp = edges[i];
+      if (!relaxed_order_ && !pq_.empty() &&
+          EdgeCompareFunctor()(temp, pq_.top())) {
+        // Edges pushed by the commits go first, the remaining evaluations
+        // are kept for later
+        for (size_t k = i; k < edges.size(); ++k) {
+          pq_.push(edges[k]);
+          speculated_results_.emplace(EdgeKey(edges[k].point1_index,
+              edges[k].point2_index), std::move(results[k]));
+        }
+        break;
+      }
+      if (visited_.at(temp.point2_index) || visited_.at(end_index_))
+        continue;
+
+      // Earlier commits could have cached bubbles the evaluation missed
+      if (!relaxed_order_ && use_cache_ &&
+          !cache_.Unchanged(results[i].cache_cells)) {
+        results[i] = ConnectResult<N>(arena_.dimension(), cache_cell_size_);
+        EvaluateConnect(temp.point1_index, temp.point2_index,
+                        *contexts_.front(), results[i]);
+      }
+
+      if (CommitConnect(temp.point2_index, results[i]))
+        AddPointToTree(temp.point2_index, temp.extra_weight);
+
+      end_t = std::chrono::steady_clock::now();
+      duration = end_t - start_t;
+      log << std::chrono::duration<double, std::milli> (duration).count() <<
+          std::endl;
+      start_t = end_t;
+    }
   }
+  speculated_results_.clear();
 
-  if (!pq_.empty() && bubbles_.at(end_index_)->parent() != nullptr) {
+  if (!pq_.empty() && bubbles_.at(end_index_) != BubbleArena<N>::kNull &&
+      arena_.parent(bubbles_.at(end_index_)) != BubbleArena<N>::kNull) {
     std::cout << "**********BUILD SUCCESSFULL**********" << std::endl;
     std::cout << "Bubbles generated: " << pqp_environment_->CreatedBubbles() <<
       std::endl;
     std::cout << "Current q size: " << pq_.size() << std::endl;
+    std::cout << "Cache hit rate: " << CacheHitRate() << std::endl;
+    std::cout << "Warm start hit rate: " <<
+      pqp_environment_->WarmStartHitRate() << ", bounded distances: " <<
+      pqp_environment_->BoundedDistances() << std::endl;
+    std::cout << "Distance BV tests: " <<
+      pqp_environment_->DistanceBvTests() << ", triangle tests: " <<
+      pqp_environment_->DistanceTriTests() << std::endl;
     log << "Bubbles: " <<pqp_environment_->CreatedBubbles() << std::endl <<
       "Connects: " << connects_ << std::endl << "Adds: " << adds_ <<
+      std::endl << "Cache hit rate: " << CacheHitRate() << std::endl <<
+      "Warm start hit rate: " << pqp_environment_->WarmStartHitRate() <<
       std::endl << "Q size: " << pq_.size() << std::endl << 1;
     return true;
   } else {
@@ -181,16 +386,26 @@ bool BubblePrm::BuildTree(const std::string& log_filename) {
     std::cout << "Bubbles generated: " << pqp_environment_->CreatedBubbles() <<
       std::endl;
     std::cout << "Current q size: " << pq_.size() << std::endl;
+    std::cout << "Cache hit rate: " << CacheHitRate() << std::endl;
+    std::cout << "Warm start hit rate: " <<
+      pqp_environment_->WarmStartHitRate() << ", bounded distances: " <<
+      pqp_environment_->BoundedDistances() << std::endl;
+    std::cout << "Distance BV tests: " <<
+      pqp_environment_->DistanceBvTests() << ", triangle tests: " <<
+      pqp_environment_->DistanceTriTests() << std::endl;
     log << "Bubbles: " <<pqp_environment_->CreatedBubbles() << std::endl <<
       "Connects: " << connects_ << std::endl << "Adds: " << adds_ <<
+      std::endl << "Cache hit rate: " << CacheHitRate() << std::endl <<
+      "Warm start hit rate: " << pqp_environment_->WarmStartHitRate() <<
       std::endl << "Q size: " << pq_.size() << std::endl << 0;
     return false;
   }
 }
 
-void BubblePrm::GeneratePath(const std::string& filename) {
-  auto trajectory_it = bubbles_.at(end_index_);
-  if (trajectory_it == nullptr) {
+template <int N>
+void BubblePrmT<N>::GeneratePath(const std::string& filename) {
+  int trajectory_it = bubbles_.at(end_index_);
+  if (trajectory_it == BubbleArena<N>::kNull) {
     std::cout << "Trajectory writing unsuccessful!" << std::endl;
     return;
   }
@@ -206,10 +421,10 @@ void BubblePrm::GeneratePath(const std::string& filename) {
     std::endl << "RL = Robolink()" << std::endl << std::endl <<
     "robot = RL.Item('ABB IRB 120-3/0.6')" << std::endl;
 
-  std::vector<EVectorXd> trajectory_deg;
-  while (trajectory_it != nullptr) {
-    trajectory_deg.push_back(180 * trajectory_it->coordinates() / M_PI);
-    trajectory_it = trajectory_it->parent();
+  std::vector<EVectorNd, Eigen::aligned_allocator<EVectorNd>> trajectory_deg;
+  while (trajectory_it != BubbleArena<N>::kNull) {
+    trajectory_deg.push_back(180 * arena_.coordinates(trajectory_it) / M_PI);
+    trajectory_it = arena_.parent(trajectory_it);
   }
 
   file << "robot.setJoints([";
@@ -232,4 +447,28 @@ void BubblePrm::GeneratePath(const std::string& filename) {
                "--------------------------------" << std::endl << std::endl;
 }
 
+template class BubblePrmT<2>;
+template class BubblePrmT<6>;
+template class BubblePrmT<Eigen::Dynamic>;
+
+std::unique_ptr<PrmTreeInterface> CreateBubblePrm(
+    PqpEnvironment* pqp_environment, const Eigen::VectorXd& start,
+    const Eigen::VectorXd& end, int knn_num, int max_connect_param,
+    double cache_cell_size, int speculated_edges, bool relaxed_order) {
+  switch (start.size()) {
+    case 2:
+      return std::unique_ptr<PrmTreeInterface>(new BubblePrmT<2>(
+          pqp_environment, start, end, knn_num, max_connect_param,
+          cache_cell_size, speculated_edges, relaxed_order));
+    case 6:
+      return std::unique_ptr<PrmTreeInterface>(new BubblePrmT<6>(
+          pqp_environment, start, end, knn_num, max_connect_param,
+          cache_cell_size, speculated_edges, relaxed_order));
+    default:
+      return std::unique_ptr<PrmTreeInterface>(new BubblePrm(
+          pqp_environment, start, end, knn_num, max_connect_param,
+          cache_cell_size, speculated_edges, relaxed_order));
+  }
+}
+
 }  // namespace bubbleprm
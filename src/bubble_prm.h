@@ -20,12 +20,15 @@
 #include <Eigen/Dense>
 #include <vector>
 #include <queue>
+#include <map>
+#include <utility>
 #include <memory>
 #include <string>
 
 #include "prm_tree.h"
 #include "environment/pqp_environment.h"
-#include "bubble.h"
+#include "bubble_arena.h"
+#include "bubble_cache.h"
 
 namespace bubbleprm {
 
@@ -39,37 +42,121 @@ struct Edge {
   double weight, extra_weight;
 };
 
+// Total order, so that the order of edges doesn't depend on the queue
 struct EdgeCompareFunctor {
   bool operator() (const Edge& e1, const Edge& e2) const {
-    return e1.weight > e2.weight;
+    if (e1.weight != e2.weight) return e1.weight > e2.weight;
+    if (e1.point1_index != e2.point1_index)
+      return e1.point1_index > e2.point1_index;
+    return e1.point2_index > e2.point2_index;
   }
 };
 
-class BubblePrm : PrmTree {
+// Outcome of evaluating ConnectPoints against a snapshot of the planner,
+// applied to the planner once committed
+template <int N>
+struct ConnectResult {
+  ConnectResult(size_t dimension, double cache_cell_size)
+      : connected(false), parent(BubbleArena<N>::kNull), snapshot(0),
+        bubbles(dimension), cache(cache_cell_size) {}
+
+  bool connected;
+  int parent;  // Parent of the second point's bubble
+  int snapshot;  // Arena size at evaluation, handle of the first new bubble
+  BubbleArena<N> bubbles;  // New bubbles
+  BubbleCache<N> cache;  // New bubbles to be cached
+  typename BubbleCache<N>::CellSizes cache_cells;  // Searched cache cells
+};
+
+template <int N>
+class BubblePrmT : public PrmTreeT<N> {
  public:
-  typedef Eigen::VectorXd EVectorXd;
-  BubblePrm(PqpEnvironment* pqp_environment, EVectorXd& start, EVectorXd& end,
-            int knn_num,  // Number of nearest neighbors
-            int max_connect_param = 256  // Max binary splits for ConnectPoints
-            )
-      : PrmTree(pqp_environment, start, end, knn_num),
-        bubbles_(space_size_, nullptr), max_connect_param_(max_connect_param),
-        connects_(0), adds_(0) // Logged parameters
-        {}
+  typedef typename PrmTreeT<N>::EVectorNd EVectorNd;
+  BubblePrmT(PqpEnvironment* pqp_environment, const EVectorNd& start,
+             const EVectorNd& end,
+             int knn_num,  // Number of nearest neighbors
+             int max_connect_param = 256,  // Max ConnectPoints binary splits
+             double cache_cell_size = 0,  // Bubble cache grid, 0 disables it
+             int speculated_edges = 1,  // Edges evaluated concurrently
+             bool relaxed_order = false  // Commits speculated edges unchecked
+             );
 
   virtual bool ConnectPoints(int point1_index, int point2_index);
   virtual bool AddPointToTree(int point_index, double extra_weight = 0);
   virtual bool BuildTree(const std::string& log_filename);
   virtual void GeneratePath(const std::string& filename);
 
+  // Bubbles of the tree, along with the bubble of every point - kNull if it
+  // has none
+  const BubbleArena<N>& arena() const { return arena_; }
+  const std::vector<int>& point_bubbles() const { return bubbles_; }
+  // Fraction of ConnectPoints segments found inside cached bubbles
+  double CacheHitRate() const {
+    return cache_.queries() ?
+      static_cast<double>(cache_.hits()) / cache_.queries() : 0.0;
+  }
+
  private:
-  std::vector<std::shared_ptr<Bubble>> bubbles_;
+  using PrmTreeT<N>::pqp_environment_;
+  using PrmTreeT<N>::start_;
+  using PrmTreeT<N>::end_;
+  using PrmTreeT<N>::start_index_;
+  using PrmTreeT<N>::end_index_;
+  using PrmTreeT<N>::knn_num_;
+  using PrmTreeT<N>::visited_;
+  using PrmTreeT<N>::GetCoordinates;
+
+  typedef std::pair<int, int> EdgeKey;
+
+  // Cached bubble reused at a mid point has to contain it with at most this
+  // fill, so that the bubble derived from it is not too small
+  const double kMaxCacheFill = 0.5;
+
+  // Runs ConnectPoints without modifying the planner, can be called
+  // concurrently with distinct contexts and results
+  void EvaluateConnect(int point1_index, int point2_index,
+                       PqpQueryContext& context,
+                       ConnectResult<N>& result);
+  // Applies the evaluated connection - returns true if the points connected
+  bool CommitConnect(int point2_index, ConnectResult<N>& result);
+  // Evaluates edges concurrently, reusing the results kept from earlier
+  void EvaluateConnects(const std::vector<Edge>& edges,
+                        std::vector<ConnectResult<N>>& results);
+  // Makes bubble at mid of segment begin-end, derived from a cached bubble if
+  // possible. Sets covered instead if a cached bubble contains the segment.
+  // Returns false upon failure.
+  bool MakeMidBubble(const EVectorNd& begin, const EVectorNd& end,
+                     PqpQueryContext& context,
+                     BubbleArenaOverlay<N>& arena, ConnectResult<N>& result,
+                     int& bubble, bool& covered);
+
+  BubbleArena<N> arena_;
+  std::vector<int> bubbles_;  // Bubble handle of every point
+  BubbleCache<N> cache_;
+  double cache_cell_size_;
+  bool use_cache_;
+  // Query context of every thread evaluating edges
+  std::vector<std::unique_ptr<PqpQueryContext>> contexts_;
+  size_t speculated_edges_;
+  bool relaxed_order_;
+  // Evaluated edges put back into the queue
+  std::map<EdgeKey, ConnectResult<N>> speculated_results_;
   double step_size_, collision_limit_;
   int max_connect_param_;
   size_t connects_, adds_;
   std::priority_queue<Edge, std::vector<Edge>, EdgeCompareFunctor> pq_;
 };
 
+typedef BubblePrmT<Eigen::Dynamic> BubblePrm;
+
+// Creates the planner specialized for the dimension of start, falling back
+// to the dynamic size one for dimensions without specialization
+std::unique_ptr<PrmTreeInterface> CreateBubblePrm(
+    PqpEnvironment* pqp_environment, const Eigen::VectorXd& start,
+    const Eigen::VectorXd& end, int knn_num, int max_connect_param = 256,
+    double cache_cell_size = 0, int speculated_edges = 1,
+    bool relaxed_order = false);
+
 }  // namespace bubbleprm
 
 #endif  // BUBBLE_PRM_H_INCLUDED
@@ -25,6 +25,8 @@
 #include <chrono>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <string>
 
 #include "environment/pqp_environment.h"
 #include "random_generator/naive_generator.h"
@@ -71,6 +73,32 @@ BOOST_AUTO_TEST_CASE(hull2) {
   BOOST_CHECK_SMALL((direction - result).norm(), 0.01);
 }
 
+BOOST_AUTO_TEST_CASE(cache) {
+  BubbleArena<2> arena;
+  BubbleCache<2> cache (0.5);
+  int bubble = arena.Add(Eigen::Vector2d(0, 0));
+  arena.dimensions(bubble) << 1, 0.5;
+  cache.Insert(arena, bubble);
+
+  bool covers;
+  // Segment inside the bubble
+  BOOST_CHECK_EQUAL(cache.Find(arena, Eigen::Vector2d(-0.5, 0),
+                               Eigen::Vector2d(0.5, 0.1), 0.5, covers),
+                    bubble);
+  BOOST_CHECK_EQUAL(covers, true);
+  // Only the mid point inside the bubble
+  BOOST_CHECK_EQUAL(cache.Find(arena, Eigen::Vector2d(-0.1, -0.6),
+                               Eigen::Vector2d(0.1, 0.6), 0.5, covers),
+                    bubble);
+  BOOST_CHECK_EQUAL(covers, false);
+  // Mid point too close to the hull
+  BOOST_CHECK_EQUAL(cache.Find(arena, Eigen::Vector2d(0.6, -0.6),
+                               Eigen::Vector2d(0.8, 0.6), 0.5, covers),
+                    arena.kNull);
+  BOOST_CHECK_EQUAL(cache.hits(), 2u);
+  BOOST_CHECK_EQUAL(cache.queries(), 3u);
+}
+
 BOOST_AUTO_TEST_CASE(build) {
   auto start_t = std::chrono::steady_clock::now();
   std::vector<std::pair<double, double>> limits;
@@ -501,3 +529,94 @@ BOOST_AUTO_TEST_CASE(initialcol6) {
   BubblePrm bubble_prm (pqp.release(), start, end, 15);
   BOOST_CHECK_EQUAL(bubble_prm.BuildTree("bubble_col6"), false);
 }
+
+BOOST_AUTO_TEST_CASE(dispatch_twoseg) {
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(0, 3.1416);
+  limits.emplace_back(-2.618, 2.618);
+  EVectorXd start (2); start << 0.0, 0.0;
+  EVectorXd end (2); end << 1.9897, 0.0;
+
+  // Specialized and dynamic size planners
+  for (bool fixed : {true, false}) {
+    std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+      new HaltonGenerator(limits));
+    std::unique_ptr<PqpEnvironment> pqp (new PqpEnvironment(
+        {"models/two-seg/bmp_seg1.stl", "models/two-seg/bmp_seg2.stl"},
+        "models/two-seg/bmp_dh_table.txt",
+        "models/environment/obstacles_twoseg.stl",
+        generator.release(), 1000));
+    std::unique_ptr<PrmTreeInterface> bubble_prm;
+    if (fixed)
+      bubble_prm = CreateBubblePrm(pqp.release(), start, end, 15);
+    else
+      bubble_prm.reset(new BubblePrm(pqp.release(), start, end, 15));
+    BOOST_CHECK_EQUAL(bubble_prm->BuildTree("bubble_twoseg"), true);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(speculated_twoseg) {
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(0, 3.1416);
+  limits.emplace_back(-2.618, 2.618);
+  EVectorXd start (2); start << 0.0, 0.0;
+  EVectorXd end (2); end << 1.9897, 0.0;
+
+  // Strict and relaxed commit order
+  for (bool relaxed : {false, true}) {
+    std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+      new HaltonGenerator(limits));
+    std::unique_ptr<PqpEnvironment> pqp (new PqpEnvironment(
+        {"models/two-seg/bmp_seg1.stl", "models/two-seg/bmp_seg2.stl"},
+        "models/two-seg/bmp_dh_table.txt",
+        "models/environment/obstacles_twoseg.stl",
+        generator.release(), 1000));
+    std::unique_ptr<PrmTreeInterface> bubble_prm (CreateBubblePrm(
+        pqp.release(), start, end, 15, 256, 0.3, 4, relaxed));
+    BOOST_CHECK_EQUAL(bubble_prm->BuildTree("bubble_twoseg"), true);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(speculated_serial_twoseg) {
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(0, 3.1416);
+  limits.emplace_back(-2.618, 2.618);
+  EVectorXd start (2); start << 0.0, 0.0;
+  EVectorXd end (2); end << 1.9897, 0.0;
+
+  // Strict order speculation builds the tree of the serial planner, with and
+  // without the cache
+  for (unsigned seed : {1u, 2u, 3u, 4u}) {
+    for (double cache_cell_size : {0.0, 0.3}) {
+      bool built[2];
+      std::vector<int> parents[2], point_bubbles[2];
+      std::string paths[2];
+      for (int speculated : {0, 1}) {
+        std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+          new NaiveGenerator(limits, seed));
+        std::unique_ptr<PqpEnvironment> pqp (new PqpEnvironment(
+            {"models/two-seg/bmp_seg1.stl", "models/two-seg/bmp_seg2.stl"},
+            "models/two-seg/bmp_dh_table.txt",
+            "models/environment/obstacles_twoseg.stl",
+            generator.release(), 1000));
+        BubblePrm bubble_prm (pqp.release(), start, end, 15, 256,
+                              cache_cell_size, speculated ? 4 : 1, false);
+        built[speculated] = bubble_prm.BuildTree("bubble_twoseg");
+
+        for (size_t i = 0; i < bubble_prm.arena().size(); ++i)
+          parents[speculated].push_back(bubble_prm.arena().parent(i));
+        point_bubbles[speculated] = bubble_prm.point_bubbles();
+        if (built[speculated]) {
+          bubble_prm.GeneratePath("bubble_twoseg_path.py");
+          std::ifstream path ("bubble_twoseg_path.py");
+          paths[speculated].assign(std::istreambuf_iterator<char>(path),
+                                   std::istreambuf_iterator<char>());
+        }
+      }
+      BOOST_CHECK_EQUAL(built[0], built[1]);
+      BOOST_CHECK(parents[0] == parents[1]);
+      BOOST_CHECK(point_bubbles[0] == point_bubbles[1]);
+      BOOST_CHECK_EQUAL(paths[0], paths[1]);
+    }
+  }
+}
@@ -44,3 +44,37 @@ const void DhParameter::InverseTransform(EMatrix& R, EVector& T) const {
   T = rotation_.transpose() * T - rotation_.transpose() * translation_;
   R = rotation_.transpose() * R;
 }
+
+ForwardKinematics::ForwardKinematics(const std::vector<DhParameter>& dh_table)
+    : dh_table_(dh_table), rotation_(dh_table.size()),
+      base_rotation_(dh_table.size()), inverse_rotation_(dh_table.size()),
+      translation_(dh_table.size()), base_translation_(dh_table.size()),
+      inverse_translation_(dh_table.size()) {}
+
+void ForwardKinematics::Compute(const double* q) {
+  EMatrix R = EMatrix::Identity();
+  EVector T (0.0, 0.0, 0.0);
+
+  // Prefix pass - every transform of the chain is applied once
+  for (size_t i = 0; i < dh_table_.size(); ++i) {
+    base_rotation_[i] = R;
+    base_translation_[i] = T;
+
+    // Same as R * AngleAxis(q, z), without building the rotation
+    const float c = std::cos(static_cast<float>(q[i])),
+                s = std::sin(static_cast<float>(q[i]));
+    const EVector x = R.col(0);
+    R.col(0) = c * x + s * R.col(1);
+    R.col(1) = c * R.col(1) - s * x;
+
+    rotation_[i] = R;
+    translation_[i] = T;
+    dh_table_[i].Transform(R, T);
+  }
+
+  // Inverse pass - maps the chain into each joint's base frame
+  for (size_t i = 0; i < dh_table_.size(); ++i) {
+    inverse_rotation_[i] = base_rotation_[i].transpose();
+    inverse_translation_[i] = -(inverse_rotation_[i] * base_translation_[i]);
+  }
+}
@@ -57,4 +57,34 @@ class DhParameter {
   EVector translation_;
 };
 
+// Forward kinematics of a serial chain with revolute joints about the local z
+// axes. All frames of a configuration are computed at once, so that queries
+// over the whole chain don't have to recompute the prefix transforms.
+class ForwardKinematics {
+ public:
+  explicit ForwardKinematics(const std::vector<DhParameter>& dh_table);
+
+  size_t size() const { return dh_table_.size(); }
+  // Computes link and joint frames for joint coordinates q
+  void Compute(const double* q);
+
+  // Frame of link i - placement of the i-th segment
+  const EMatrix& rotation(size_t i) const { return rotation_[i]; }
+  const EVector& translation(size_t i) const { return translation_[i]; }
+  // Frame joint i rotates in, before applying its coordinate
+  const EMatrix& base_rotation(size_t i) const { return base_rotation_[i]; }
+  const EVector& base_translation(size_t i) const {
+    return base_translation_[i];
+  }
+  // Transforms world point p to the base frame of joint i
+  EVector ToBase(size_t i, const EVector& p) const {
+    return inverse_rotation_[i] * p + inverse_translation_[i];
+  }
+
+ private:
+  std::vector<DhParameter> dh_table_;
+  std::vector<EMatrix> rotation_, base_rotation_, inverse_rotation_;
+  std::vector<EVector> translation_, base_translation_, inverse_translation_;
+};
+
 #endif  // DH_PARAMETER_H_INCLUDED
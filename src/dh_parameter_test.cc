@@ -101,4 +101,29 @@ BOOST_AUTO_TEST_CASE(transform) {
            0.00000,  0.58779,   0.80902;
   EVector T_exp (1.8660, 2.5, 5.0);
   CheckCloseTransform(R, T, R_exp, T_exp);
+}
+
+BOOST_AUTO_TEST_CASE(forward_kinematics) {
+  const double pi_6 = M_PI / 6, pi_5 = M_PI / 5;
+  std::vector<DhParameter> dh_table {DhParameter(pi_6, 2, 1, pi_5),
+      DhParameter(0, 0.5, 1.5, M_PI_2), DhParameter(pi_5, 0, 0.25, 0)};
+  ForwardKinematics kinematics (dh_table);
+  Eigen::VectorXd q (3); q << 0.3, -1.2, 2.5;
+  kinematics.Compute(q.data());
+
+  EMatrix R (EMatrix::Identity());
+  EVector T (0, 0, 0);
+  for (size_t i = 0; i < dh_table.size(); ++i) {
+    CheckCloseTransform(kinematics.base_rotation(i),
+                        kinematics.base_translation(i), R, T);
+    R = R * Eigen::AngleAxisf(q[i], EVector::UnitZ());
+    CheckCloseTransform(kinematics.rotation(i), kinematics.translation(i),
+                        R, T);
+
+    // Point on the joint axis stays on the base frame z axis
+    EVector point (kinematics.ToBase(i, T + 2 * R.col(2)));
+    CheckCloseTransform(EMatrix::Identity(), point, EMatrix::Identity(),
+                        EVector(0, 0, 2));
+    dh_table[i].Transform(R, T);
+  }
 }
\ No newline at end of file
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include "bvh_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+BvhStats ComputeBvhStats(const PQP_Model& model) {
+  BvhStats stats = {0, 0, 0.0, {}, 0.0, 0.0};
+  if (model.num_bvs <= 0) return stats;
+
+  long long leaf_depth_sum = 0;
+  int leaves = 0;
+  std::vector<std::pair<int, int>> stack (1, std::make_pair(0, 0));
+  while (!stack.empty()) {
+    const int node = stack.back().first, depth = stack.back().second;
+    stack.pop_back();
+    const BV& bv = model.b[node];
+    ++stats.nodes;
+#if PQP_BV_TYPE & OBB_TYPE
+    if (model.bv_type & OBB_TYPE) {
+      const OBB& obb = *model.child_obb(node);
+      stats.obb_volume += 8.0 * obb.d[0] * obb.d[1] * obb.d[2];
+    }
+#endif
+#if PQP_BV_TYPE & RSS_TYPE
+    // Rectangle swept by the sphere
+    if (model.bv_type & RSS_TYPE)
+      stats.rss_volume += 2.0 * bv.l[0] * bv.l[1] * bv.r +
+          M_PI * (bv.l[0] + bv.l[1]) * bv.r * bv.r +
+          4.0 / 3.0 * M_PI * bv.r * bv.r * bv.r;
+#endif
+    if (bv.first_child < 0) {
+      if (depth >= static_cast<int>(stats.leaf_depths.size()))
+        stats.leaf_depths.resize(depth + 1, 0);
+      ++stats.leaf_depths[depth];
+      stats.depth = std::max(stats.depth, depth);
+      leaf_depth_sum += depth;
+      ++leaves;
+    } else {
+      stack.emplace_back(bv.first_child + 1, depth + 1);
+      stack.emplace_back(bv.first_child, depth + 1);
+    }
+  }
+  stats.mean_leaf_depth = static_cast<double>(leaf_depth_sum) / leaves;
+  return stats;
+}
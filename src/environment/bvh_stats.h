@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef BVH_STATS_H_INCLUDED
+#define BVH_STATS_H_INCLUDED
+
+#include <PQP/PQP.h>
+#include <vector>
+
+// Shape of a built PQP hierarchy, for comparing split rules. Every PQP leaf
+// holds a single triangle, so leaves are described by their depths.
+struct BvhStats {
+  int nodes;
+  int depth;  // Of the deepest leaf, the root is at depth 0
+  double mean_leaf_depth;
+  std::vector<int> leaf_depths;  // Number of leaves at every depth
+  // Summed volumes of the bounding volumes of all nodes, zero for the BV
+  // types the model was built without
+  double obb_volume, rss_volume;
+};
+
+BvhStats ComputeBvhStats(const PQP_Model& model);
+
+#endif  // BVH_STATS_H_INCLUDED
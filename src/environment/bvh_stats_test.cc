@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE BvhStatsTest
+
+#include "bvh_stats.h"
+
+#include <cmath>
+#include <memory>
+#include <numeric>
+#include <random>
+
+#include <boost/test/unit_test.hpp>
+
+const int kSplitRules[] = {PQP_SPLIT_MEAN, PQP_SPLIT_MEDIAN, PQP_SPLIT_SAH};
+
+// Long thin fixture, with most triangles crowded at one end
+std::unique_ptr<PQP_Model> MakeFixture(int num_tris, int split_rule) {
+  std::unique_ptr<PQP_Model> model (new PQP_Model);
+  std::mt19937 generator (3);
+  std::uniform_real_distribution<float> unit (0, 1);
+  model->BeginModel(num_tris);
+  for (int i = 0; i < num_tris; ++i) {
+    const float x = 1000 * std::pow(unit(generator), 4.0f),
+                y = unit(generator), z = unit(generator);
+    PQP_REAL p1[3] = {x, y, z}, p2[3] = {x + 1, y, z}, p3[3] = {x, y + 1, z};
+    model->AddTri(p1, p2, p3, i);
+  }
+  model->EndModel(split_rule);
+  return model;
+}
+
+BOOST_AUTO_TEST_CASE(single_triangle) {
+  PQP_Model model;
+  PQP_REAL p1[3] = {0, 0, 0}, p2[3] = {2, 0, 0}, p3[3] = {0, 2, 0};
+  model.BeginModel();
+  model.AddTri(p1, p2, p3, 0);
+  model.EndModel();
+
+  const BvhStats stats = ComputeBvhStats(model);
+  BOOST_CHECK_EQUAL(stats.nodes, 1);
+  BOOST_CHECK_EQUAL(stats.depth, 0);
+  BOOST_CHECK_EQUAL(stats.mean_leaf_depth, 0.0);
+  BOOST_REQUIRE_EQUAL(stats.leaf_depths.size(), 1);
+  BOOST_CHECK_EQUAL(stats.leaf_depths[0], 1);
+  // Flat triangle has flat bounding volumes
+  BOOST_CHECK_SMALL(stats.obb_volume, 1e-6);
+  BOOST_CHECK_SMALL(stats.rss_volume, 1e-6);
+}
+
+BOOST_AUTO_TEST_CASE(split_rules) {
+  const int num_tris = 3000;
+  std::vector<BvhStats> stats;
+  for (int split_rule : kSplitRules) {
+    std::unique_ptr<PQP_Model> model = MakeFixture(num_tris, split_rule);
+    stats.push_back(ComputeBvhStats(*model));
+    BOOST_CHECK_EQUAL(stats.back().nodes, 2 * num_tris - 1);
+    BOOST_CHECK_EQUAL(std::accumulate(stats.back().leaf_depths.begin(),
+                                      stats.back().leaf_depths.end(), 0),
+                      num_tris);
+    BOOST_CHECK_EQUAL(stats.back().leaf_depths.size(),
+                      stats.back().depth + 1);
+    BOOST_CHECK_GE(stats.back().depth, std::ceil(std::log2(num_tris)));
+  }
+  // Median splits give the balanced tree
+  BOOST_CHECK_EQUAL(stats[PQP_SPLIT_MEDIAN].depth,
+                    std::ceil(std::log2(num_tris)));
+  BOOST_CHECK_LT(stats[PQP_SPLIT_MEDIAN].depth, stats[PQP_SPLIT_MEAN].depth);
+}
+
+BOOST_AUTO_TEST_CASE(split_rules_distance) {
+  std::unique_ptr<PQP_Model> models[3];
+  for (int split_rule : kSplitRules)
+    models[split_rule] = MakeFixture(2000, split_rule);
+
+  PQP_Model probe;
+  PQP_REAL p1[3] = {0, 0, 0}, p2[3] = {1, 0, 0}, p3[3] = {0, 0, 1};
+  probe.BeginModel();
+  probe.AddTri(p1, p2, p3, 0);
+  probe.EndModel();
+
+  PQP_REAL R[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}, T0[3] = {0, 0, 0};
+  for (float x = -50; x < 1100; x += 97) {
+    PQP_REAL T[3] = {x, 5, 3};
+    PQP_DistanceResult results[3];
+    for (int split_rule : kSplitRules) {
+      PQP_Distance(&results[split_rule], R, T, &probe, R, T0,
+                   models[split_rule].get(), 0.0, 0.0);
+      BOOST_CHECK_GT(results[split_rule].NumBVTests(), 0);
+    }
+    BOOST_CHECK_CLOSE(results[PQP_SPLIT_MEDIAN].Distance(),
+                      results[PQP_SPLIT_MEAN].Distance(), 1e-4);
+    BOOST_CHECK_CLOSE(results[PQP_SPLIT_SAH].Distance(),
+                      results[PQP_SPLIT_MEAN].Distance(), 1e-4);
+  }
+}
@@ -0,0 +1,453 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include "distance_field.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Field data is the header followed by the block corner distances, the
+// block indices and the distances of the sampled blocks
+struct FieldHeader {
+  char magic[8];
+  uint32_t version, block_cells;
+  uint64_t key;
+  int32_t dims[3], sampled_blocks;
+  double origin[3], cell_size;
+};
+static_assert(sizeof(FieldHeader) % sizeof(float) == 0 &&
+              sizeof(float) == sizeof(int32_t), "Field arrays misaligned");
+
+const char kFieldMagic[8] = "DISTFLD";
+// Bump when the layout or the way fields are sampled changes
+const uint32_t kFieldVersion = 1;
+const uint64_t kFieldSeed = 3;
+// Grids are limited to keep their sizes in range
+const int kMaxBlocksPerAxis = 1024;
+const int kBlockNodes = DistanceField::kBlockCells + 1;
+const int kBlockSamples = kBlockNodes * kBlockNodes * kBlockNodes;
+// Relative growth of the spheres placed in the world
+const double kSphereMargin = 1e-5;
+
+size_t Corners(const int32_t dims[3]) {
+  return static_cast<size_t>(dims[0] + 1) * (dims[1] + 1) * (dims[2] + 1);
+}
+
+size_t Blocks(const int32_t dims[3]) {
+  return static_cast<size_t>(dims[0]) * dims[1] * dims[2];
+}
+
+size_t FieldSize(const int32_t dims[3], int sampled_blocks) {
+  return sizeof(FieldHeader) + sizeof(float) * Corners(dims) +
+         sizeof(int32_t) * Blocks(dims) +
+         sizeof(float) * kBlockSamples * static_cast<size_t>(sampled_blocks);
+}
+
+// Closest floats not above and not below the value
+float RoundDown(double value) {
+  const float rounded = value;
+  return rounded > value ? std::nextafter(rounded, -INFINITY) : rounded;
+}
+
+float RoundUp(double value) {
+  const float rounded = value;
+  return rounded < value ? std::nextafter(rounded, INFINITY) : rounded;
+}
+
+std::string CachePath(const std::string& cache_dir, uint64_t key) {
+  std::ostringstream path;
+  path << cache_dir << '/' << std::hex << std::setw(16) <<
+    std::setfill('0') << key << ".sdf";
+  return path.str();
+}
+
+}  // namespace
+
+DistanceField::DistanceField(
+    const std::shared_ptr<const ObstacleSet>& obstacles, double cell_size,
+    double band, const std::string& cache_dir)
+    : obstacles_(obstacles), size_(0) {
+  if (!obstacles_ || obstacles_->size() == 0 || !(cell_size > 0.0) ||
+      !(band >= 0.0))
+    throw "Distance field problem!";
+
+  uint64_t key = HashBytes(&kFieldSeed, sizeof(kFieldSeed));
+  for (int id = 0; id < obstacles_->slots(); ++id) {
+    if (!obstacles_->contains(id)) continue;
+    const ObstacleSet::Obstacle& obstacle = obstacles_->obstacle(id);
+    key = HashBytes(obstacle.model->tris,
+                    sizeof(Tri) * obstacle.model->num_tris, key);
+    key = HashBytes(obstacle.rotation.data(),
+                    sizeof(float) * obstacle.rotation.size(), key);
+    key = HashBytes(obstacle.translation.data(),
+                    sizeof(float) * obstacle.translation.size(), key);
+  }
+  key = HashBytes(&cell_size, sizeof(cell_size), key);
+  key = HashBytes(&band, sizeof(band), key);
+
+  if (!cache_dir.empty()) {
+    file_.reset(new MappedFile(CachePath(cache_dir, key)));
+    if (file_->mapped() && SetArrays(file_->data(), file_->size(), key))
+      return;
+    file_.reset();
+  }
+  Sample(cell_size, band, key);
+  if (!SetArrays(data_.data(), data_.size(), key))
+    throw "Distance field problem!";
+  if (!cache_dir.empty()) {
+    // Cache is only an optimization, so failing to write it is not an error
+    mkdir(cache_dir.c_str(), 0755);
+    Store(CachePath(cache_dir, key));
+  }
+}
+
+bool DistanceField::SetArrays(const char* data, size_t size, uint64_t key) {
+  FieldHeader header;
+  if (size < sizeof(header)) return false;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kFieldMagic, sizeof(kFieldMagic)) ||
+      header.version != kFieldVersion ||
+      header.block_cells != static_cast<uint32_t>(kBlockCells) ||
+      header.key != key || !(header.cell_size > 0.0) ||
+      header.sampled_blocks < 0)
+    return false;
+  for (int axis = 0; axis < 3; ++axis)
+    if (header.dims[axis] <= 0 || header.dims[axis] > kMaxBlocksPerAxis)
+      return false;
+  if (header.sampled_blocks > static_cast<int64_t>(Blocks(header.dims)) ||
+      size != FieldSize(header.dims, header.sampled_blocks))
+    return false;
+
+  // Header keeps the arrays aligned within the mapping
+  const float* corners = reinterpret_cast<const float*>(data + sizeof(header));
+  const int32_t* block_index =
+      reinterpret_cast<const int32_t*>(corners + Corners(header.dims));
+  // Guards the lookups against a corrupt field
+  for (size_t block = 0; block < Blocks(header.dims); ++block)
+    if (block_index[block] < -1 ||
+        block_index[block] >= header.sampled_blocks)
+      return false;
+
+  for (int axis = 0; axis < 3; ++axis) {
+    origin_[axis] = header.origin[axis];
+    dims_[axis] = header.dims[axis];
+  }
+  cell_size_ = header.cell_size;
+  block_size_ = cell_size_ * kBlockCells;
+  sampled_blocks_ = header.sampled_blocks;
+  corners_ = corners;
+  block_index_ = block_index;
+  block_samples_ = reinterpret_cast<const float*>(block_index +
+                                                   Blocks(header.dims));
+  size_ = size;
+  return true;
+}
+
+void DistanceField::Sample(double cell_size, double band, uint64_t key) {
+  // Grid covers the obstacle triangles, grown by the band
+  EVector3f min = EVector3f::Constant(INFINITY),
+            max = EVector3f::Constant(-INFINITY);
+  for (int id = 0; id < obstacles_->slots(); ++id) {
+    if (!obstacles_->contains(id)) continue;
+    const ObstacleSet::Obstacle& obstacle = obstacles_->obstacle(id);
+    for (int i = 0; i < obstacle.model->num_tris; ++i) {
+      const Tri& tri = obstacle.model->tris[i];
+      for (const PQP_REAL* p : {tri.p1, tri.p2, tri.p3}) {
+        const EVector3f vertex = obstacle.rotation *
+            EVector3f(p[0], p[1], p[2]) + obstacle.translation;
+        min = min.cwiseMin(vertex);
+        max = max.cwiseMax(vertex);
+      }
+    }
+  }
+
+  FieldHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kFieldMagic, sizeof(kFieldMagic));
+  header.version = kFieldVersion;
+  header.block_cells = kBlockCells;
+  header.key = key;
+  header.cell_size = cell_size;
+  const double block_size = cell_size * kBlockCells;
+  // Box is grown to hold the triangles despite the rounding errors
+  const double grown = band + 1e-5 * std::max(min.cwiseAbs().maxCoeff(),
+                                              max.cwiseAbs().maxCoeff());
+  for (int axis = 0; axis < 3; ++axis) {
+    header.origin[axis] = min(axis) - grown;
+    const double blocks = std::ceil((max(axis) - min(axis) + 2 * grown) /
+                                    block_size);
+    if (!(blocks <= kMaxBlocksPerAxis)) throw "Distance field problem!";
+    header.dims[axis] = std::max(static_cast<int>(blocks), 1);
+  }
+  const int32_t* dims = header.dims;
+
+  // Samples are taken at float points, off the grid by the rounding, which
+  // is subtracted so that they bound the distances at the grid points
+  const auto sample = [this](const Eigen::Vector3d& point,
+                             double upper_bound) {
+    const EVector3f rounded = point.cast<float>();
+    const double offset = (rounded.cast<double>() - point).norm();
+    return RoundDown(std::max(obstacles_->CapsuleDistance(rounded, rounded,
+        0.0, upper_bound + offset) - offset, 0.0));
+  };
+  const Eigen::Vector3d origin (header.origin[0], header.origin[1],
+                                header.origin[2]);
+
+  std::vector<float> corners (Corners(dims));
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (int i = 0; i < static_cast<int>(corners.size()); ++i) {
+    const Eigen::Vector3d node (i % (dims[0] + 1),
+                                i / (dims[0] + 1) % (dims[1] + 1),
+                                i / ((dims[0] + 1) * (dims[1] + 1)));
+    corners[i] = sample(origin + node * block_size, INFINITY);
+  }
+  const auto corner = [&corners, dims](int x, int y, int z) {
+    return corners[(static_cast<size_t>(z) * (dims[1] + 1) + y) *
+                   (dims[0] + 1) + x];
+  };
+
+  // Points of blocks sampled at the corners only are further than the band
+  // from the obstacles
+  const double reach = band + block_size * std::sqrt(3.0) / 2;
+  std::vector<int32_t> block_index (Blocks(dims), -1);
+  std::vector<int> sampled;
+  for (int z = 0; z < dims[2]; ++z)
+    for (int y = 0; y < dims[1]; ++y)
+      for (int x = 0; x < dims[0]; ++x) {
+        float nearest = INFINITY;
+        for (int k = 0; k < 8; ++k)
+          nearest = std::min(nearest,
+              corner(x + (k & 1), y + (k >> 1 & 1), z + (k >> 2)));
+        if (nearest >= reach) continue;
+        const int block = (z * dims[1] + y) * dims[0] + x;
+        block_index[block] = sampled.size();
+        sampled.push_back(block);
+      }
+  header.sampled_blocks = sampled.size();
+
+  data_.resize(FieldSize(dims, header.sampled_blocks));
+  char* data = data_.data();
+  std::memcpy(data, &header, sizeof(header));
+  std::memcpy(data + sizeof(header), corners.data(),
+              sizeof(float) * corners.size());
+  std::memcpy(data + sizeof(header) + sizeof(float) * corners.size(),
+              block_index.data(), sizeof(int32_t) * block_index.size());
+  float* samples = reinterpret_cast<float*>(data + sizeof(header) +
+      sizeof(float) * corners.size() + sizeof(int32_t) * block_index.size());
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < header.sampled_blocks; ++i) {
+    const int block[3] = {sampled[i] % dims[0],
+                          sampled[i] / dims[0] % dims[1],
+                          sampled[i] / (dims[0] * dims[1])};
+    float* block_samples = samples + static_cast<size_t>(i) * kBlockSamples;
+    for (int k = 0; k < kBlockSamples; ++k) {
+      const Eigen::Vector3i local (k % kBlockNodes,
+                                   k / kBlockNodes % kBlockNodes,
+                                   k / (kBlockNodes * kBlockNodes));
+      // Block corners bound the distance from above, pruning the traversal
+      double upper_bound = INFINITY;
+      for (int c = 0; c < 8; ++c) {
+        const Eigen::Vector3i offset (c & 1, c >> 1 & 1, c >> 2);
+        upper_bound = std::min(upper_bound, corner(block[0] + offset(0),
+            block[1] + offset(1), block[2] + offset(2)) + cell_size *
+            (offset * kBlockCells - local).cast<double>().norm());
+      }
+      const Eigen::Vector3d node (block[0] * kBlockCells + local(0),
+                                  block[1] * kBlockCells + local(1),
+                                  block[2] * kBlockCells + local(2));
+      block_samples[k] = sample(origin + node * cell_size,
+                                upper_bound * (1 + 1e-6) + 1e-6);
+    }
+  }
+}
+
+void DistanceField::Store(const std::string& path) const {
+  // Written aside and renamed, so that concurrent readers never see a
+  // partial file
+  const std::string temp_path = path + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream output (temp_path, std::ios::binary);
+    output.write(data_.data(), data_.size());
+    if (!output) {
+      output.close();
+      std::remove(temp_path.c_str());
+      return;
+    }
+  }
+  if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+    std::remove(temp_path.c_str());
+}
+
+double DistanceField::DistanceLowerBound(const EVector3f& point) const {
+  // Grid coordinates in blocks, points outside are at least as far from
+  // the obstacles as from the grid, which holds them
+  double grid[3], outside = 0.0;
+  int block[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    const double x = (point(axis) - origin_[axis]) / block_size_;
+    grid[axis] = std::min(std::max(x, 0.0), static_cast<double>(dims_[axis]));
+    outside += (x - grid[axis]) * (x - grid[axis]);
+    block[axis] = std::min(static_cast<int>(grid[axis]), dims_[axis] - 1);
+  }
+  outside = std::sqrt(outside) * block_size_;
+
+  // Distances grow no faster than the way from a sample
+  double lower_bound = -INFINITY;
+  const int32_t index =
+      block_index_[(block[2] * dims_[1] + block[1]) * dims_[0] + block[0]];
+  if (index >= 0) {
+    const float* samples = block_samples_ +
+                           static_cast<size_t>(index) * kBlockSamples;
+    double local[3];
+    int cell[3];
+    for (int axis = 0; axis < 3; ++axis) {
+      local[axis] = (grid[axis] - block[axis]) * kBlockCells;
+      cell[axis] = std::min(static_cast<int>(local[axis]), kBlockCells - 1);
+    }
+    for (int k = 0; k < 8; ++k) {
+      const int x = cell[0] + (k & 1), y = cell[1] + (k >> 1 & 1),
+                z = cell[2] + (k >> 2);
+      const double dx = local[0] - x, dy = local[1] - y, dz = local[2] - z;
+      lower_bound = std::max(lower_bound,
+          samples[(z * kBlockNodes + y) * kBlockNodes + x] -
+          cell_size_ * std::sqrt(dx * dx + dy * dy + dz * dz));
+    }
+  } else {
+    for (int k = 0; k < 8; ++k) {
+      const int x = block[0] + (k & 1), y = block[1] + (k >> 1 & 1),
+                z = block[2] + (k >> 2);
+      const double dx = grid[0] - x, dy = grid[1] - y, dz = grid[2] - z;
+      lower_bound = std::max(lower_bound,
+          corners_[(static_cast<size_t>(z) * (dims_[1] + 1) + y) *
+                   (dims_[0] + 1) + x] -
+          block_size_ * std::sqrt(dx * dx + dy * dy + dz * dz));
+    }
+  }
+  return std::max(std::max(lower_bound - outside, outside), 0.0);
+}
+
+double DistanceField::DistanceLowerBound(const std::vector<Sphere>& spheres,
+    const EMatrix& rotation, const EVector3f& translation) const {
+  double lower_bound = INFINITY;
+  for (const auto& sphere : spheres) {
+    const EVector3f center = rotation * sphere.center + translation;
+    // Sphere is grown to stay conservative despite the rounding errors
+    lower_bound = std::min(lower_bound, DistanceLowerBound(center) -
+        sphere.radius - kSphereMargin * (sphere.radius + center.norm()));
+  }
+  return std::max(lower_bound, 0.0);
+}
+
+std::vector<DistanceField::Sphere> DistanceField::BoundingSpheres(
+    const PQP_Model& model, size_t max_spheres) {
+  if (model.num_bvs <= 0 || max_spheres == 0) return {};
+
+  // Parts of the model are BVH nodes and, below the leaves, triangles
+  // halved at their longest edges
+  struct Part {
+    int node;  // Negative for triangles
+    EVector3f vertices[3];
+    Sphere sphere;
+  };
+  // Sphere around the box of the vertices
+  const auto cover = [](const std::vector<EVector3f>& vertices) {
+    EVector3f min = vertices[0], max = vertices[0];
+    for (const auto& vertex : vertices) {
+      min = min.cwiseMin(vertex);
+      max = max.cwiseMax(vertex);
+    }
+    Sphere sphere {(min + max) / 2, 0.0f};
+    double radius = 0.0;
+    for (const auto& vertex : vertices)
+      radius = std::max(radius,
+          (vertex.cast<double>() - sphere.center.cast<double>()).norm());
+    sphere.radius = RoundUp(radius);
+    return sphere;
+  };
+  const auto triangle = [&cover](const EVector3f& a, const EVector3f& b,
+                                 const EVector3f& c) {
+    Part part {-1, {a, b, c}, cover({a, b, c})};
+    return part;
+  };
+  const auto node_part = [&model, &cover, &triangle](int node) {
+    const int first_child = model.b[node].first_child;
+    if (first_child < 0) {
+      const Tri& tri = model.tris[-first_child - 1];
+      return triangle(EVector3f(tri.p1[0], tri.p1[1], tri.p1[2]),
+                      EVector3f(tri.p2[0], tri.p2[1], tri.p2[2]),
+                      EVector3f(tri.p3[0], tri.p3[1], tri.p3[2]));
+    }
+    std::vector<EVector3f> vertices;
+    std::vector<int> stack (1, node);
+    while (!stack.empty()) {
+      const int child = model.b[stack.back()].first_child;
+      stack.pop_back();
+      if (child < 0) {
+        const Tri& tri = model.tris[-child - 1];
+        for (const PQP_REAL* p : {tri.p1, tri.p2, tri.p3})
+          vertices.emplace_back(p[0], p[1], p[2]);
+      } else {
+        stack.push_back(child);
+        stack.push_back(child + 1);
+      }
+    }
+    Part part {node, {}, cover(vertices)};
+    return part;
+  };
+
+  // Largest sphere is replaced by those of the two halves of its part
+  std::vector<Part> parts (1, node_part(0));
+  while (parts.size() < max_spheres) {
+    size_t largest = 0;
+    for (size_t k = 1; k < parts.size(); ++k)
+      if (parts[k].sphere.radius > parts[largest].sphere.radius)
+        largest = k;
+    const Part part = parts[largest];
+    if (part.sphere.radius <= 0.0f) break;
+    if (part.node >= 0) {
+      const int first_child = model.b[part.node].first_child;
+      parts[largest] = node_part(first_child);
+      parts.push_back(node_part(first_child + 1));
+    } else {
+      int edge = 0;
+      for (int k = 1; k < 3; ++k)
+        if ((part.vertices[(k + 1) % 3] - part.vertices[k]).squaredNorm() >
+            (part.vertices[(edge + 1) % 3] - part.vertices[edge]).squaredNorm())
+          edge = k;
+      const EVector3f& a = part.vertices[edge];
+      const EVector3f& b = part.vertices[(edge + 1) % 3];
+      const EVector3f& c = part.vertices[(edge + 2) % 3];
+      const EVector3f middle = (a + b) / 2;
+      parts[largest] = triangle(a, middle, c);
+      parts.push_back(triangle(middle, b, c));
+    }
+  }
+
+  std::vector<Sphere> spheres;
+  for (const auto& part : parts)
+    spheres.push_back(part.sphere);
+  return spheres;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef DISTANCE_FIELD_H_INCLUDED
+#define DISTANCE_FIELD_H_INCLUDED
+
+#include <cmath>
+#include <PQP/PQP.h>
+#include <Eigen/Dense>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "obstacle_set.h"
+
+// Distances to the obstacles of a set, sampled on a sparse grid. Blocks of
+// kBlockCells cells per edge within band of the obstacle surfaces are
+// sampled every cell, the others only at their corners. A point moves away
+// from the obstacles no faster than it moves, which bounds the distances
+// between samples from below - the field gives conservative clearances
+// for a few lookups instead of a BVH traversal. Distances are unsigned,
+// to the obstacle triangles as PQP measures them. The field is kept as
+// laid out on disk, so cached fields are used in place through a read-only
+// mapping.
+class DistanceField {
+ public:
+  typedef Eigen::Matrix<float, 3, 3, Eigen::RowMajor> EMatrix;
+  typedef Eigen::Vector3f EVector3f;
+
+  // Sphere bounding a part of a model
+  struct Sphere {
+    EVector3f center;
+    float radius;
+  };
+
+  static const int kBlockCells = 8;
+
+  // Samples the obstacles cell_size apart within band of their surfaces,
+  // or maps the field cached in cache_dir for the same obstacles and
+  // parameters, caching the sampled one. Empty directory disables the
+  // cache. Throws for an empty obstacle set.
+  DistanceField(const std::shared_ptr<const ObstacleSet>& obstacles,
+                double cell_size, double band,
+                const std::string& cache_dir = "");
+  DistanceField(const DistanceField&) = delete;
+  DistanceField& operator=(const DistanceField&) = delete;
+
+  // Obstacles the field was sampled for, later updates don't change it
+  const std::shared_ptr<const ObstacleSet>& obstacles() const {
+    return obstacles_;
+  }
+  // Lower bound of the distance from point to the obstacles, exact at the
+  // samples
+  double DistanceLowerBound(const EVector3f& point) const;
+  // Lower bound of the distance from the spheres, placed in the world by
+  // rotation and translation, to the obstacles
+  double DistanceLowerBound(const std::vector<Sphere>& spheres,
+                            const EMatrix& rotation,
+                            const EVector3f& translation) const;
+  // Field was mapped from the cache rather than sampled
+  bool cached() const { return file_ != nullptr; }
+  int blocks() const { return dims_[0] * dims_[1] * dims_[2]; }
+  int sampled_blocks() const { return sampled_blocks_; }
+  // Bytes of the field, as stored in the cache
+  size_t size() const { return size_; }
+
+  // At most max_spheres spheres covering the triangles of the model, in its
+  // frame. Spheres bound nodes of the model BVH, the largest one is
+  // replaced by those of its children while the limit allows.
+  static std::vector<Sphere> BoundingSpheres(const PQP_Model& model,
+                                             size_t max_spheres);
+
+ private:
+  // Points the arrays into the field data, false unless it is complete and
+  // was sampled for the key by this build
+  bool SetArrays(const char* data, size_t size, uint64_t key);
+  void Sample(double cell_size, double band, uint64_t key);
+  void Store(const std::string& path) const;
+
+  std::shared_ptr<const ObstacleSet> obstacles_;
+  // Field data, mapped from the cache or sampled
+  std::unique_ptr<MappedFile> file_;
+  std::vector<char> data_;
+  size_t size_;
+  // Grid origin, spacing of the cells and blocks, blocks per axis
+  double origin_[3], cell_size_, block_size_;
+  int dims_[3], sampled_blocks_;
+  // Block corner distances, indices of the sampled blocks, -1 for the
+  // others, and the distances of the sampled blocks
+  const float* corners_;
+  const int32_t* block_index_;
+  const float* block_samples_;
+};
+
+#endif  // DISTANCE_FIELD_H_INCLUDED
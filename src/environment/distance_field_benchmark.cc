@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+// Bubbles of the distance field against the exact and capsule ones, for the
+// ABB IRB 120 among the hard obstacles. Reports the field sampling and
+// mapping times and size, the bubble times and how much smaller the field
+// bubbles are. Run from its build directory, as the tests.
+//
+// Usage: distance_field_benchmark [cell size [band [configurations]]]
+
+#include "pqp_environment.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "random_generator/naive_generator.h"
+
+namespace {
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+// Bubbles of the context at every configuration, timed
+double MakeBubbles(PqpQueryContext* context, const PqpEnvironment& pqp,
+                   int configurations, std::vector<double>* distances) {
+  std::vector<double> dimensions (pqp.scene()->dimension());
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < configurations; ++i)
+    if (!context->MakeBubble(pqp.GetPoint(i), (*distances)[i],
+                             dimensions.data()))
+      (*distances)[i] = 0.0;
+  return Seconds(start);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const double cell_size = argc > 1 ? std::atof(argv[1]) : 20.0;
+  const double band = argc > 2 ? std::atof(argv[2]) : 200.0;
+  const int configurations = argc > 3 ? std::atoi(argv[3]) : 5000;
+
+  char cache_dir[] = "/tmp/distance_field_benchmarkXXXXXX";
+  if (!mkdtemp(cache_dir)) return 1;
+  std::shared_ptr<PqpScene> scene (new PqpScene(
+      {"../models/abb-irb-120/1link.stl", "../models/abb-irb-120/2link.stl",
+      "../models/abb-irb-120/3link1.stl", "../models/abb-irb-120/4link1.stl",
+      "../models/abb-irb-120/5link.stl", "../models/abb-irb-120/6link.stl"},
+      "../models/abb-irb-120/parameters.txt",
+      "../models/environment/obstacles_hard.stl", cache_dir));
+
+  auto start = std::chrono::steady_clock::now();
+  scene->BuildDistanceField(cell_size, band);
+  const double sample_time = Seconds(start);
+  start = std::chrono::steady_clock::now();
+  scene->BuildDistanceField(cell_size, band);
+  const double map_time = Seconds(start);
+  const DistanceField& field = *scene->distance_field();
+  std::printf("field: cell %g band %g, %d of %d blocks sampled, %.1f MB, "
+              "sampled in %.3f s, mapped in %.6f s%s\n", cell_size, band,
+              field.sampled_blocks(), field.blocks(), field.size() / 1e6,
+              sample_time, map_time, field.cached() ? "" : " (not cached)");
+
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(-2.879793266, 2.879793266);
+  limits.emplace_back(-1.919862177, 1.919862177);
+  limits.emplace_back(-1.570796327, 1.221730476);
+  limits.emplace_back(-2.792526803, 2.792526803);
+  limits.emplace_back(-2.094395102, 2.094395102);
+  limits.emplace_back(-6.981317008, 6.981317008);
+  std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+    new NaiveGenerator(limits));
+  PqpEnvironment pqp (scene, generator.get(), configurations);
+  std::unique_ptr<PqpQueryContext> exact (pqp.NewQueryContext());
+  std::unique_ptr<PqpQueryContext> capsule (pqp.NewQueryContext());
+  capsule->set_capsule_bubbles(true);
+  std::unique_ptr<PqpQueryContext> sampled (pqp.NewQueryContext());
+  sampled->set_field_bubbles(true);
+
+  std::vector<double> exact_distances (configurations),
+                      capsule_distances (configurations),
+                      field_distances (configurations);
+  const double exact_time = MakeBubbles(exact.get(), pqp, configurations,
+                                        &exact_distances);
+  const double capsule_time = MakeBubbles(capsule.get(), pqp, configurations,
+                                          &capsule_distances);
+  const double field_time = MakeBubbles(sampled.get(), pqp, configurations,
+                                        &field_distances);
+
+  // Bubble distances relative to the exact ones, of the configurations all
+  // modes made bubbles at
+  double capsule_ratio = 0.0, field_ratio = 0.0, worst_field_ratio = 1.0;
+  int bubbles = 0, violations = 0;
+  for (int i = 0; i < configurations; ++i) {
+    if (field_distances[i] > exact_distances[i] * (1 + 1e-6)) ++violations;
+    if (exact_distances[i] <= 0.0 || capsule_distances[i] <= 0.0 ||
+        field_distances[i] <= 0.0)
+      continue;
+    capsule_ratio += capsule_distances[i] / exact_distances[i];
+    field_ratio += field_distances[i] / exact_distances[i];
+    worst_field_ratio = std::min(worst_field_ratio,
+                                 field_distances[i] / exact_distances[i]);
+    ++bubbles;
+  }
+  std::printf("bubbles: %d configurations, %d made by all modes\n",
+              configurations, bubbles);
+  std::printf("exact:   %8.2f us per bubble\n",
+              1e6 * exact_time / configurations);
+  std::printf("capsule: %8.2f us per bubble, distance %.3f of exact\n",
+              1e6 * capsule_time / configurations,
+              bubbles ? capsule_ratio / bubbles : 0.0);
+  std::printf("field:   %8.2f us per bubble, distance %.3f of exact, "
+              "%.3f at worst, %zu exact fallbacks, %d above exact\n",
+              1e6 * field_time / configurations,
+              bubbles ? field_ratio / bubbles : 0.0, worst_field_ratio,
+              pqp.FieldFallbacks(), violations);
+
+  std::system(("rm -r " + std::string(cache_dir)).c_str());
+  return violations ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE DistanceFieldTest
+
+#include "distance_field.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <boost/test/unit_test.hpp>
+
+typedef DistanceField::EMatrix EMatrix;
+typedef DistanceField::EVector3f EVector3f;
+
+// Tetrahedra scattered in a box of size 100
+std::shared_ptr<PQP_Model> MakeTetrahedra(int num_tetrahedra) {
+  std::shared_ptr<PQP_Model> model (new PQP_Model);
+  model->BeginModel(4 * num_tetrahedra);
+  for (int i = 0; i < num_tetrahedra; ++i) {
+    EVector3f corners[4];
+    corners[0] = (EVector3f::Random() + EVector3f::Ones()) * 50;
+    for (int k = 1; k < 4; ++k)
+      corners[k] = corners[0] + EVector3f::Random() * 10;
+    for (int k = 0; k < 4; ++k)
+      model->AddTri(corners[k].data(), corners[(k + 1) % 4].data(),
+                    corners[(k + 2) % 4].data(), 4 * i + k);
+  }
+  model->EndModel();
+  return model;
+}
+
+std::shared_ptr<const ObstacleSet> MakeObstacles() {
+  std::shared_ptr<const ObstacleSet> set = std::make_shared<ObstacleSet>();
+  std::shared_ptr<PQP_Model> model = MakeTetrahedra(20);
+  int id;
+  set = set->Add(model, EMatrix::Identity(), EVector3f::Zero(), &id);
+  Eigen::Quaternionf rotation (1, 2, 3, 4);
+  rotation.normalize();
+  return set->Add(model, rotation.toRotationMatrix(),
+                  EVector3f(150, 0, 20), &id);
+}
+
+double Distance(const ObstacleSet& set, const EVector3f& point) {
+  return set.CapsuleDistance(point, point, 0.0, INFINITY);
+}
+
+BOOST_AUTO_TEST_CASE(lower_bound) {
+  std::shared_ptr<const ObstacleSet> obstacles = MakeObstacles();
+  const double cell_size = 2.0, band = 10.0;
+  DistanceField field (obstacles, cell_size, band);
+  BOOST_CHECK(!field.cached());
+  BOOST_CHECK_EQUAL(field.obstacles(), obstacles);
+  BOOST_CHECK_GT(field.sampled_blocks(), 0);
+  BOOST_CHECK_LT(field.sampled_blocks(), field.blocks());
+
+  // Bounds never exceed the distances, and are tight near the obstacles,
+  // inside and outside the grid
+  int near = 0;
+  for (int i = 0; i < 2000; ++i) {
+    const EVector3f point ((EVector3f::Random() + EVector3f(1, 0, 0)) * 150);
+    const double distance = Distance(*obstacles, point),
+                 lower_bound = field.DistanceLowerBound(point);
+    BOOST_CHECK_LE(lower_bound, distance);
+    BOOST_CHECK_GE(lower_bound, 0.0);
+    if (distance < band) {
+      BOOST_CHECK_GE(lower_bound, distance - std::sqrt(3.0) * cell_size);
+      ++near;
+    }
+  }
+  BOOST_CHECK_GT(near, 0);
+  const EVector3f far (1000, 1000, 1000);
+  BOOST_CHECK_LE(field.DistanceLowerBound(far), Distance(*obstacles, far));
+  BOOST_CHECK_GT(field.DistanceLowerBound(far),
+                 0.8 * Distance(*obstacles, far));
+
+  BOOST_CHECK_THROW(DistanceField(std::make_shared<ObstacleSet>(), 1.0, 1.0),
+                    const char*);
+  BOOST_CHECK_THROW(DistanceField(obstacles, 0.0, 1.0), const char*);
+}
+
+BOOST_AUTO_TEST_CASE(cache) {
+  char cache_dir[] = "/tmp/distance_field_testXXXXXX";
+  BOOST_REQUIRE(mkdtemp(cache_dir) != nullptr);
+  std::shared_ptr<const ObstacleSet> obstacles = MakeObstacles();
+  DistanceField built (obstacles, 4.0, 8.0, cache_dir);
+  DistanceField mapped (obstacles, 4.0, 8.0, cache_dir);
+  BOOST_CHECK(!built.cached());
+  BOOST_CHECK(mapped.cached());
+  BOOST_CHECK_EQUAL(mapped.size(), built.size());
+  BOOST_CHECK_EQUAL(mapped.sampled_blocks(), built.sampled_blocks());
+  for (int i = 0; i < 200; ++i) {
+    const EVector3f point (EVector3f::Random() * 200);
+    BOOST_CHECK_EQUAL(mapped.DistanceLowerBound(point),
+                      built.DistanceLowerBound(point));
+  }
+
+  // Other parameters and moved obstacles are sampled anew
+  BOOST_CHECK(!DistanceField(obstacles, 4.0, 12.0, cache_dir).cached());
+  BOOST_CHECK(!DistanceField(obstacles->Move(1, EMatrix::Identity(),
+      EVector3f::Zero()), 4.0, 8.0, cache_dir).cached());
+  BOOST_CHECK_EQUAL(std::system(("rm -r " + std::string(cache_dir)).c_str()),
+                    0);
+}
+
+BOOST_AUTO_TEST_CASE(bounding_spheres) {
+  std::shared_ptr<PQP_Model> model = MakeTetrahedra(30);
+  for (size_t max_spheres : {1, 8, 1000}) {
+    std::vector<DistanceField::Sphere> spheres =
+        DistanceField::BoundingSpheres(*model, max_spheres);
+    BOOST_CHECK_EQUAL(spheres.size(), max_spheres);
+    // Every point of the triangles is in a sphere
+    for (int i = 0; i < model->num_tris; ++i) {
+      const Tri& tri = model->tris[i];
+      const Eigen::Vector3d a (tri.p1[0], tri.p1[1], tri.p1[2]),
+                            b (tri.p2[0], tri.p2[1], tri.p2[2]),
+                            c (tri.p3[0], tri.p3[1], tri.p3[2]);
+      for (int k = 0; k < 20; ++k) {
+        Eigen::Vector3d weights (Eigen::Vector3d::Random().cwiseAbs());
+        if (k < 3) weights = Eigen::Vector3d::Unit(k);
+        weights /= weights.sum();
+        const Eigen::Vector3d point = weights(0) * a + weights(1) * b +
+                                      weights(2) * c;
+        double nearest = INFINITY;
+        for (const auto& sphere : spheres)
+          nearest = std::min(nearest, (point - sphere.center.cast<double>())
+                                          .norm() - sphere.radius);
+        BOOST_CHECK_LE(nearest, 1e-4);
+      }
+    }
+  }
+
+  // Spheres are no closer than their vertices
+  std::shared_ptr<const ObstacleSet> obstacles = MakeObstacles();
+  DistanceField field (obstacles, 2.0, 10.0);
+  std::vector<DistanceField::Sphere> spheres =
+      DistanceField::BoundingSpheres(*model, 16);
+  for (int i = 0; i < 50; ++i) {
+    Eigen::Quaternionf rotation (Eigen::Vector4f::Random());
+    rotation.normalize();
+    const EMatrix R = rotation.toRotationMatrix();
+    const EVector3f T (EVector3f::Random() * 200);
+    double distance = INFINITY;
+    for (int k = 0; k < model->num_tris; ++k) {
+      const Tri& tri = model->tris[k];
+      for (const PQP_REAL* p : {tri.p1, tri.p2, tri.p3})
+        distance = std::min(distance, Distance(*obstacles,
+            R * EVector3f(p[0], p[1], p[2]) + T));
+    }
+    BOOST_CHECK_LE(field.DistanceLowerBound(spheres, R, T), distance);
+  }
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include "joint_metric.h"
+
+#include <algorithm>
+
+JointMetric::JointMetric(int dimension)
+    : weights_(std::max(dimension, 0), 1.0),
+      wrapped_(std::max(dimension, 0), false), uniform_(true) {
+  if (dimension <= 0) throw "Joint metric problem!";
+}
+
+JointMetric::JointMetric(const std::vector<double>& weights,
+                         const std::vector<bool>& wrapped)
+    : weights_(weights), wrapped_(wrapped), uniform_(true) {
+  if (wrapped_.empty()) wrapped_.assign(weights_.size(), false);
+  if (weights_.empty() || wrapped_.size() != weights_.size())
+    throw "Joint metric problem!";
+  for (int i = 0; i < dimension(); ++i) {
+    if (!(weights_[i] > 0.0 && std::isfinite(weights_[i])))
+      throw "Joint metric problem!";
+    if (weights_[i] != 1.0 || wrapped_[i]) uniform_ = false;
+  }
+}
+
+double JointMetric::Distance(const double* a, const double* b) const {
+  double distance = 0.0;
+  for (int i = 0; i < dimension(); ++i) {
+    const double difference = weights_[i] * JointDifference(i, a[i], b[i]);
+    distance += difference * difference;
+  }
+  return std::sqrt(distance);
+}
+
+double JointMetric::UnwrappedDistance(const double* a, const double* b) const {
+  double distance = 0.0;
+  for (int i = 0; i < dimension(); ++i) {
+    const double difference = weights_[i] * (b[i] - a[i]);
+    distance += difference * difference;
+  }
+  return std::sqrt(distance);
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef JOINT_METRIC_H_INCLUDED
+#define JOINT_METRIC_H_INCLUDED
+
+#include <cmath>
+#include <vector>
+#include <Eigen/Dense>
+
+// Distance between configurations, the Euclidean norm of joint differences
+// scaled by per-joint weights. Coordinates of wrapped joints are angles of
+// continuous joints, differing by the shorter way around the circle, so
+// paths over them must follow Difference rather than the raw coordinates.
+class JointMetric {
+ public:
+  // Unit weights, no wrapped joints
+  explicit JointMetric(int dimension);
+  // Positive weights, joints with wrapped set are continuous - none if it
+  // is empty
+  explicit JointMetric(const std::vector<double>& weights,
+                       const std::vector<bool>& wrapped = std::vector<bool>());
+
+  int dimension() const { return static_cast<int>(weights_.size()); }
+  double weight(int i) const { return weights_.at(i); }
+  bool wrapped(int i) const { return wrapped_.at(i); }
+  bool uniform() const { return uniform_; }
+
+  // Shorter difference b - a of joint i coordinates, within [-pi, pi] for
+  // wrapped joints
+  double JointDifference(int i, double a, double b) const {
+    return wrapped_[i] ? std::remainder(b - a, 2 * M_PI) : b - a;
+  }
+  double Distance(const double* a, const double* b) const;
+  template <int N>
+  double Distance(const Eigen::Matrix<double, N, 1>& a,
+                  const Eigen::Matrix<double, N, 1>& b) const {
+    return Distance(a.data(), b.data());
+  }
+  // Distance of the raw coordinates, as if no joint were wrapped
+  double UnwrappedDistance(const double* a, const double* b) const;
+  template <int N>
+  double UnwrappedDistance(const Eigen::Matrix<double, N, 1>& a,
+                           const Eigen::Matrix<double, N, 1>& b) const {
+    return UnwrappedDistance(a.data(), b.data());
+  }
+  // Displacement from a to b along the shorter way around wrapped joints,
+  // a + Difference(a, b) equals b modulo 2 pi
+  template <int N>
+  Eigen::Matrix<double, N, 1> Difference(
+      const Eigen::Matrix<double, N, 1>& a,
+      const Eigen::Matrix<double, N, 1>& b) const {
+    Eigen::Matrix<double, N, 1> difference (b - a);
+    if (!uniform_)
+      for (int i = 0; i < dimension(); ++i)
+        if (wrapped_[i]) difference[i] = JointDifference(i, a[i], b[i]);
+    return difference;
+  }
+
+ private:
+  std::vector<double> weights_;
+  std::vector<bool> wrapped_;
+  // Unit weights, no wrapped joints
+  bool uniform_;
+};
+
+#endif  // JOINT_METRIC_H_INCLUDED
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE JointMetricTest
+
+#include "joint_metric.h"
+
+#include <cmath>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <boost/test/unit_test.hpp>
+
+typedef Eigen::Vector3d EVector3d;
+
+BOOST_AUTO_TEST_CASE(uniform) {
+  const JointMetric metric (3);
+  BOOST_CHECK(metric.uniform());
+  const EVector3d a (0.1, -2.0, 3.0), b (-6.0, 1.0, 2.5);
+  BOOST_CHECK_CLOSE(metric.Distance(a, b), (b - a).norm(), 1e-12);
+  BOOST_CHECK(metric.Difference(a, b) == b - a);
+  BOOST_CHECK_THROW(JointMetric(0), const char*);
+}
+
+BOOST_AUTO_TEST_CASE(weights_and_wrapping) {
+  const JointMetric metric ({2.0, 1.0, 0.5}, {false, true, true});
+  BOOST_CHECK(!metric.uniform());
+  BOOST_CHECK_EQUAL(metric.dimension(), 3);
+
+  // Wrapped joints go the shorter way around
+  const EVector3d a (0.0, 3.0, -3.0), b (1.0, -3.0, 3.0);
+  const EVector3d difference = metric.Difference(a, b);
+  BOOST_CHECK_EQUAL(difference[0], 1.0);
+  BOOST_CHECK_CLOSE(difference[1], 2 * M_PI - 6.0, 1e-9);
+  BOOST_CHECK_CLOSE(difference[2], 6.0 - 2 * M_PI, 1e-9);
+  const EVector3d wrapped = a + difference;
+  for (int i = 1; i < 3; ++i)
+    BOOST_CHECK_SMALL(std::remainder(wrapped[i] - b[i], 2 * M_PI), 1e-12);
+  BOOST_CHECK_CLOSE(metric.Distance(a, b), std::sqrt(
+      4.0 + std::pow(2 * M_PI - 6.0, 2) + 0.25 * std::pow(2 * M_PI - 6.0, 2)),
+      1e-9);
+  // Coordinates whole turns apart coincide
+  BOOST_CHECK_SMALL(metric.Distance(EVector3d(1.0, 0.5, 0.5),
+      EVector3d(1.0, 0.5 + 4 * M_PI, 0.5 - 2 * M_PI)), 1e-12);
+  BOOST_CHECK_EQUAL(metric.Distance(b, a), metric.Distance(a, b));
+  BOOST_CHECK_CLOSE(metric.UnwrappedDistance(a, b), std::sqrt(
+      4.0 + 36.0 + 0.25 * 36.0), 1e-9);
+
+  BOOST_CHECK_THROW(JointMetric({1.0, 0.0}), const char*);
+  BOOST_CHECK_THROW(JointMetric({1.0, NAN}), const char*);
+  BOOST_CHECK_THROW(JointMetric({1.0, 1.0}, {true}), const char*);
+  BOOST_CHECK_THROW(JointMetric(std::vector<double>()), const char*);
+  BOOST_CHECK(JointMetric({1.0, 1.0}).uniform());
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include "knn_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+const int KnnIndex::kPending;
+const int KnnIndex::kRemoved;
+const int KnnIndex::kLeafSize;
+
+KnnIndex::KnnIndex(std::unique_ptr<double[]> points, int size, int dimension)
+    : metric_(dimension), live_(size), tree_size_(0) {
+  if (size < 0 || (size > 0 && !points)) throw "Knn index problem!";
+  points_.assign(points.get(), points.get() + static_cast<size_t>(size) *
+                                              dimension);
+  leaves_.assign(size, kPending);
+  set_metric(metric_);
+}
+
+void KnnIndex::set_metric(const JointMetric& metric) {
+  if (metric.dimension() != dimension()) throw "Knn index problem!";
+  metric_ = metric;
+  periods_.assign(dimension(), 0.0);
+  wraps_ = false;
+  for (int i = 0; i < dimension(); ++i) {
+    if (metric_.wrapped(i)) {
+      periods_[i] = 2 * M_PI * metric_.weight(i);
+      wraps_ = true;
+    }
+  }
+  scaled_.resize(points_.size());
+  for (size_t i = 0; i < points_.size(); ++i)
+    scaled_[i] = metric_.weight(i % dimension()) * points_[i];
+  Rebuild();
+}
+
+int KnnIndex::Add(const double* point) {
+  // The point may be one of the index's own
+  const std::vector<double> row (point, point + dimension());
+  points_.insert(points_.end(), row.begin(), row.end());
+  for (int i = 0; i < dimension(); ++i)
+    scaled_.push_back(metric_.weight(i) * row[i]);
+  leaves_.push_back(kPending);
+  pending_.push_back(size() - 1);
+  ++live_;
+  // Every search scans the added points, they are indexed once they are
+  // an eighth of the tree
+  if (static_cast<int>(pending_.size()) > std::max(kLeafSize, tree_size_ / 8))
+    Rebuild();
+  return size() - 1;
+}
+
+void KnnIndex::Remove(int index) {
+  if (index < 0 || index >= size()) throw "Knn index problem!";
+  const int leaf = leaves_[index];
+  if (leaf == kRemoved) return;
+  leaves_[index] = kRemoved;
+  --live_;
+  if (leaf == kPending) {
+    pending_.erase(std::find(pending_.begin(), pending_.end(), index));
+    return;
+  }
+
+  // Swaps the point with the leaf's last live one
+  const size_t dimension = this->dimension();
+  const int slot = slots_[index],
+            last = nodes_[leaf].first + nodes_[leaf].live - 1;
+  std::swap(order_[slot], order_[last]);
+  std::swap_ranges(rows_.begin() + slot * dimension,
+                   rows_.begin() + (slot + 1) * dimension,
+                   rows_.begin() + last * dimension);
+  slots_[order_[slot]] = slot;
+  slots_[index] = last;
+  for (int node = leaf; node >= 0; node = nodes_[node].parent)
+    --nodes_[node].live;
+
+  // Compacts the tree once half of it is removed
+  if (tree_size_ > kLeafSize && 2 * nodes_[0].live < tree_size_)
+    Rebuild();
+}
+
+std::vector<int> KnnIndex::KnnSearch(const double* q, int k) const {
+  if (k <= 0) return std::vector<int>();
+  Heap heap (Search(q, k, INFINITY));
+  return Sorted(&heap);
+}
+
+std::vector<int> KnnIndex::RadiusSearch(const double* q,
+                                        double radius) const {
+  if (radius < 0) return std::vector<int>();
+  Heap heap (Search(q, std::numeric_limits<size_t>::max(), radius * radius));
+  return Sorted(&heap);
+}
+
+double KnnIndex::AxisDistance(int axis, double x, double low,
+                              double high) const {
+  const double period = periods_[axis];
+  if (period == 0.0)
+    return x < low ? low - x : x > high ? x - high : 0.0;
+  // Along the circle, from x on to low or from high on to x
+  if (high - low >= period) return 0.0;
+  double to_low = std::fmod(low - x, period);
+  if (to_low < 0.0) to_low += period;
+  const double to_high = period - to_low - (high - low);
+  return to_high <= 0.0 ? 0.0 : std::min(to_low, to_high);
+}
+
+double KnnIndex::SquaredDistance(const double* q, const double* row) const {
+  double distance = 0.0;
+  if (!wraps_) {
+    for (int i = 0; i < dimension(); ++i)
+      distance += (q[i] - row[i]) * (q[i] - row[i]);
+    return distance;
+  }
+  for (int i = 0; i < dimension(); ++i) {
+    const double axis_distance = AxisDistance(i, q[i], row[i], row[i]);
+    distance += axis_distance * axis_distance;
+  }
+  return distance;
+}
+
+KnnIndex::Heap KnnIndex::Search(const double* q, size_t k,
+                                double max_distance) const {
+  std::vector<double> scaled_q (dimension());
+  for (int i = 0; i < dimension(); ++i)
+    scaled_q[i] = metric_.weight(i) * q[i];
+  Heap heap;
+  if (!nodes_.empty()) {
+    Cell cell;
+    cell.lows = lows_;
+    cell.highs = highs_;
+    cell.offsets.resize(dimension());
+    for (int i = 0; i < dimension(); ++i) {
+      const double offset = AxisDistance(i, scaled_q[i], lows_[i],
+                                         highs_[i]);
+      cell.offsets[i] = offset * offset;
+    }
+    double distance = 0.0;
+    for (double offset : cell.offsets) distance += offset;
+    Search(0, scaled_q.data(), k, max_distance, distance, &cell, &heap);
+  }
+  for (int index : pending_) {
+    const double distance = SquaredDistance(scaled_q.data(), scaled(index));
+    if (distance <= max_distance) Push(distance, index, k, &heap);
+  }
+  return heap;
+}
+
+void KnnIndex::Rebuild() {
+  order_.clear();
+  for (int i = 0; i < size(); ++i)
+    if (leaves_[i] != kRemoved) order_.push_back(i);
+  pending_.clear();
+  tree_size_ = static_cast<int>(order_.size());
+  nodes_.clear();
+  rows_.clear();
+  if (order_.empty()) return;
+  nodes_.emplace_back();
+  nodes_[0].parent = -1;
+  Build(0, 0, tree_size_);
+
+  const size_t dimension = this->dimension();
+  slots_.resize(size());
+  rows_.resize(tree_size_ * dimension);
+  lows_.assign(dimension, INFINITY);
+  highs_.assign(dimension, -INFINITY);
+  for (int slot = 0; slot < tree_size_; ++slot) {
+    slots_[order_[slot]] = slot;
+    const double* row = scaled(order_[slot]);
+    std::copy(row, row + dimension, rows_.begin() + slot * dimension);
+    for (size_t i = 0; i < dimension; ++i) {
+      lows_[i] = std::min(lows_[i], row[i]);
+      highs_[i] = std::max(highs_[i], row[i]);
+    }
+  }
+}
+
+void KnnIndex::Build(int node, int first, int last) {
+  nodes_[node].first = first;
+  nodes_[node].live = last - first;
+  if (last - first <= kLeafSize) {
+    nodes_[node].first_child = -1;
+    for (int slot = first; slot < last; ++slot)
+      leaves_[order_[slot]] = node;
+    return;
+  }
+
+  // Median split along the axis of the largest spread
+  int dimension = 0;
+  double spread = -1.0;
+  for (int i = 0; i < this->dimension(); ++i) {
+    double low = INFINITY, high = -INFINITY;
+    for (int slot = first; slot < last; ++slot) {
+      low = std::min(low, scaled(order_[slot])[i]);
+      high = std::max(high, scaled(order_[slot])[i]);
+    }
+    if (high - low > spread) {
+      spread = high - low;
+      dimension = i;
+    }
+  }
+  const int middle = first + (last - first) / 2;
+  std::nth_element(order_.begin() + first, order_.begin() + middle,
+                   order_.begin() + last, [this, dimension](int a, int b) {
+    return scaled(a)[dimension] < scaled(b)[dimension];
+  });
+  double low = -INFINITY;
+  for (int slot = first; slot < middle; ++slot)
+    low = std::max(low, scaled(order_[slot])[dimension]);
+
+  const int children = static_cast<int>(nodes_.size());
+  nodes_.resize(children + 2);
+  nodes_[node].first_child = children;
+  nodes_[node].dimension = dimension;
+  nodes_[node].low = low;
+  nodes_[node].high = scaled(order_[middle])[dimension];
+  nodes_[children].parent = nodes_[children + 1].parent = node;
+  Build(children, first, middle);
+  Build(children + 1, middle, last);
+}
+
+void KnnIndex::Search(int node, const double* q, size_t k,
+                      double max_distance, double distance, Cell* cell,
+                      Heap* heap) const {
+  const Node& current = nodes_[node];
+  if (current.live == 0) return;
+  if (current.first_child < 0) {
+    for (int slot = current.first; slot < current.first + current.live;
+         ++slot) {
+      const double distance = SquaredDistance(
+          q, rows_.data() + static_cast<size_t>(slot) * dimension());
+      if (distance <= max_distance)
+        Push(distance, order_[slot], k, heap);
+    }
+    return;
+  }
+
+  // Children boxes along the split axis, the nearer one searched first.
+  // Summing the offsets in the axis order keeps the bound of a box below
+  // the distances of its points despite the rounding, so it is summed anew
+  // rather than updated.
+  const int axis = current.dimension;
+  const double low = cell->lows[axis], high = cell->highs[axis],
+               offset = cell->offsets[axis];
+  const double child_lows[2] = {low, current.high},
+               child_highs[2] = {current.low, high};
+  double child_offsets[2], child_distances[2];
+  for (int child = 0; child < 2; ++child) {
+    const double axis_distance = AxisDistance(axis, q[axis],
+                                              child_lows[child],
+                                              child_highs[child]);
+    child_offsets[child] = axis_distance * axis_distance;
+    child_distances[child] = distance;
+    if (child_offsets[child] == offset) continue;
+    cell->offsets[axis] = child_offsets[child];
+    child_distances[child] = 0.0;
+    for (double child_offset : cell->offsets)
+      child_distances[child] += child_offset;
+  }
+  const int nearer = child_distances[1] < child_distances[0] ? 1 : 0;
+  for (int child : {nearer, 1 - nearer}) {
+    if (child_distances[child] > max_distance ||
+        (heap->size() >= k && child_distances[child] > heap->front().first))
+      continue;
+    cell->lows[axis] = child_lows[child];
+    cell->highs[axis] = child_highs[child];
+    cell->offsets[axis] = child_offsets[child];
+    Search(current.first_child + child, q, k, max_distance,
+           child_distances[child], cell, heap);
+  }
+  cell->lows[axis] = low;
+  cell->highs[axis] = high;
+  cell->offsets[axis] = offset;
+}
+
+void KnnIndex::Push(double distance, int index, size_t k, Heap* heap) {
+  const std::pair<double, int> candidate (distance, index);
+  if (heap->size() < k) {
+    heap->push_back(candidate);
+    std::push_heap(heap->begin(), heap->end());
+  } else if (candidate < heap->front()) {
+    std::pop_heap(heap->begin(), heap->end());
+    heap->back() = candidate;
+    std::push_heap(heap->begin(), heap->end());
+  }
+}
+
+std::vector<int> KnnIndex::Sorted(Heap* heap) {
+  std::sort_heap(heap->begin(), heap->end());
+  std::vector<int> indices;
+  indices.reserve(heap->size());
+  for (const auto& candidate : *heap)
+    indices.push_back(candidate.second);
+  return indices;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef KNN_INDEX_H_INCLUDED
+#define KNN_INDEX_H_INCLUDED
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "joint_metric.h"
+
+// Exact nearest neighbour index of configurations under a joint metric, a
+// flat kd-tree over a packed copy of the rows, scaled by the joint weights.
+// Boxes of the tree wrap around the circle along wrapped joints. Removed
+// points leave the tree's leaves at once, so searches never visit them, and
+// the tree is rebuilt from the remaining points once most of it is removed.
+// Added points are scanned linearly until there are enough of them for a
+// rebuild.
+class KnnIndex {
+ public:
+  // Index of size points, rows of the dimension coordinates each, under
+  // the uniform metric
+  KnnIndex(std::unique_ptr<double[]> points, int size, int dimension);
+  KnnIndex(const KnnIndex&) = delete;
+  KnnIndex& operator=(const KnnIndex&) = delete;
+
+  // Points ever added, removed ones keep their indices
+  int size() const { return static_cast<int>(leaves_.size()); }
+  int dimension() const { return metric_.dimension(); }
+  // Points not removed
+  int live() const { return live_; }
+  bool removed(int index) const { return leaves_.at(index) == kRemoved; }
+  // Coordinates of the point, valid until the next point is added
+  const double* point(int index) const {
+    return points_.data() + static_cast<size_t>(index) * dimension();
+  }
+  const JointMetric& metric() const { return metric_; }
+  // Rebuilds the index under the metric of the same dimension
+  void set_metric(const JointMetric& metric);
+
+  // Adds a copy of the point, returns its index
+  int Add(const double* point);
+  // Removes the point from searches, removing it again does nothing
+  void Remove(int index);
+
+  // Indices of the k points nearest to q in the metric, nearest first, or
+  // of all the points when fewer remain. Equally distant points are ordered
+  // by index.
+  std::vector<int> KnnSearch(const double* q, int k) const;
+  // Indices of the points within radius of q, nearest first
+  std::vector<int> RadiusSearch(const double* q, double radius) const;
+
+ private:
+  // Leaf of the points that are not in the tree
+  static const int kPending = -1;
+  static const int kRemoved = -2;
+  // Most points of a leaf
+  static const int kLeafSize = 16;
+
+  // Root first, children next to each other. Points of the subtree are
+  // first to first + live in the leaf order, the rest of its range holds
+  // removed ones.
+  struct Node {
+    int first_child;  // Negative in leaves
+    int parent;
+    int first, live;
+    int dimension;  // Splits left points, at most low, from right points,
+    double low, high;  // at least high
+  };
+
+  // Candidate neighbours, a max-heap on distance and index
+  typedef std::vector<std::pair<double, int>> Heap;
+  // Box of the searched subtree, bounds and squared distances from the
+  // query along each axis
+  struct Cell {
+    std::vector<double> lows, highs, offsets;
+  };
+
+  // Scaled coordinates of the point
+  const double* scaled(int index) const {
+    return scaled_.data() + static_cast<size_t>(index) * dimension();
+  }
+  // Distance from scaled coordinate x to the range low to high along the
+  // axis
+  double AxisDistance(int axis, double x, double low, double high) const;
+  // Squared distance between scaled q and the row, the sum of the squared
+  // axis distances in the order of Cell offsets
+  double SquaredDistance(const double* q, const double* row) const;
+  // Heap of the k points nearest to q within max distance, squared
+  Heap Search(const double* q, size_t k, double max_distance) const;
+  // Rebuilds the tree of all points not removed
+  void Rebuild();
+  // Fills the node with the leaf order points first to last
+  void Build(int node, int first, int last);
+  // Adds the subtree points within max distance of q and nearer than the
+  // heap's farthest to the heap of k points at most, the subtree in the
+  // cell at distance from q
+  void Search(int node, const double* q, size_t k, double max_distance,
+              double distance, Cell* cell, Heap* heap) const;
+  // Adds the point if nearer than the heap's farthest
+  static void Push(double distance, int index, size_t k, Heap* heap);
+  // Indices of the heap points, nearest first
+  static std::vector<int> Sorted(Heap* heap);
+
+  JointMetric metric_;
+  // Scaled wrapped joint periods, zero for the others
+  std::vector<double> periods_;
+  bool wraps_;  // Some joint is wrapped
+  int live_;
+  std::vector<double> points_;  // By index
+  std::vector<double> scaled_;  // Scaled by the weights, by index
+  std::vector<int> leaves_;  // Leaf of each point, or pending or removed
+  std::vector<int> slots_;  // Position of each tree point in the leaf order
+  std::vector<int> order_;  // Tree points, leaf after leaf
+  std::vector<double> rows_;  // Their scaled coordinates, in the same order
+  std::vector<int> pending_;  // Points added since the last rebuild
+  int tree_size_;  // Points of the leaf order when the tree was built
+  std::vector<Node> nodes_;
+  std::vector<double> lows_, highs_;  // Box of the tree
+};
+
+#endif  // KNN_INDEX_H_INCLUDED
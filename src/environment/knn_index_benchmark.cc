@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+// Knn index against the FLANN kd-trees it replaces, on the planners'
+// pattern of removing the visited points and querying their neighbours.
+// Reports the build time, the query times over the whole run and its last
+// quarter, when most points are removed, and FLANN's recall of the exact
+// neighbours.
+//
+// Usage: knn_index_benchmark [neighbours [dimension]]
+
+#include "knn_index.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <flann/flann.hpp>
+
+namespace {
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+// Visits of a run, the same for both indices: points removed before each
+// query at the first of them
+struct Visit {
+  std::vector<int> removed;
+};
+
+// Visits 90% of the points in random order, every other visit also removes
+// a random point as colliding
+std::vector<Visit> MakeVisits(int size, std::mt19937* random_engine) {
+  std::vector<int> order (size);
+  for (int i = 0; i < size; ++i) order[i] = i;
+  std::shuffle(order.begin(), order.end(), *random_engine);
+  std::uniform_int_distribution<int> point (0, size - 1);
+  std::vector<Visit> visits (size * 9 / 10);
+  for (size_t i = 0; i < visits.size(); ++i) {
+    visits[i].removed.push_back(order[i]);
+    if (i % 2) visits[i].removed.push_back(point(*random_engine));
+  }
+  return visits;
+}
+
+// Query times of the whole run and of its last quarter, per query
+struct Times {
+  double build, query, last_query;
+};
+
+Times RunKnnIndex(const std::vector<double>& points, int size, int dimension,
+                  const std::vector<Visit>& visits, int neighbours,
+                  std::vector<std::vector<int>>* results) {
+  Times times;
+  auto start = std::chrono::steady_clock::now();
+  std::unique_ptr<double[]> rows (new double[points.size()]);
+  std::copy(points.begin(), points.end(), rows.get());
+  KnnIndex index (std::move(rows), size, dimension);
+  times.build = Seconds(start);
+
+  const size_t last_quarter = visits.size() * 3 / 4;
+  double time = 0.0, last_time = 0.0;
+  for (size_t i = 0; i < visits.size(); ++i) {
+    start = std::chrono::steady_clock::now();
+    for (int removed : visits[i].removed) index.Remove(removed);
+    (*results)[i] = index.KnnSearch(&points[visits[i].removed[0] * dimension],
+                                    neighbours);
+    const double seconds = Seconds(start);
+    time += seconds;
+    if (i >= last_quarter) last_time += seconds;
+  }
+  times.query = time / visits.size();
+  times.last_query = last_time / (visits.size() - last_quarter);
+  return times;
+}
+
+Times RunFlann(std::vector<double> points, int size, int dimension,
+               const std::vector<Visit>& visits, int neighbours,
+               std::vector<std::vector<int>>* results) {
+  Times times;
+  auto start = std::chrono::steady_clock::now();
+  flann::Index<flann::L2<double>> index (
+      flann::Matrix<double> (points.data(), size, dimension),
+      flann::KDTreeIndexParams(4));
+  index.buildIndex();
+  times.build = Seconds(start);
+
+  std::vector<int> indices (neighbours);
+  std::vector<double> distances (neighbours);
+  flann::Matrix<int> indices_matrix (indices.data(), 1, neighbours);
+  flann::Matrix<double> distances_matrix (distances.data(), 1, neighbours);
+  const size_t last_quarter = visits.size() * 3 / 4;
+  double time = 0.0, last_time = 0.0;
+  for (size_t i = 0; i < visits.size(); ++i) {
+    start = std::chrono::steady_clock::now();
+    for (int removed : visits[i].removed) index.removePoint(removed);
+    flann::Matrix<double> query (&points[visits[i].removed[0] * dimension], 1,
+                                 dimension);
+    index.knnSearch(query, indices_matrix, distances_matrix, neighbours,
+                    flann::SearchParams(128));
+    const double seconds = Seconds(start);
+    time += seconds;
+    if (i >= last_quarter) last_time += seconds;
+    (*results)[i] = indices;
+  }
+  times.query = time / visits.size();
+  times.last_query = last_time / (visits.size() - last_quarter);
+  return times;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const int neighbours = argc > 1 ? std::atoi(argv[1]) : 20;
+  const int dimension = argc > 2 ? std::atoi(argv[2]) : 6;
+  if (neighbours <= 0 || dimension <= 0) return 1;
+
+  std::mt19937 random_engine (1);
+  std::uniform_real_distribution<double> coordinate (-M_PI, M_PI);
+  std::printf("%d neighbours, dimension %d, times in us\n", neighbours,
+              dimension);
+  for (int size : {1000, 10000, 100000}) {
+    std::vector<double> points (static_cast<size_t>(size) * dimension);
+    for (auto& x : points) x = coordinate(random_engine);
+    const std::vector<Visit> visits = MakeVisits(size, &random_engine);
+
+    std::vector<std::vector<int>> exact (visits.size()),
+                                  approximate (visits.size());
+    const Times index = RunKnnIndex(points, size, dimension, visits,
+                                    neighbours, &exact);
+    const Times flann = RunFlann(points, size, dimension, visits, neighbours,
+                                 &approximate);
+
+    // Neighbours FLANN found of the exact ones
+    size_t found = 0, total = 0;
+    for (size_t i = 0; i < visits.size(); ++i) {
+      std::vector<int> expected = exact[i], result = approximate[i];
+      std::sort(expected.begin(), expected.end());
+      std::sort(result.begin(), result.end());
+      std::vector<int> common;
+      std::set_intersection(expected.begin(), expected.end(), result.begin(),
+                            result.end(), std::back_inserter(common));
+      found += common.size();
+      total += expected.size();
+    }
+
+    std::printf("%6d points: knn index build %9.1f, query %7.2f, last "
+                "quarter %7.2f\n", size, index.build * 1e6, index.query * 1e6,
+                index.last_query * 1e6);
+    std::printf("%6d points: flann     build %9.1f, query %7.2f, last "
+                "quarter %7.2f, recall %.4f\n", size, flann.build * 1e6,
+                flann.query * 1e6, flann.last_query * 1e6,
+                total ? static_cast<double>(found) / total : 1.0);
+  }
+  return 0;
+}
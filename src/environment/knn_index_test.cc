@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE KnnIndexTest
+
+#include "knn_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+// Index of size random points in the unit cube, rounded to a coarse grid
+// for equally distant points
+std::unique_ptr<KnnIndex> MakeIndex(int size, int dimension,
+                                    std::mt19937* random_engine) {
+  std::uniform_int_distribution<int> coordinate (0, 20);
+  std::unique_ptr<double[]> points (new double[size * dimension]);
+  for (int i = 0; i < size * dimension; ++i)
+    points[i] = coordinate(*random_engine) / 20.0;
+  return std::unique_ptr<KnnIndex> (
+      new KnnIndex(std::move(points), size, dimension));
+}
+
+// Points not removed, nearest to q first, then by index
+std::vector<std::pair<double, int>> BruteForce(const KnnIndex& index,
+                                               const double* q) {
+  std::vector<std::pair<double, int>> points;
+  for (int i = 0; i < index.size(); ++i) {
+    if (index.removed(i)) continue;
+    double distance = 0.0;
+    for (int k = 0; k < index.dimension(); ++k)
+      distance += (q[k] - index.point(i)[k]) * (q[k] - index.point(i)[k]);
+    points.emplace_back(distance, i);
+  }
+  std::sort(points.begin(), points.end());
+  return points;
+}
+
+// Knn and radius searches against brute force
+void CheckSearches(const KnnIndex& index, std::mt19937* random_engine) {
+  std::uniform_real_distribution<double> coordinate (-0.2, 1.2);
+  std::vector<double> q (index.dimension());
+  for (int query = 0; query < 20; ++query) {
+    for (auto& x : q) x = coordinate(*random_engine);
+    const auto expected = BruteForce(index, q.data());
+    for (int k : {1, 5, 30}) {
+      const std::vector<int> found = index.KnnSearch(q.data(), k);
+      BOOST_REQUIRE_EQUAL(found.size(),
+                          std::min<size_t>(k, expected.size()));
+      for (size_t i = 0; i < found.size(); ++i)
+        BOOST_CHECK_EQUAL(found[i], expected[i].second);
+    }
+    const double radius = 0.3;
+    const std::vector<int> found = index.RadiusSearch(q.data(), radius);
+    size_t within = 0;
+    while (within < expected.size() &&
+           expected[within].first <= radius * radius)
+      ++within;
+    BOOST_REQUIRE_EQUAL(found.size(), within);
+    for (size_t i = 0; i < found.size(); ++i)
+      BOOST_CHECK_EQUAL(found[i], expected[i].second);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(searches) {
+  std::mt19937 random_engine (1);
+  for (int dimension : {1, 2, 6}) {
+    for (int size : {0, 1, 10, 1000}) {
+      std::unique_ptr<KnnIndex> index (
+          MakeIndex(size, dimension, &random_engine));
+      BOOST_CHECK_EQUAL(index->size(), size);
+      BOOST_CHECK_EQUAL(index->live(), size);
+      CheckSearches(*index, &random_engine);
+    }
+  }
+  BOOST_CHECK(KnnIndex(nullptr, 0, 3).KnnSearch(nullptr, 0).empty());
+  BOOST_CHECK_THROW(KnnIndex(nullptr, 10, 3), const char*);
+  BOOST_CHECK_THROW(KnnIndex(nullptr, 0, 0), const char*);
+}
+
+BOOST_AUTO_TEST_CASE(updates) {
+  std::mt19937 random_engine (2);
+  const int kDimension = 6;
+  std::unique_ptr<KnnIndex> index (MakeIndex(2000, kDimension,
+                                             &random_engine));
+  std::uniform_real_distribution<double> coordinate (0.0, 1.0);
+
+  // Removals through several compactions, with points added meanwhile
+  int live = index->size();
+  for (int round = 0; round < 12; ++round) {
+    for (int i = 0; i < 150; ++i) {
+      const int removed = std::uniform_int_distribution<int> (
+          0, index->size() - 1)(random_engine);
+      if (!index->removed(removed)) --live;
+      index->Remove(removed);
+      BOOST_CHECK(index->removed(removed));
+    }
+    std::vector<double> point (kDimension);
+    for (int i = 0; i < 25; ++i) {
+      for (auto& x : point) x = coordinate(random_engine);
+      const int added = index->Add(point.data());
+      BOOST_CHECK_EQUAL(added, index->size() - 1);
+      BOOST_CHECK(std::equal(point.begin(), point.end(),
+                             index->point(added)));
+      ++live;
+    }
+    // Adding a point of the index copies it
+    index->Add(index->point(index->size() - 1));
+    ++live;
+    BOOST_CHECK_EQUAL(index->live(), live);
+    CheckSearches(*index, &random_engine);
+  }
+
+  // Everything removed
+  for (int i = 0; i < index->size(); ++i) index->Remove(i);
+  BOOST_CHECK_EQUAL(index->live(), 0);
+  CheckSearches(*index, &random_engine);
+  BOOST_CHECK_THROW(index->Remove(index->size()), const char*);
+}
+
+BOOST_AUTO_TEST_CASE(metric) {
+  std::mt19937 random_engine (3);
+  const int kSize = 3000, kDimension = 4;
+  // Beyond a turn along the wrapped joints
+  std::uniform_real_distribution<double> coordinate (-2 * M_PI, 2 * M_PI);
+  std::unique_ptr<double[]> points (new double[kSize * kDimension]);
+  for (int i = 0; i < kSize * kDimension; ++i)
+    points[i] = coordinate(random_engine);
+  KnnIndex index (std::move(points), kSize, kDimension);
+  const JointMetric metric ({2.0, 0.5, 1.0, 3.0}, {false, true, false, true});
+  index.set_metric(metric);
+  BOOST_CHECK_THROW(index.set_metric(JointMetric(3)), const char*);
+  for (int i = 0; i < kSize; i += 3) index.Remove(i);
+  std::vector<double> q (kDimension);
+  for (int i = 0; i < 50; ++i) {
+    for (auto& x : q) x = coordinate(random_engine);
+    index.Add(q.data());
+  }
+
+  // Distances rounded apart from the index's, compared rather than indices
+  for (int query = 0; query < 20; ++query) {
+    for (auto& x : q) x = coordinate(random_engine);
+    std::vector<double> expected;
+    for (int i = 0; i < index.size(); ++i)
+      if (!index.removed(i))
+        expected.push_back(metric.Distance(q.data(), index.point(i)));
+    std::sort(expected.begin(), expected.end());
+
+    const std::vector<int> found = index.KnnSearch(q.data(), 10);
+    BOOST_REQUIRE_EQUAL(found.size(), 10u);
+    for (size_t i = 0; i < found.size(); ++i)
+      BOOST_CHECK_SMALL(metric.Distance(q.data(), index.point(found[i])) -
+                        expected[i], 1e-9);
+
+    const double radius = 2.0;
+    const std::vector<int> within = index.RadiusSearch(q.data(), radius);
+    BOOST_CHECK_EQUAL(within.size(), static_cast<size_t>(
+        std::upper_bound(expected.begin(), expected.end(), radius) -
+        expected.begin()));
+    for (size_t i = 0; i < within.size(); ++i)
+      BOOST_CHECK_SMALL(metric.Distance(q.data(), index.point(within[i])) -
+                        expected[i], 1e-9);
+  }
+}
@@ -19,13 +19,173 @@
 #include <cmath>
 #include <PQP/PQP.h>
 #include <Eigen/Dense>
-#include <fstream>
 #include <memory>
 #include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "mapped_file.h"
 
 typedef Eigen::Vector3f EVector3f;
 
+namespace {
+
+// Triangles of a binary or ASCII STL file. The file is mapped read-only and
+// binary triangle records are read in place.
+class StlReader {
+ public:
+  explicit StlReader(const std::string& model_file)
+      : file_(model_file), num_tris_(0) {
+    if (!file_.mapped()) throw "File " + model_file + " error!";
+
+    const char* data = file_.data();
+    const size_t size = file_.size();
+    if (size >= kHeaderSize + sizeof(uint32_t)) {
+      uint32_t num_tris;
+      std::memcpy(&num_tris, data + kHeaderSize, sizeof(num_tris));
+      if (size == kHeaderSize + sizeof(num_tris) +
+                  static_cast<uint64_t>(num_tris) * kRecordSize) {
+        num_tris_ = num_tris;
+        return;
+      }
+    }
+    // Binary files have to match the size given by their header
+    if (size < 5 || std::strncmp(data, "solid", 5) != 0)
+      throw "File " + model_file + " size doesn't match its header!";
+    if (!ParseAscii()) throw "File " + model_file + " vertex error!";
+  }
+
+  size_t size() const { return num_tris_; }
+  // Hash of the file content, continuing from hash
+  uint64_t Hash(uint64_t hash) const {
+    return HashBytes(file_.data(), file_.size(), hash);
+  }
+  // Vertices of triangle i, in the model frame
+  void Triangle(size_t i, EVector3f vertices[3]) const {
+    if (!ascii_vertices_.empty()) {
+      for (int k = 0; k < 3; ++k)
+        vertices[k] = ascii_vertices_[3 * i + k];
+      return;
+    }
+    // Record is normal, three vertices and a two byte attribute
+    const char* record = file_.data() + kHeaderSize + sizeof(uint32_t) +
+                         i * kRecordSize + sizeof(float[3]);
+    for (int k = 0; k < 3; ++k)
+      std::memcpy(vertices[k].data(), record + k * sizeof(float[3]),
+                  sizeof(float[3]));
+  }
+
+ private:
+  static const size_t kHeaderSize = 80, kRecordSize = 50;
+
+  // Reads "vertex x y z" lines, everything else is skipped - returns false
+  // upon malformed or missing vertices. Binary files whose header starts with
+  // "solid" but whose size is wrong end up here and fail.
+  bool ParseAscii() {
+    const std::string text (file_.data(), file_.size());
+    const char* const keyword = "vertex";
+    for (size_t position = text.find(keyword); position != std::string::npos;
+         position = text.find(keyword, position)) {
+      const char* number = text.c_str() + position + std::strlen(keyword);
+      char* number_end;
+      EVector3f vertex;
+      for (int k = 0; k < 3; ++k) {
+        vertex[k] = std::strtof(number, &number_end);
+        if (number_end == number) return false;
+        number = number_end;
+      }
+      ascii_vertices_.push_back(vertex);
+      position = number - text.c_str();
+    }
+    num_tris_ = ascii_vertices_.size() / 3;
+    return num_tris_ > 0 && ascii_vertices_.size() % 3 == 0;
+  }
+
+  MappedFile file_;
+  size_t num_tris_;
+  std::vector<EVector3f> ascii_vertices_;
+};
+
+// Cache file is the header followed by the tris, the BV and, when the model
+// keeps one, the OBB arrays of the built model, as laid out in memory
+struct BvhCacheHeader {
+  char magic[8];
+  uint32_t version, real_size, tri_size, bv_size, obb_size;
+  uint64_t key;
+  int32_t bv_type, num_tris, num_bvs;
+  double axis_length, radius;
+};
+static_assert(sizeof(BvhCacheHeader) % alignof(Tri) == 0 &&
+              sizeof(BvhCacheHeader) % alignof(BV) == 0 &&
+              sizeof(Tri) % alignof(BV) == 0 &&
+              sizeof(BV) % alignof(OBB) == 0, "Cache arrays misaligned");
+
+const char kBvhCacheMagic[8] = "PQPBVH";
+// Bump when the layout or the way models are built changes
+const uint32_t kBvhCacheVersion = 4;
+// Seeds of the keys, so that plain and transformed models never share them
+const uint64_t kModelSeed = 1, kTransformModelSeed = 2;
+
+// Bytes per BV of the OBB array of models with the BV types, none when the
+// boxes are kept in the BVs or absent, see PQP_Model::EndModel()
+size_t ObbArraySize(int bv_type) {
+  return (bv_type & RSS_TYPE) && (bv_type & OBB_TYPE) ? sizeof(OBB) : 0;
+}
+
+// Model with the BV types in the cache file at path, nullptr unless the file
+// is complete and was written for the key by this build
+PQP_Model* ReadBvhCache(const std::string& path, uint64_t key, int bv_type,
+                        double* axis_length, double* radius) {
+  MappedFile file (path);
+  if (!file.mapped() || file.size() < sizeof(BvhCacheHeader)) return nullptr;
+
+  BvhCacheHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, kBvhCacheMagic, sizeof(kBvhCacheMagic)) ||
+      header.version != kBvhCacheVersion ||
+      header.real_size != sizeof(PQP_REAL) ||
+      header.tri_size != sizeof(Tri) || header.bv_size != sizeof(BV) ||
+      header.obb_size != ObbArraySize(bv_type) ||
+      header.bv_type != bv_type || header.key != key ||
+      header.num_tris <= 0 || header.num_bvs <= 0 ||
+      file.size() != sizeof(header) + sizeof(Tri) * header.num_tris +
+                     (sizeof(BV) + header.obb_size) * header.num_bvs)
+    return nullptr;
+
+  // Header keeps the arrays aligned within the page aligned mapping
+  const Tri* tris = reinterpret_cast<const Tri*>(file.data() + sizeof(header));
+  const BV* bvs = reinterpret_cast<const BV*>(tris + header.num_tris);
+  const OBB* obbs = reinterpret_cast<const OBB*>(bvs + header.num_bvs);
+  // Guards the traversals against a corrupt hierarchy
+  for (int i = 0; i < header.num_bvs; ++i) {
+    const int first_child = bvs[i].first_child;
+    if (first_child < 0 ? -first_child - 1 >= header.num_tris
+                        : first_child <= i || first_child + 1 >= header.num_bvs)
+      return nullptr;
+  }
+
+  // PQP_Model owns its arrays, so they are copied out of the mapping
+  std::unique_ptr<PQP_Model> model (new PQP_Model);
+  if (model->LoadBuiltModel(tris, header.num_tris, bvs, obbs,
+                            header.num_bvs, bv_type) != PQP_OK)
+    return nullptr;
+  *axis_length = header.axis_length;
+  *radius = header.radius;
+  return model.release();
+}
+
+}  // namespace
+
 double PointDistanceToAxis(const EVector3f& point, const EVector3f& axis) {
   double l = point.dot(axis);
   return (point - axis * l).norm();
@@ -59,86 +219,124 @@ PQP_Model* ModelParser::GetTransformModel(const std::string& model_file,
                                           const EVector3f& axis,
                                           double* axis_length,
                                           double* radius) {
-  std::ifstream input_file (model_file.c_str(), std::ios::binary);
-  try {
-    std::unique_ptr<PQP_Model> model (new PQP_Model);
+  StlReader reader (model_file);
+  uint64_t key = reader.Hash(HashBytes(&kTransformModelSeed,
+                                       sizeof(kTransformModelSeed)));
+  key = HashBytes(R.data(), sizeof(float) * R.size(), key);
+  key = HashBytes(T.data(), sizeof(float) * T.size(), key);
+  key = HashBytes(axis.data(), sizeof(float) * axis.size(), key);
+  key = HashBytes(&split_rule_, sizeof(split_rule_), key);
+  key = HashBytes(&bv_type_, sizeof(bv_type_), key);
+  std::unique_ptr<PQP_Model> model (LoadCached(key, axis_length, radius));
+  if (model) return model.release();
 
-    char header[80] = "";         // Reads STL binary header
-    input_file.read(header, 80);
+  model.reset(new PQP_Model);
+  model->BeginModel(std::max<size_t>(reader.size(), 1));
 
-    unsigned num_tris = 0;  // Reads number of triangles
-    input_file.read(reinterpret_cast<char*>(&num_tris), sizeof(num_tris));
-
-    EVector3f vertex[3];  // Triangle represented as three vertices
-    float surf_vec[3];
-
-    model->BeginModel();
-
-    int16_t temp = 0;  // Used for taking two bits of data after a triangle
-    uint64_t counter = 0;
-
-    *axis_length = 0.0;
-    *radius = 0.0;
-    while (counter < num_tris) {
-      input_file.read(reinterpret_cast<char*>(surf_vec), sizeof(surf_vec));
-
-      for (unsigned i = 0; i < 3; ++i) {
-        input_file.read(reinterpret_cast<char*>(&vertex[i]), sizeof(vertex[i]));
-        vertex[i] = R * vertex[i] + T;
-        *axis_length = std::max(*axis_length, double(vertex[i].dot(axis)));
-        *radius = std::max(*radius,
-            PointDistanceToVector(vertex[i], axis * *axis_length));
-      }
-      model->AddTri(vertex[0].data(), vertex[1].data(), vertex[2].data(),
-        counter);
-
-      input_file.read(reinterpret_cast<char*>(&temp), sizeof(temp));
-      ++counter;
+  EVector3f vertex[3];  // Triangle represented as three vertices
+  *axis_length = 0.0;
+  *radius = 0.0;
+  for (size_t counter = 0; counter < reader.size(); ++counter) {
+    reader.Triangle(counter, vertex);
+    for (unsigned i = 0; i < 3; ++i) {
+      vertex[i] = R * vertex[i] + T;
+      *axis_length = std::max(*axis_length, double(vertex[i].dot(axis)));
+      *radius = std::max(*radius,
+          PointDistanceToVector(vertex[i], axis * *axis_length));
     }
-
-    model->EndModel();
-    return model.release();
-  }
-  catch(...) {
-    throw "File " + model_file + " error!";
+    model->AddTri(vertex[0].data(), vertex[1].data(), vertex[2].data(),
+      counter);
   }
+
+  model->EndModel(split_rule_, bv_type_);
+  StoreCached(key, *model, *axis_length, *radius);
+  return model.release();
 }
 
-// TODO(hamza): Try to get rid of code repetition
 PQP_Model* ModelParser::GetModel(const std::string& model_file) {
-  std::ifstream input_file (model_file.c_str(), std::ios::binary);
-  try {
-    std::unique_ptr<PQP_Model> model (new PQP_Model);
+  StlReader reader (model_file);
+  uint64_t key = HashBytes(&split_rule_, sizeof(split_rule_),
+      reader.Hash(HashBytes(&kModelSeed, sizeof(kModelSeed))));
+  key = HashBytes(&bv_type_, sizeof(bv_type_), key);
+  double axis_length, radius;
+  std::unique_ptr<PQP_Model> model (LoadCached(key, &axis_length, &radius));
+  if (model) return model.release();
 
-    char header[80] = "";         // Reads STL binary header
-    input_file.read(header, 80);
+  model.reset(new PQP_Model);
+  model->BeginModel(std::max<size_t>(reader.size(), 1));
 
-    unsigned num_tris = 0;  // Reads number of triangles
-    input_file.read(reinterpret_cast<char*>(&num_tris), sizeof(num_tris));
+  EVector3f vertex[3];  // Triangle represented as three vertices
+  for (size_t counter = 0; counter < reader.size(); ++counter) {
+    reader.Triangle(counter, vertex);
+    model->AddTri(vertex[0].data(), vertex[1].data(), vertex[2].data(),
+      counter);
+  }
 
-    float vertex[3][3];  // Triangle represented as three vertices
-    float surf_vec[3];
+  model->EndModel(split_rule_, bv_type_);
+  StoreCached(key, *model, 0.0, 0.0);
+  return model.release();
+}
 
-    model->BeginModel();
+std::string ModelParser::CachePath(uint64_t key) const {
+  std::ostringstream path;
+  path << bvh_cache_dir_ << '/' << std::hex << std::setw(16) <<
+    std::setfill('0') << key << ".bvh";
+  return path.str();
+}
 
-    int16_t temp (0);  // Used for taking two bits of data after a triangle
-    uint64_t counter = 0;
-    while (counter < num_tris) {
-      input_file.read(reinterpret_cast<char*>(surf_vec), sizeof(surf_vec));
+PQP_Model* ModelParser::LoadCached(uint64_t key, double* axis_length,
+                                   double* radius) {
+  if (bvh_cache_dir_.empty()) return nullptr;
+  PQP_Model* model = ReadBvhCache(CachePath(key), key, bv_type_, axis_length,
+                                  radius);
+  if (model)
+    ++cache_hits_;
+  else
+    ++cache_misses_;
+  return model;
+}
 
-      input_file.read(reinterpret_cast<char*>(&vertex[0]), sizeof(vertex[0]));
-      input_file.read(reinterpret_cast<char*>(&vertex[1]), sizeof(vertex[1]));
-      input_file.read(reinterpret_cast<char*>(&vertex[2]), sizeof(vertex[2]));
-      model->AddTri(vertex[0], vertex[1], vertex[2], counter);
+void ModelParser::StoreCached(uint64_t key, const PQP_Model& model,
+                              double axis_length, double radius) const {
+  if (bvh_cache_dir_.empty() || model.num_tris <= 0 || model.num_bvs <= 0)
+    return;
+  // Cache is only an optimization, so failing to write it is not an error
+  mkdir(bvh_cache_dir_.c_str(), 0755);
 
-      input_file.read(reinterpret_cast<char*>(&temp), sizeof(temp));
-      ++counter;
-    }
+  BvhCacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kBvhCacheMagic, sizeof(kBvhCacheMagic));
+  header.version = kBvhCacheVersion;
+  header.real_size = sizeof(PQP_REAL);
+  header.tri_size = sizeof(Tri);
+  header.bv_size = sizeof(BV);
+  header.obb_size = ObbArraySize(model.bv_type);
+  header.key = key;
+  header.bv_type = model.bv_type;
+  header.num_tris = model.num_tris;
+  header.num_bvs = model.num_bvs;
+  header.axis_length = axis_length;
+  header.radius = radius;
 
-    model->EndModel();
-    return model.release();
-  }
-  catch(...) {
-    throw "File " + model_file + " error!";
+  // Written aside and renamed, so that concurrent readers never see a
+  // partial file
+  const std::string path = CachePath(key);
+  const std::string temp_path = path + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream output (temp_path, std::ios::binary);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.write(reinterpret_cast<const char*>(model.tris),
+                 sizeof(Tri) * model.num_tris);
+    output.write(reinterpret_cast<const char*>(model.b),
+                 sizeof(BV) * model.num_bvs);
+    output.write(reinterpret_cast<const char*>(model.obb),
+                 header.obb_size * model.num_bvs);
+    if (!output) {
+      output.close();
+      std::remove(temp_path.c_str());
+      return;
+    }
   }
+  if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+    std::remove(temp_path.c_str());
 }
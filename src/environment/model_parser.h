@@ -21,18 +21,44 @@
 #include <PQP/PQP.h>
 #include <Eigen/Dense>
 #include <string>
+#include <cstdint>
 
 class ModelParser {
   typedef Eigen::Matrix<float, 3, 3, Eigen::RowMajor> EMatrix;
   typedef Eigen::Vector3f EVector3f;
  public:
-  ModelParser() {}
+  // Built models are cached as files in bvh_cache_dir, keyed by the content
+  // of the model file, the transform, the split rule and the BV types. Empty
+  // directory disables the cache. Hierarchies are built with split_rule, one
+  // of the PQP_SPLIT_ rules, and with the bv_type BVs, see
+  // PQP_Model::EndModel().
+  explicit ModelParser(const std::string& bvh_cache_dir = "",
+                       int split_rule = PQP_SPLIT_MEAN,
+                       int bv_type = PQP_BV_TYPE)
+      : bvh_cache_dir_(bvh_cache_dir), split_rule_(split_rule),
+        bv_type_(bv_type), cache_hits_(0), cache_misses_(0) {}
   PQP_Model* GetTransformModel(const std::string& model_file,
                                const EMatrix& R, const EVector3f& T,
                                const EVector3f& axis, double* axis_length,
                                double* radius);
   PQP_Model* GetModel(const std::string& model_file);
   // TODO(hamza): Add robot parameters getter
+
+  // Models loaded from the cache and models built, while the cache is enabled
+  int cache_hits() const { return cache_hits_; }
+  int cache_misses() const { return cache_misses_; }
+
+ private:
+  std::string CachePath(uint64_t key) const;
+  // Returns the cached model with the key, nullptr if it is absent or stale
+  PQP_Model* LoadCached(uint64_t key, double* axis_length, double* radius);
+  void StoreCached(uint64_t key, const PQP_Model& model, double axis_length,
+                   double radius) const;
+
+  std::string bvh_cache_dir_;
+  int split_rule_;
+  int bv_type_;
+  int cache_hits_, cache_misses_;
 };
 
 #endif  // MODEL_PARSER_H_INCLUDED
@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE ModelParserTest
+
+#include "model_parser.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <omp.h>
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+
+const float kTriangles[2][3][3] = {{{0, 0, 0}, {1, 0, 0}, {0, 1, 0}},
+                                   {{0, 0, 1}, {1.5, 0, 1}, {0, -2.25, 1}}};
+
+void WriteBinary(const std::string& filename, uint32_t num_tris,
+                 int records) {
+  std::ofstream file (filename, std::ios::binary);
+  char header[80] = "solid binary header";
+  file.write(header, sizeof(header));
+  file.write(reinterpret_cast<const char*>(&num_tris), sizeof(num_tris));
+  for (int i = 0; i < records; ++i) {
+    float normal[3] = {0, 0, 1};
+    uint16_t attribute = 0;
+    file.write(reinterpret_cast<const char*>(normal), sizeof(normal));
+    file.write(reinterpret_cast<const char*>(kTriangles[i]),
+               sizeof(kTriangles[i]));
+    file.write(reinterpret_cast<const char*>(&attribute), sizeof(attribute));
+  }
+}
+
+// Triangles of size up to 2 scattered in a box of size 100
+void WriteRandom(const std::string& filename, uint32_t num_tris) {
+  std::ofstream file (filename, std::ios::binary);
+  char header[80] = "";
+  file.write(header, sizeof(header));
+  file.write(reinterpret_cast<const char*>(&num_tris), sizeof(num_tris));
+  std::mt19937 generator (7);
+  std::uniform_real_distribution<float> position (0, 100), size (0, 2);
+  for (uint32_t i = 0; i < num_tris; ++i) {
+    float record[12] = {0, 0, 1};
+    for (int k = 0; k < 3; ++k) record[3 + k] = position(generator);
+    for (int v = 1; v < 3; ++v)
+      for (int k = 0; k < 3; ++k)
+        record[3 + 3 * v + k] = record[3 + k] + size(generator);
+    uint16_t attribute = 0;
+    file.write(reinterpret_cast<const char*>(record), sizeof(record));
+    file.write(reinterpret_cast<const char*>(&attribute), sizeof(attribute));
+  }
+}
+
+void WriteAscii(const std::string& filename) {
+  std::ofstream file (filename);
+  file << "solid ascii" << std::endl;
+  for (const auto& triangle : kTriangles) {
+    file << "  facet normal 0 0 1" << std::endl << "    outer loop" <<
+      std::endl;
+    for (const auto& vertex : triangle)
+      file << "      vertex " << vertex[0] << " " << vertex[1] << " " <<
+        vertex[2] << std::endl;
+    file << "    endloop" << std::endl << "  endfacet" << std::endl;
+  }
+  file << "endsolid ascii" << std::endl;
+}
+
+// Building the BVH reorders triangles, so they are matched by id
+void CheckModel(const PQP_Model& model) {
+  BOOST_REQUIRE_EQUAL(model.num_tris, 2);
+  for (int j = 0; j < 2; ++j) {
+    const int i = model.tris[j].id;
+    BOOST_REQUIRE(i == 0 || i == 1);
+    for (int k = 0; k < 3; ++k) {
+      BOOST_CHECK_EQUAL(model.tris[j].p1[k], kTriangles[i][0][k]);
+      BOOST_CHECK_EQUAL(model.tris[j].p2[k], kTriangles[i][1][k]);
+      BOOST_CHECK_EQUAL(model.tris[j].p3[k], kTriangles[i][2][k]);
+    }
+  }
+}
+
+// Files in the directory, without . and ..
+std::vector<std::string> ListDirectory(const std::string& directory) {
+  std::vector<std::string> files;
+  DIR* dir = opendir(directory.c_str());
+  if (!dir) return files;
+  while (dirent* entry = readdir(dir))
+    if (std::strcmp(entry->d_name, ".") && std::strcmp(entry->d_name, ".."))
+      files.push_back(directory + "/" + entry->d_name);
+  closedir(dir);
+  return files;
+}
+
+void RemoveDirectory(const std::string& directory) {
+  for (const auto& file : ListDirectory(directory))
+    std::remove(file.c_str());
+  rmdir(directory.c_str());
+}
+
+void CheckSameModel(const PQP_Model& model1, const PQP_Model& model2) {
+  BOOST_REQUIRE_EQUAL(model1.num_tris, model2.num_tris);
+  BOOST_REQUIRE_EQUAL(model1.num_bvs, model2.num_bvs);
+  BOOST_REQUIRE_EQUAL(model1.bv_type, model2.bv_type);
+  BOOST_CHECK(!std::memcmp(model1.tris, model2.tris,
+                           sizeof(Tri) * model1.num_tris));
+  BOOST_CHECK(!std::memcmp(model1.b, model2.b, sizeof(BV) * model1.num_bvs));
+  for (int i = 0; i < model1.num_bvs && (model1.bv_type & OBB_TYPE); ++i)
+    BOOST_CHECK(!std::memcmp(model1.child_obb(i), model2.child_obb(i),
+                             sizeof(OBB)));
+  BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(model2.b) % PQP_BV_ALIGNMENT,
+                    0u);
+}
+
+BOOST_AUTO_TEST_CASE(binary) {
+  WriteBinary("model_parser_binary.stl", 2, 2);
+  ModelParser parser;
+  std::unique_ptr<PQP_Model> model (parser.GetModel("model_parser_binary.stl"));
+  CheckModel(*model);
+  std::remove("model_parser_binary.stl");
+}
+
+BOOST_AUTO_TEST_CASE(ascii) {
+  WriteAscii("model_parser_ascii.stl");
+  ModelParser parser;
+  std::unique_ptr<PQP_Model> model (parser.GetModel("model_parser_ascii.stl"));
+  CheckModel(*model);
+  std::remove("model_parser_ascii.stl");
+}
+
+BOOST_AUTO_TEST_CASE(invalid) {
+  ModelParser parser;
+  BOOST_CHECK_THROW(parser.GetModel("model_parser_missing.stl"), std::string);
+
+  // Header claims more triangles than the file holds
+  WriteBinary("model_parser_truncated.stl", 3, 2);
+  BOOST_CHECK_THROW(parser.GetModel("model_parser_truncated.stl"),
+                    std::string);
+  std::remove("model_parser_truncated.stl");
+}
+
+BOOST_AUTO_TEST_CASE(bvh_cache) {
+  const std::string cache_dir = "model_parser_cache";
+  RemoveDirectory(cache_dir);
+  WriteBinary("model_parser_cached.stl", 2, 2);
+
+  ModelParser uncached;
+  std::unique_ptr<PQP_Model> built (uncached.GetModel(
+      "model_parser_cached.stl"));
+  ModelParser parser1 (cache_dir);
+  std::unique_ptr<PQP_Model> stored (parser1.GetModel(
+      "model_parser_cached.stl"));
+  BOOST_CHECK_EQUAL(parser1.cache_hits(), 0);
+  BOOST_CHECK_EQUAL(parser1.cache_misses(), 1);
+  BOOST_CHECK_EQUAL(ListDirectory(cache_dir).size(), 1);
+
+  ModelParser parser2 (cache_dir);
+  std::unique_ptr<PQP_Model> loaded (parser2.GetModel(
+      "model_parser_cached.stl"));
+  BOOST_CHECK_EQUAL(parser2.cache_hits(), 1);
+  BOOST_CHECK_EQUAL(parser2.cache_misses(), 0);
+  CheckSameModel(*built, *loaded);
+  CheckModel(*loaded);
+
+  // Transformed models are keyed by the transform too
+  Eigen::Matrix<float, 3, 3, Eigen::RowMajor> R;
+  R << 0, -1, 0, 1, 0, 0, 0, 0, 1;
+  const Eigen::Vector3f T (1, 2, 3), axis (0, 0, 1);
+  double axis_length1, radius1, axis_length2, radius2;
+  std::unique_ptr<PQP_Model> transformed1 (parser2.GetTransformModel(
+      "model_parser_cached.stl", R, T, axis, &axis_length1, &radius1));
+  std::unique_ptr<PQP_Model> transformed2 (parser2.GetTransformModel(
+      "model_parser_cached.stl", R, T, axis, &axis_length2, &radius2));
+  BOOST_CHECK_EQUAL(parser2.cache_hits(), 2);
+  BOOST_CHECK_EQUAL(parser2.cache_misses(), 1);
+  BOOST_CHECK_EQUAL(axis_length1, axis_length2);
+  BOOST_CHECK_EQUAL(radius1, radius2);
+  CheckSameModel(*transformed1, *transformed2);
+
+  // Changed content is a different key
+  WriteBinary("model_parser_cached.stl", 1, 1);
+  std::unique_ptr<PQP_Model> changed (parser2.GetModel(
+      "model_parser_cached.stl"));
+  BOOST_CHECK_EQUAL(changed->num_tris, 1);
+  BOOST_CHECK_EQUAL(parser2.cache_misses(), 2);
+
+  // Damaged cache files are rebuilt
+  for (const auto& file : ListDirectory(cache_dir))
+    truncate(file.c_str(), 100);
+  std::unique_ptr<PQP_Model> rebuilt (parser2.GetModel(
+      "model_parser_cached.stl"));
+  BOOST_CHECK_EQUAL(rebuilt->num_tris, 1);
+  BOOST_CHECK_EQUAL(parser2.cache_misses(), 3);
+
+  std::remove("model_parser_cached.stl");
+  RemoveDirectory(cache_dir);
+}
+
+BOOST_AUTO_TEST_CASE(parallel_build) {
+  // Enough triangles for concurrent subtrees and chunked sums
+  const uint32_t num_tris = 40000;
+  WriteRandom("model_parser_large.stl", num_tris);
+
+  const int max_threads = omp_get_max_threads();
+  ModelParser parser;
+  omp_set_num_threads(1);
+  std::unique_ptr<PQP_Model> serial (parser.GetModel(
+      "model_parser_large.stl"));
+  omp_set_num_threads(4);
+  std::unique_ptr<PQP_Model> parallel (parser.GetModel(
+      "model_parser_large.stl"));
+  omp_set_num_threads(max_threads);
+  CheckSameModel(*serial, *parallel);
+
+  // Every triangle is in exactly one leaf
+  BOOST_REQUIRE_EQUAL(parallel->num_bvs, 2 * parallel->num_tris - 1);
+  std::vector<int> leaves (num_tris, 0);
+  for (int i = 0; i < parallel->num_bvs; ++i)
+    if (parallel->b[i].first_child < 0)
+      ++leaves.at(-parallel->b[i].first_child - 1);
+  BOOST_CHECK(std::all_of(leaves.begin(), leaves.end(),
+                          [](int count) { return count == 1; }));
+  std::remove("model_parser_large.stl");
+}
+
+BOOST_AUTO_TEST_CASE(bv_types) {
+  const std::string cache_dir = "model_parser_types_cache";
+  RemoveDirectory(cache_dir);
+  WriteRandom("model_parser_types.stl", 2000);
+
+  ModelParser full_parser, rss_parser (cache_dir, PQP_SPLIT_MEAN, RSS_TYPE),
+              obb_parser (cache_dir, PQP_SPLIT_MEAN, OBB_TYPE);
+  std::unique_ptr<PQP_Model> full (full_parser.GetModel(
+      "model_parser_types.stl"));
+  std::unique_ptr<PQP_Model> rss (rss_parser.GetModel(
+      "model_parser_types.stl"));
+  std::unique_ptr<PQP_Model> obb (obb_parser.GetModel(
+      "model_parser_types.stl"));
+  BOOST_CHECK_EQUAL(rss->bv_type, RSS_TYPE);
+  BOOST_CHECK_EQUAL(obb->bv_type, OBB_TYPE);
+  BOOST_CHECK(rss->MemUsage(0) < full->MemUsage(0));
+  BOOST_CHECK(obb->MemUsage(0) < full->MemUsage(0));
+
+  // Same hierarchy, minus the other type
+  BOOST_REQUIRE_EQUAL(rss->num_bvs, full->num_bvs);
+  BOOST_REQUIRE_EQUAL(obb->num_bvs, full->num_bvs);
+  BOOST_CHECK(!std::memcmp(rss->b, full->b, sizeof(BV) * full->num_bvs));
+  for (int i = 0; i < full->num_bvs; ++i) {
+    BOOST_CHECK(!std::memcmp(obb->child_obb(i), full->child_obb(i),
+                             sizeof(OBB)));
+    BOOST_CHECK(!std::memcmp(obb->b[i].R, full->b[i].R, sizeof(BV::R)));
+    BOOST_CHECK_EQUAL(obb->b[i].first_child, full->b[i].first_child);
+  }
+
+  // Both flavours round trip through the cache
+  ModelParser rss_reader (cache_dir, PQP_SPLIT_MEAN, RSS_TYPE),
+              obb_reader (cache_dir, PQP_SPLIT_MEAN, OBB_TYPE);
+  std::unique_ptr<PQP_Model> rss_loaded (rss_reader.GetModel(
+      "model_parser_types.stl"));
+  std::unique_ptr<PQP_Model> obb_loaded (obb_reader.GetModel(
+      "model_parser_types.stl"));
+  BOOST_CHECK_EQUAL(rss_reader.cache_hits() + obb_reader.cache_hits(), 2);
+  CheckSameModel(*rss, *rss_loaded);
+  CheckSameModel(*obb, *obb_loaded);
+
+  // Queries of a shifted copy match those of the full models
+  PQP_REAL R[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}, T0[3] = {0, 0, 0};
+  for (PQP_REAL shift : {0.5f, 3.0f, 120.0f}) {
+    PQP_REAL T[3] = {shift, 0, 0};
+    PQP_DistanceResult full_distance, rss_distance;
+    PQP_Distance(&full_distance, R, T0, full.get(), R, T, full.get(), 0, 0);
+    BOOST_REQUIRE_EQUAL(PQP_Distance(&rss_distance, R, T0, rss.get(), R, T,
+                                     rss.get(), 0, 0), PQP_OK);
+    BOOST_CHECK_EQUAL(full_distance.Distance(), rss_distance.Distance());
+
+    PQP_CollideResult full_collide, rss_collide, obb_collide;
+    PQP_Collide(&full_collide, R, T0, full.get(), R, T, full.get(),
+                PQP_ALL_CONTACTS);
+    BOOST_REQUIRE_EQUAL(PQP_Collide(&rss_collide, R, T0, rss.get(), R, T,
+                                    rss.get(), PQP_ALL_CONTACTS), PQP_OK);
+    BOOST_REQUIRE_EQUAL(PQP_Collide(&obb_collide, R, T0, obb.get(), R, T,
+                                    obb.get(), PQP_ALL_CONTACTS), PQP_OK);
+    BOOST_CHECK_EQUAL(rss_collide.NumPairs(), full_collide.NumPairs());
+    BOOST_CHECK_EQUAL(obb_collide.NumPairs(), full_collide.NumPairs());
+  }
+
+  // Queries the models lack the BVs for are refused
+  PQP_DistanceResult distance;
+  BOOST_CHECK_EQUAL(PQP_Distance(&distance, R, T0, obb.get(), R, T0,
+                                 full.get(), 0, 0),
+                    PQP_ERR_UNSUPPORTED_BV_TYPE);
+  PQP_ToleranceResult tolerance;
+  BOOST_CHECK_EQUAL(PQP_Tolerance(&tolerance, R, T0, full.get(), R, T0,
+                                  obb.get(), 1),
+                    PQP_ERR_UNSUPPORTED_BV_TYPE);
+  PQP_CollideResult collide;
+  BOOST_CHECK_EQUAL(PQP_Collide(&collide, R, T0, rss.get(), R, T0,
+                                obb.get(), PQP_FIRST_CONTACT),
+                    PQP_ERR_UNSUPPORTED_BV_TYPE);
+
+  std::remove("model_parser_types.stl");
+  RemoveDirectory(cache_dir);
+}
@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include "obstacle_set.h"
+
+#include <algorithm>
+
+namespace {
+
+// Relative growth of the obstacle boxes
+const float kBoundsMargin = 1e-5f;
+
+}  // namespace
+
+std::shared_ptr<const ObstacleSet> ObstacleSet::Add(
+    const std::shared_ptr<PQP_Model>& model, const EMatrix& rotation,
+    const EVector3f& translation, int* id) const {
+  if (!model || model->num_bvs <= 0) throw "Obstacle model problem!";
+  std::shared_ptr<ObstacleSet> set (new ObstacleSet(*this));
+  // Placed in full before it is stored
+  Obstacle obstacle;
+  obstacle.model = model;
+  Place(&obstacle, rotation, translation);
+  int free_id = 0;
+  while (free_id < slots() && obstacles_[free_id].model) ++free_id;
+  if (free_id == slots())
+    set->obstacles_.push_back(std::move(obstacle));
+  else
+    set->obstacles_[free_id] = std::move(obstacle);
+  ++set->size_;
+  set->BuildNodes();
+  *id = free_id;
+  return set;
+}
+
+std::shared_ptr<const ObstacleSet> ObstacleSet::Remove(int id) const {
+  if (!contains(id)) throw "Unknown obstacle!";
+  std::shared_ptr<ObstacleSet> set (new ObstacleSet(*this));
+  set->obstacles_[id].model.reset();
+  set->obstacles_[id].bounds.clear();
+  // Trailing empty slots are dropped, so ids stay dense
+  while (!set->obstacles_.empty() && !set->obstacles_.back().model)
+    set->obstacles_.pop_back();
+  --set->size_;
+  set->BuildNodes();
+  return set;
+}
+
+std::shared_ptr<const ObstacleSet> ObstacleSet::Move(int id,
+    const EMatrix& rotation, const EVector3f& translation) const {
+  if (!contains(id)) throw "Unknown obstacle!";
+  std::shared_ptr<ObstacleSet> set (new ObstacleSet(*this));
+  Place(&set->obstacles_[id], rotation, translation);
+  set->BuildNodes();
+  return set;
+}
+
+void ObstacleSet::Place(Obstacle* obstacle, const EMatrix& rotation,
+                        const EVector3f& translation) {
+  obstacle->rotation = rotation;
+  obstacle->translation = translation;
+  const Bound world {rotation, translation, translation,
+                     EVector3f::Zero()};
+  const PQP_Model& model = *obstacle->model;
+  obstacle->root = BoxToParent(model, 0, world);
+
+  // Descends the BVH level by level while the bounds fit the limit. Child
+  // boxes are stored relative to their parent.
+  std::vector<std::pair<int, Bound>> bounds, next_bounds;
+  bounds.emplace_back(0, obstacle->root);
+  bool expanded = true;
+  while (expanded) {
+    expanded = false;
+    next_bounds.clear();
+    for (const auto& bound : bounds) {
+      const int first_child = model.b[bound.first].first_child;
+      if (first_child < 0) {
+        next_bounds.push_back(bound);
+        continue;
+      }
+      for (int child = first_child; child < first_child + 2; ++child)
+        next_bounds.emplace_back(child,
+                                 BoxToParent(model, child, bound.second));
+      expanded = true;
+    }
+    if (next_bounds.size() > kMaxObstacleBounds) break;
+    bounds.swap(next_bounds);
+  }
+  obstacle->bounds.clear();
+  for (const auto& bound : bounds)
+    obstacle->bounds.push_back(bound.second);
+}
+
+void ObstacleSet::BuildNodes() {
+  nodes_.clear();
+  std::vector<int> ids;
+  for (int id = 0; id < slots(); ++id)
+    if (contains(id)) ids.push_back(id);
+  if (ids.empty()) return;
+  nodes_.reserve(2 * ids.size() - 1);
+  nodes_.emplace_back();
+  BuildNodes(0, ids.begin(), ids.end());
+}
+
+void ObstacleSet::BuildNodes(int node, std::vector<int>::iterator first,
+                             std::vector<int>::iterator last) {
+  if (last - first == 1) {
+    nodes_[node].bound = obstacles_[*first].root;
+    nodes_[node].first_child = -(*first + 1);
+    return;
+  }
+
+  // Axis aligned box of the obstacle boxes
+  EVector3f min = EVector3f::Constant(INFINITY),
+            max = EVector3f::Constant(-INFINITY);
+  for (auto id = first; id != last; ++id) {
+    const Bound& root = obstacles_[*id].root;
+    const EVector3f extent = root.rotation.cwiseAbs() * root.half_extents;
+    min = min.cwiseMin(root.center - extent);
+    max = max.cwiseMax(root.center + extent);
+  }
+  nodes_[node].bound = Bound{Eigen::Matrix3f::Identity(), (min + max) / 2,
+                             (min + max) / 2, (max - min) / 2};
+
+  // Median split of the box centers along the longest axis
+  int axis;
+  (max - min).maxCoeff(&axis);
+  const auto middle = first + (last - first) / 2;
+  std::nth_element(first, middle, last, [this, axis](int i, int j) {
+    return obstacles_[i].root.center(axis) < obstacles_[j].root.center(axis);
+  });
+  const int first_child = nodes_.size();
+  nodes_[node].first_child = first_child;
+  nodes_.resize(first_child + 2);
+  BuildNodes(first_child, first, middle);
+  BuildNodes(first_child + 1, middle, last);
+}
+
+ObstacleSet::Bound ObstacleSet::BoxToParent(const PQP_Model& model,
+    int node, const Bound& parent) {
+  const BV& bv = model.b[node];
+  Bound bound;
+  Eigen::Matrix3f rotation;
+  for (int row = 0; row < 3; ++row)
+    for (int col = 0; col < 3; ++col)
+      rotation(row, col) = bv.R[row][col];
+  bound.rotation = parent.rotation * rotation;
+  EVector3f origin, offset;
+  if (model.bv_type & OBB_TYPE) {
+    const OBB& obb = *model.child_obb(node);
+    origin = EVector3f(obb.To[0], obb.To[1], obb.To[2]);
+    offset = EVector3f::Zero();
+    bound.half_extents = EVector3f(obb.d[0], obb.d[1], obb.d[2]);
+  } else {
+    // Rectangle spans l from the origin along the first two axes
+    origin = EVector3f(bv.Tr[0], bv.Tr[1], bv.Tr[2]);
+    offset = EVector3f(bv.l[0] / 2, bv.l[1] / 2, 0.0f);
+    bound.half_extents = offset + EVector3f::Constant(bv.r);
+  }
+  bound.origin = parent.rotation * origin + parent.origin;
+  bound.center = bound.origin + bound.rotation * offset;
+  return bound;
+}
+
+double ObstacleSet::BoxGap(const Bound& bound, const EVector3f& begin,
+    const EVector3f& end) {
+  // Box is grown to stay conservative despite the rounding errors
+  const EVector3f half_extents = bound.half_extents.array() + kBoundsMargin *
+      (bound.center.norm() + bound.half_extents.norm());
+  const EVector3f a = bound.rotation.transpose() * (begin - bound.center),
+                  b = bound.rotation.transpose() * (end - bound.center);
+  return (a.cwiseMin(b) - half_extents).cwiseMax(
+      -half_extents - a.cwiseMax(b)).cwiseMax(0.0f).norm();
+}
+
+double ObstacleSet::CapsuleDistanceLowerBound(const EVector3f& begin,
+    const EVector3f& end, double radius) const {
+  double lower_bound = INFINITY;
+  Traverse(begin, end, &lower_bound, [&](int id) {
+    for (const auto& bound : obstacles_[id].bounds)
+      lower_bound = std::min(lower_bound, BoxGap(bound, begin, end));
+    return true;
+  });
+  return std::max(lower_bound - radius, 0.0);
+}
+
+double ObstacleSet::CapsuleDistance(const EVector3f& begin,
+    const EVector3f& end, double radius, double upper_bound) const {
+  // Closest axis distance so far, obstacles further away are pruned
+  double distance = upper_bound + radius;
+  Traverse(begin, end, &distance, [&](int id) {
+    const Obstacle& obstacle = obstacles_[id];
+    const auto to_model = [&obstacle](const EVector3f& point) {
+      return EVector3f(obstacle.rotation.transpose() *
+                       (point - obstacle.translation));
+    };
+    distance = std::min(distance, ModelDistance(*obstacle.model,
+        to_model(begin), to_model(end), distance));
+    return true;
+  });
+  return std::max(distance - radius, 0.0);
+}
+
+double ObstacleSet::ModelDistance(const PQP_Model& model,
+    const EVector3f& begin, const EVector3f& end, double upper_bound) {
+  double distance = upper_bound;
+
+  // Depth first, the closer child first
+  struct Node {
+    int index;
+    Bound bound;
+    double gap;
+  };
+  std::vector<Node> stack;
+  const Bound root = BoxToParent(model, 0,
+      Bound{Eigen::Matrix3f::Identity(), EVector3f::Zero(), EVector3f::Zero(),
+            EVector3f::Zero()});
+  stack.push_back(Node{0, root, BoxGap(root, begin, end)});
+
+  while (!stack.empty()) {
+    const Node node = stack.back(); stack.pop_back();
+    if (node.gap >= distance) continue;
+
+    const int first_child = model.b[node.index].first_child;
+    if (first_child < 0) {
+      const Tri& tri = model.tris[-first_child - 1];
+      distance = std::min(distance, SegmentTriangleDistance(begin, end,
+          EVector3f(tri.p1[0], tri.p1[1], tri.p1[2]),
+          EVector3f(tri.p2[0], tri.p2[1], tri.p2[2]),
+          EVector3f(tri.p3[0], tri.p3[1], tri.p3[2])));
+      continue;
+    }
+
+    Node children[2];
+    for (int k = 0; k < 2; ++k) {
+      children[k].index = first_child + k;
+      children[k].bound = BoxToParent(model, first_child + k, node.bound);
+      children[k].gap = BoxGap(children[k].bound, begin, end);
+    }
+    if (children[0].gap < children[1].gap) std::swap(children[0], children[1]);
+    for (const auto& child : children)
+      if (child.gap < distance) stack.push_back(child);
+  }
+  return distance;
+}
+
+double ObstacleSet::SegmentsDistance(const EVector3f& begin1,
+    const EVector3f& end1, const EVector3f& begin2, const EVector3f& end2) {
+  // Closest points of the two segments, parametrized by s and t
+  const Eigen::Vector3d d1 = (end1 - begin1).cast<double>(),
+                        d2 = (end2 - begin2).cast<double>(),
+                        r = (begin1 - begin2).cast<double>();
+  const double a = d1.squaredNorm(), e = d2.squaredNorm(), f = d2.dot(r);
+  const double kEpsilon = 1e-12;
+  auto clamp = [](double x) { return std::min(std::max(x, 0.0), 1.0); };
+
+  double s = 0.0, t = 0.0;
+  if (a <= kEpsilon && e <= kEpsilon) return r.norm();
+  if (a <= kEpsilon) {
+    t = clamp(f / e);
+  } else {
+    const double c = d1.dot(r);
+    if (e <= kEpsilon) {
+      s = clamp(-c / a);
+    } else {
+      const double b = d1.dot(d2), denominator = a * e - b * b;
+      s = denominator > kEpsilon ? clamp((b * f - c * e) / denominator) : 0.0;
+      t = (b * s + f) / e;
+      if (t < 0.0) {
+        t = 0.0;
+        s = clamp(-c / a);
+      } else if (t > 1.0) {
+        t = 1.0;
+        s = clamp((b - c) / a);
+      }
+    }
+  }
+  return (r + d1 * s - d2 * t).norm();
+}
+
+double ObstacleSet::SegmentTriangleDistance(const EVector3f& begin,
+    const EVector3f& end, const EVector3f& a, const EVector3f& b,
+    const EVector3f& c) {
+  const Eigen::Vector3d p = begin.cast<double>(), q = end.cast<double>(),
+                        v0 = a.cast<double>(), v1 = b.cast<double>(),
+                        v2 = c.cast<double>();
+  const Eigen::Vector3d normal = (v1 - v0).cross(v2 - v0);
+  const double normal_norm = normal.norm();
+
+  // Point of the triangle plane inside the triangle
+  auto inside = [&](const Eigen::Vector3d& x) {
+    return normal.dot((v1 - v0).cross(x - v0)) >= 0.0 &&
+           normal.dot((v2 - v1).cross(x - v1)) >= 0.0 &&
+           normal.dot((v0 - v2).cross(x - v2)) >= 0.0;
+  };
+
+  double distance = std::min(SegmentsDistance(begin, end, a, b),
+      std::min(SegmentsDistance(begin, end, b, c),
+               SegmentsDistance(begin, end, c, a)));
+  if (normal_norm <= 0.0) return distance;  // Degenerate triangle
+
+  // Segment crossing the triangle
+  const double dp = normal.dot(p - v0), dq = normal.dot(q - v0);
+  if (dp * dq <= 0.0 && dp != dq &&
+      inside(p + (q - p) * (dp / (dp - dq))))
+    return 0.0;
+
+  // Segment endpoints over the triangle
+  if (inside(p - normal * (dp / (normal_norm * normal_norm))))
+    distance = std::min(distance, std::fabs(dp) / normal_norm);
+  if (inside(q - normal * (dq / (normal_norm * normal_norm))))
+    distance = std::min(distance, std::fabs(dq) / normal_norm);
+  return distance;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef OBSTACLE_SET_H_INCLUDED
+#define OBSTACLE_SET_H_INCLUDED
+
+#include <cmath>
+#include <PQP/PQP.h>
+#include <Eigen/Dense>
+#include <vector>
+#include <memory>
+#include <utility>
+
+// Rigid obstacles, each an independently built PQP model placed in the
+// world by its own transform, under a top-level BVH of their bounding
+// boxes. A set never changes - updates return a new set sharing the models
+// of the untouched obstacles, so queries running on the old set are not
+// disturbed and an update costs the obstacle plus a top-level rebuild.
+class ObstacleSet {
+ public:
+  typedef Eigen::Matrix<float, 3, 3, Eigen::RowMajor> EMatrix;
+  typedef Eigen::Vector3f EVector3f;
+
+  // Oriented box, axes are columns of the rotation
+  struct Bound {
+    Eigen::Matrix3f rotation;
+    EVector3f origin;  // Of the BVH node frame, its children are placed in
+    EVector3f center, half_extents;
+  };
+
+  struct Obstacle {
+    std::shared_ptr<PQP_Model> model;  // Null once the obstacle is removed
+    EMatrix rotation;
+    EVector3f translation;
+    Bound root;  // Box of the model root in the world frame
+    // Topmost model BVH boxes in the world frame, for coarse lower bounds
+    std::vector<Bound> bounds;
+  };
+
+  ObstacleSet() {}
+
+  // Sets with the obstacle added, removed or moved. Added obstacles take the
+  // smallest free id, returned in id. Unknown ids throw.
+  std::shared_ptr<const ObstacleSet> Add(
+      const std::shared_ptr<PQP_Model>& model, const EMatrix& rotation,
+      const EVector3f& translation, int* id) const;
+  std::shared_ptr<const ObstacleSet> Remove(int id) const;
+  std::shared_ptr<const ObstacleSet> Move(int id, const EMatrix& rotation,
+                                         const EVector3f& translation) const;
+
+  // Ids are less than slots, those of removed obstacles are empty until
+  // reused
+  int slots() const { return obstacles_.size(); }
+  int size() const { return size_; }
+  bool contains(int id) const {
+    return id >= 0 && id < slots() && obstacles_[id].model != nullptr;
+  }
+  const Obstacle& obstacle(int id) const { return obstacles_.at(id); }
+
+  // Calls query(id) for the obstacles whose root boxes are less than
+  // *limit from the box bounding segment begin-end, nearer ones first. The
+  // traversal stops when query returns false, and rereads *limit, which
+  // queries may lower.
+  template <typename Query>
+  void Traverse(const EVector3f& begin, const EVector3f& end, double* limit,
+                Query query) const;
+  // Lower bound of the distance from obstacles to the capsule with axis
+  // begin-end, from the coarse obstacle bounds only
+  double CapsuleDistanceLowerBound(const EVector3f& begin,
+                                   const EVector3f& end, double radius) const;
+  // Distance from obstacles to the capsule with axis begin-end, traversing
+  // the obstacle BVHs - exact if less than upper bound, otherwise at least
+  // upper bound. Capsules intersecting obstacles are at distance 0.
+  double CapsuleDistance(const EVector3f& begin, const EVector3f& end,
+                         double radius, double upper_bound) const;
+
+  // Distance between segments begin1-end1 and begin2-end2
+  static double SegmentsDistance(const EVector3f& begin1,
+                                 const EVector3f& end1,
+                                 const EVector3f& begin2,
+                                 const EVector3f& end2);
+  // Distance between segment begin-end and triangle abc
+  static double SegmentTriangleDistance(const EVector3f& begin,
+      const EVector3f& end, const EVector3f& a, const EVector3f& b,
+      const EVector3f& c);
+
+ private:
+  // Coarse bounds of an obstacle are its topmost BVH nodes, at most
+  static const size_t kMaxObstacleBounds = 16;
+
+  // Top-level BVH node, bounding box in the world frame
+  struct Node {
+    Bound bound;
+    int first_child;  // Negative value is -(id + 1) of the obstacle
+  };
+
+  // Box of model BVH node in the frame its parent box is given in, the OBB
+  // of the node or, when the model has none, the box of its RSS
+  static Bound BoxToParent(const PQP_Model& model, int node,
+                           const Bound& parent);
+  // Distance between the box and the box bounding segment begin-end in its
+  // frame, the box grown by a margin
+  static double BoxGap(const Bound& bound, const EVector3f& begin,
+                       const EVector3f& end);
+  // Axis distance of segment begin-end, in the model frame, to the model -
+  // exact if less than upper bound, otherwise at least upper bound
+  static double ModelDistance(const PQP_Model& model, const EVector3f& begin,
+                              const EVector3f& end, double upper_bound);
+  // Places the obstacle in the world and computes its bounds
+  static void Place(Obstacle* obstacle, const EMatrix& rotation,
+                    const EVector3f& translation);
+  // Builds the top-level BVH of the obstacles in the set
+  void BuildNodes();
+  // Fills the node with the subtree of obstacles first to last
+  void BuildNodes(int node, std::vector<int>::iterator first,
+                  std::vector<int>::iterator last);
+
+  std::vector<Obstacle> obstacles_;
+  int size_ = 0;
+  std::vector<Node> nodes_;  // Root first, children next to each other
+};
+
+template <typename Query>
+void ObstacleSet::Traverse(const EVector3f& begin, const EVector3f& end,
+                           double* limit, Query query) const {
+  if (nodes_.empty()) return;
+  // Depth first, the nearer child first
+  std::vector<std::pair<int, double>> stack;
+  stack.emplace_back(0, BoxGap(nodes_[0].bound, begin, end));
+  while (!stack.empty()) {
+    const std::pair<int, double> node = stack.back(); stack.pop_back();
+    if (node.second >= *limit) continue;
+    const int first_child = nodes_[node.first].first_child;
+    if (first_child < 0) {
+      if (!query(-first_child - 1)) return;
+      continue;
+    }
+    const double gap0 = BoxGap(nodes_[first_child].bound, begin, end),
+                 gap1 = BoxGap(nodes_[first_child + 1].bound, begin, end);
+    if (gap0 < gap1) {
+      stack.emplace_back(first_child + 1, gap1);
+      stack.emplace_back(first_child, gap0);
+    } else {
+      stack.emplace_back(first_child, gap0);
+      stack.emplace_back(first_child + 1, gap1);
+    }
+  }
+}
+
+#endif  // OBSTACLE_SET_H_INCLUDED
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE ObstacleSetTest
+
+#include "obstacle_set.h"
+
+#include <cmath>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <boost/test/unit_test.hpp>
+
+typedef ObstacleSet::EMatrix EMatrix;
+typedef ObstacleSet::EVector3f EVector3f;
+
+// Cube of the given size with a corner in the origin
+std::shared_ptr<PQP_Model> MakeCube(float size) {
+  std::shared_ptr<PQP_Model> model (new PQP_Model);
+  const int kFaces[6][4] = {{0, 1, 3, 2}, {4, 6, 7, 5}, {0, 4, 5, 1},
+                            {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 5, 7, 3}};
+  PQP_REAL corners[8][3];
+  for (int k = 0; k < 8; ++k)
+    for (int axis = 0; axis < 3; ++axis)
+      corners[k][axis] = (k >> axis) & 1 ? size : 0.0f;
+  model->BeginModel(12);
+  for (int face = 0; face < 6; ++face) {
+    const int* v = kFaces[face];
+    model->AddTri(corners[v[0]], corners[v[1]], corners[v[2]], 2 * face);
+    model->AddTri(corners[v[0]], corners[v[2]], corners[v[3]], 2 * face + 1);
+  }
+  model->EndModel();
+  return model;
+}
+
+EMatrix RandomRotation() {
+  Eigen::Quaternionf rotation (Eigen::Vector4f::Random());
+  rotation.normalize();
+  return rotation.toRotationMatrix();
+}
+
+// Distance from segment begin-end to the triangles of every obstacle
+double BruteForceDistance(const ObstacleSet& set, const EVector3f& begin,
+                          const EVector3f& end) {
+  double distance = INFINITY;
+  for (int id = 0; id < set.slots(); ++id) {
+    if (!set.contains(id)) continue;
+    const ObstacleSet::Obstacle& obstacle = set.obstacle(id);
+    auto to_world = [&obstacle](const PQP_REAL* p) {
+      return EVector3f(obstacle.rotation * EVector3f(p[0], p[1], p[2]) +
+                       obstacle.translation);
+    };
+    for (int k = 0; k < obstacle.model->num_tris; ++k) {
+      const Tri& tri = obstacle.model->tris[k];
+      distance = std::min(distance, ObstacleSet::SegmentTriangleDistance(
+          begin, end, to_world(tri.p1), to_world(tri.p2), to_world(tri.p3)));
+    }
+  }
+  return distance;
+}
+
+BOOST_AUTO_TEST_CASE(updates) {
+  std::shared_ptr<PQP_Model> cube = MakeCube(1);
+  std::shared_ptr<const ObstacleSet> set = std::make_shared<ObstacleSet>();
+  int ids[3];
+  for (int k = 0; k < 3; ++k) {
+    set = set->Add(cube, EMatrix::Identity(), EVector3f(10 * k, 0, 0),
+                   &ids[k]);
+    BOOST_CHECK_EQUAL(ids[k], k);
+  }
+  BOOST_CHECK_EQUAL(set->size(), 3);
+
+  // Removed ids are reused, trailing ones are dropped
+  set = set->Remove(1);
+  BOOST_CHECK_EQUAL(set->size(), 2);
+  BOOST_CHECK_EQUAL(set->slots(), 3);
+  BOOST_CHECK(!set->contains(1));
+  int id;
+  set = set->Add(cube, EMatrix::Identity(), EVector3f(0, 10, 0), &id);
+  BOOST_CHECK_EQUAL(id, 1);
+  set = set->Remove(2);
+  BOOST_CHECK_EQUAL(set->slots(), 2);
+  BOOST_CHECK_THROW(set->Remove(2), const char*);
+  BOOST_CHECK_THROW(set->Move(-1, EMatrix::Identity(), EVector3f::Zero()),
+                    const char*);
+  BOOST_CHECK_THROW(set->Add(std::make_shared<PQP_Model>(),
+                             EMatrix::Identity(), EVector3f::Zero(), &id),
+                    const char*);
+
+  // Old sets are not changed by updates, models are shared
+  const EVector3f begin (0.5, 0.5, 3), end (0.5, 0.5, 4);
+  std::shared_ptr<const ObstacleSet> moved =
+      set->Move(0, EMatrix::Identity(), EVector3f(0, 0, 3.5));
+  BOOST_CHECK_CLOSE(set->CapsuleDistance(begin, end, 0.0, INFINITY), 2.0,
+                    0.0001);
+  BOOST_CHECK_EQUAL(moved->CapsuleDistance(begin, end, 0.0, INFINITY), 0.0);
+  BOOST_CHECK_EQUAL(set->obstacle(0).translation, EVector3f::Zero());
+  BOOST_CHECK_EQUAL(moved->obstacle(0).model, set->obstacle(0).model);
+  BOOST_CHECK_EQUAL(moved->obstacle(1).model, set->obstacle(1).model);
+
+  // Empty set is infinitely far
+  set = moved->Remove(0)->Remove(1);
+  BOOST_CHECK_EQUAL(set->slots(), 0);
+  BOOST_CHECK_EQUAL(set->CapsuleDistance(begin, end, 0.0, INFINITY),
+                    INFINITY);
+}
+
+BOOST_AUTO_TEST_CASE(traverse) {
+  std::shared_ptr<PQP_Model> cube = MakeCube(1);
+  std::shared_ptr<const ObstacleSet> set = std::make_shared<ObstacleSet>();
+  for (int k = 0; k < 10; ++k) {
+    int id;
+    set = set->Add(cube, EMatrix::Identity(), EVector3f(10 * k, 0, 0), &id);
+  }
+
+  // Only obstacles within the limit are visited, nearest first
+  const EVector3f begin (30.5, 0.5, 2), end (30.5, 0.5, 3);
+  std::vector<int> visited;
+  auto visit = [&visited](int id) { visited.push_back(id); return true; };
+  double limit = 5;
+  set->Traverse(begin, end, &limit, visit);
+  BOOST_CHECK_EQUAL(visited.size(), 1);
+  BOOST_CHECK_EQUAL(visited[0], 3);
+  visited.clear();
+  limit = INFINITY;
+  set->Traverse(begin, end, &limit, visit);
+  BOOST_CHECK_EQUAL(visited.size(), 10);
+  BOOST_CHECK_EQUAL(visited[0], 3);
+  BOOST_CHECK_EQUAL(std::set<int>(visited.begin(), visited.end()).size(), 10);
+
+  // Lowered limit prunes, false result stops
+  visited.clear();
+  limit = INFINITY;
+  set->Traverse(begin, end, &limit, [&](int id) {
+    visited.push_back(id);
+    limit = 15;
+    return true;
+  });
+  BOOST_CHECK_EQUAL(visited.size(), 3);
+  visited.clear();
+  limit = INFINITY;
+  set->Traverse(begin, end, &limit, [&](int id) {
+    visited.push_back(id);
+    return false;
+  });
+  BOOST_CHECK_EQUAL(visited.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(capsule_distance) {
+  std::shared_ptr<PQP_Model> cube = MakeCube(20);
+  std::shared_ptr<const ObstacleSet> set = std::make_shared<ObstacleSet>();
+  for (int k = 0; k < 8; ++k) {
+    int id;
+    set = set->Add(cube, RandomRotation(), EVector3f::Random() * 100, &id);
+  }
+
+  // Traversal matches brute force as obstacles move, up to the rounding of
+  // the segment into the obstacle frames
+  for (int i = 0; i < 40; ++i) {
+    if (i % 5 == 0)
+      set = set->Move(i % set->slots(), RandomRotation(),
+                      EVector3f::Random() * 100);
+    const EVector3f begin (EVector3f::Random() * 150),
+                    end (EVector3f::Random() * 150);
+    const double expected = BruteForceDistance(*set, begin, end);
+    BOOST_CHECK_CLOSE(set->CapsuleDistance(begin, end, 0.0, INFINITY) + 1.0,
+                      expected + 1.0, 0.001);
+    BOOST_CHECK_GE(set->CapsuleDistance(begin, end, 0.0, expected / 2),
+                   expected / 2);
+    BOOST_CHECK_CLOSE(set->CapsuleDistance(begin, end, 1.0, INFINITY) + 1.0,
+                      std::max(expected - 1.0, 0.0) + 1.0, 0.001);
+    BOOST_CHECK_LE(set->CapsuleDistanceLowerBound(begin, end, 0.0),
+                   expected);
+  }
+}
@@ -23,66 +23,206 @@
 #include <vector>
 #include <string>
 #include <memory>
-#include <flann/flann.hpp>
+#include <functional>
 #include "../bubble.h"
+#include "../bubble_arena.h"
+#include "knn_index.h"
 
-#include "dh_parameter.h"
 #include "random_generator/random_space_generator_interface.h"
-#include "model_parser.h"
+#include "pqp_scene.h"
+#include "pqp_query_context.h"
 
+// Configuration sample space of a single planner, along with proximity
+// queries against a scene. Queries of the environment itself are meant for
+// the planner's thread (batches are parallelized internally), other threads
+// should use their own query contexts.
 class PqpEnvironment {
  public:
-  typedef flann::Index<flann::L2<double>> FlannPointArray;
   typedef Eigen::VectorXd EVectorXd;
   typedef Eigen::Matrix<float, 3, 3, Eigen::RowMajor> EMatrix;
   typedef Eigen::Vector3f EVector3f;
 
+  // Models are built with the bv_type BVs and segments of the
+  // self-collision pairs checked against each other, see PqpScene
   PqpEnvironment(const std::vector<std::string>& robot_model_files,
                  const std::string& dh_table_file,
                  const std::string& obstacles_model_file,
+                 RandomSpaceGeneratorInterface* random_generator,
+                 const int sample_space_size = 10000,
+                 const std::string& bvh_cache_dir = "",
+                 int bv_type = PQP_BV_TYPE,
+                 const PqpScene::SegmentPairs& self_collision_pairs =
+                     PqpScene::SegmentPairs());
+  // Shares already loaded models with other environments
+  PqpEnvironment(const std::shared_ptr<const PqpScene>& scene,
                  RandomSpaceGeneratorInterface* random_generator,
                  const int sample_space_size = 10000);
 
   int sample_space_size() { return conf_sample_space_->size(); }
   int dimension() { return dimension_; }
-  double* GetPoint(int point_index) const {
-    return conf_sample_space_->getPoint(point_index);
+  const std::shared_ptr<const PqpScene>& scene() const { return scene_; }
+  // Coordinates of the point, valid until the next point is added
+  const double* GetPoint(int point_index) const {
+    return conf_sample_space_->point(point_index);
+  }
+  // Adds a copy of the point and returns it's index
+  size_t AddPoint(const double* q);
+  template <int N>
+  size_t AddPoint(Eigen::Matrix<double, N, 1>& q) {
+    return AddPoint(q.data());
   }
-  // Adds a point and returns it's index
-  size_t AddPoint(EVectorXd& q);
-  // Removes a point to potentially speed up the search
+  // Removes a point from the knn and radius queries
   void RemovePoint(int point_index);
+  // Metric of the knn and radius queries and of the planners' edges,
+  // uniform unless set
+  const JointMetric& metric() const { return conf_sample_space_->metric(); }
+  void set_metric(const JointMetric& metric) {
+    conf_sample_space_->set_metric(metric);
+  }
   // Creates bubble - returns false upon failure
-  bool MakeBubble(const EVectorXd& coordinates,
-    std::shared_ptr<Bubble>& bubble);
+  template <int N>
+  bool MakeBubble(const Eigen::Matrix<double, N, 1>& coordinates,
+      std::shared_ptr<BubbleT<N>>& bubble) {
+    return query_context_.MakeBubble(coordinates, bubble);
+  }
+  // Creates bubbles concurrently - failed bubbles are left empty, returns
+  // the number of created bubbles
+  template <int N, typename Allocator>
+  size_t MakeBubbles(
+      const std::vector<Eigen::Matrix<double, N, 1>, Allocator>& coordinates,
+      std::vector<std::shared_ptr<BubbleT<N>>>& bubbles) {
+    bubbles.assign(coordinates.size(), nullptr);
+    return ParallelQueries(coordinates.size(),
+        [&](PqpQueryContext& context, int i) {
+          return context.MakeBubble(coordinates[i], bubbles[i]);
+        });
+  }
+  // Creates bubble in the arena - returns false upon failure, leaving the
+  // arena unchanged
+  template <int N>
+  bool MakeBubble(const Eigen::Matrix<double, N, 1>& coordinates,
+      BubbleArena<N>& arena, int& bubble) {
+    bubble = arena.Add(coordinates);
+    if (query_context_.MakeBubble(arena, bubble))
+      return true;
+    arena.PopBack();
+    bubble = BubbleArena<N>::kNull;
+    return false;
+  }
+  // Creates bubbles concurrently in the arena - handles of failed bubbles are
+  // kNull, returns the number of created bubbles
+  template <int N, typename Allocator>
+  size_t MakeBubbles(
+      const std::vector<Eigen::Matrix<double, N, 1>, Allocator>& coordinates,
+      BubbleArena<N>& arena, std::vector<int>& bubbles) {
+    const int first = static_cast<int>(arena.size());
+    for (const auto& bubble_coordinates : coordinates)
+      arena.Add(bubble_coordinates);
+
+    std::vector<char> created (coordinates.size());
+    ParallelQueries(coordinates.size(), [&](PqpQueryContext& context, int i) {
+      return created[i] = context.MakeBubble(arena, first + i);
+    });
+
+    // Created bubbles are moved over the failed ones
+    bubbles.assign(coordinates.size(), BubbleArena<N>::kNull);
+    int next = first;
+    for (size_t i = 0; i < coordinates.size(); ++i) {
+      if (!created[i]) continue;
+      if (first + static_cast<int>(i) != next)
+        arena.Move(first + i, next);
+      bubbles[i] = next++;
+    }
+    arena.Resize(next);
+    return next - first;
+  }
   // Performs distance query - returns smallest distance to obstacles
-  double DistanceQuery(EVectorXd& q);
+  double DistanceQuery(const double* q) {
+    return query_context_.DistanceQuery(q);
+  }
+  template <int N>
+  double DistanceQuery(const Eigen::Matrix<double, N, 1>& q) {
+    return DistanceQuery(q.data());
+  }
+  // Checks distance to obstacles against threshold - cheaper than comparing
+  // DistanceQuery, distances under the minimal one count as 0 alike
+  bool ClearanceAtLeast(const double* q, double threshold) {
+    return query_context_.ClearanceAtLeast(q, threshold);
+  }
+  template <int N>
+  bool ClearanceAtLeast(const Eigen::Matrix<double, N, 1>& q,
+      double threshold) {
+    return ClearanceAtLeast(q.data(), threshold);
+  }
   // Performs collision check - returns false upon collision
-  bool CollisionQuery(EVectorXd& q);
-  // Knn query - returns indices
-  std::vector<int> KnnQuery(EVectorXd& q, int k);
-  size_t CreatedBubbles() { return bubble_counter_; }
-  size_t CollisionChecks() { return collision_counter_; }
+  bool CollisionQuery(const double* q) {
+    return query_context_.CollisionQuery(q);
+  }
+  template <int N>
+  bool CollisionQuery(const Eigen::Matrix<double, N, 1>& q) {
+    return CollisionQuery(q.data());
+  }
+  // Knn query - returns indices, nearest first
+  std::vector<int> KnnQuery(const double* q, int k);
+  template <int N>
+  std::vector<int> KnnQuery(const Eigen::Matrix<double, N, 1>& q, int k) {
+    return KnnQuery(q.data(), k);
+  }
+  // Radius query - returns indices of the points within radius, nearest
+  // first
+  std::vector<int> RadiusQuery(const double* q, double radius);
+  template <int N>
+  std::vector<int> RadiusQuery(const Eigen::Matrix<double, N, 1>& q,
+                               double radius) {
+    return RadiusQuery(q.data(), radius);
+  }
+  // Query context for an additional thread, counted in the statistics
+  std::unique_ptr<PqpQueryContext> NewQueryContext() const;
+  // Sets capsule bubbles of this environment's contexts, including those
+  // created later - see PqpQueryContext::set_capsule_bubbles
+  void set_capsule_bubbles(bool capsule_bubbles,
+                           double min_capsule_distance = 0.0);
+  // Sets field bubbles of this environment's contexts alike - see
+  // PqpQueryContext::set_field_bubbles
+  void set_field_bubbles(bool field_bubbles, double min_field_distance = 0.0);
+  size_t CreatedBubbles() { return counters_->bubbles; }
+  size_t CollisionChecks() { return counters_->collision_checks; }
+  size_t CulledSegments() { return counters_->culled_segments; }
+  // Fraction of exact distance queries whose warm start pair stayed closest
+  double WarmStartHitRate() {
+    const size_t queries = counters_->warm_start_hits +
+                           counters_->warm_start_misses;
+    return queries ?
+      static_cast<double>(counters_->warm_start_hits) / queries : 0.0;
+  }
+  size_t BoundedDistances() { return counters_->bounded_distances; }
+  size_t CapsuleDistances() { return counters_->capsule_distances; }
+  size_t CapsuleFallbacks() { return counters_->capsule_fallbacks; }
+  size_t FieldDistances() { return counters_->field_distances; }
+  size_t FieldFallbacks() { return counters_->field_fallbacks; }
+  // Bounding volume and triangle pair tests of the exact distance queries
+  size_t DistanceBvTests() { return counters_->distance_bv_tests; }
+  size_t DistanceTriTests() { return counters_->distance_tri_tests; }
 
  private:
-  const double kMinDistanceToObstacles = 0.1;
-
-  bool LoadRobotModel(const std::vector<std::string>& robot_mode_files);
-  bool LoadRobotParameters(const std::string& parameters_file);
-  bool LoadObstacles(const std::string& obstacles_model_file);
   bool GenerateSampleSpace(
     RandomSpaceGeneratorInterface* random_generator,
     const int sample_space_size);
+  // Runs queries 0..queries_num-1 on the batch contexts, returns the number
+  // of successful ones
+  size_t ParallelQueries(int queries_num,
+    const std::function<bool(PqpQueryContext&, int)>& query);
 
-  std::unique_ptr<PQP_Model> obstacles_;
-  std::vector<std::unique_ptr<PQP_Model>> segments_;
-  std::vector<DhParameter> dh_table_;
-  ModelParser parser_;
-  std::unique_ptr<FlannPointArray> conf_sample_space_;
+  std::shared_ptr<const PqpScene> scene_;
+  std::shared_ptr<PqpQueryCounters> counters_;
+  PqpQueryContext query_context_;
+  // One context per OpenMP thread for batched queries
+  std::vector<std::unique_ptr<PqpQueryContext>> batch_contexts_;
+  std::unique_ptr<KnnIndex> conf_sample_space_;
   int sample_space_size_;
-  size_t bubble_counter_, collision_counter_;
   size_t dimension_;
-  std::vector<std::pair<EVector3f, double>> capsules_;
+  bool capsule_bubbles_, field_bubbles_;
+  double min_capsule_distance_, min_field_distance_;
 };
 
 #endif  // PQP_ENVIRONMENT_H_INCLUDED
@@ -20,11 +20,15 @@
 #include "pqp_environment.h"
 
 #include <vector>
+#include <string>
 #include <utility>
 #include <memory>
 #include <cmath>
+#include <algorithm>
+#include <random>
 
 #include "random_generator/naive_generator.h"
+#include <PQP/TriDist.h>
 #include <boost/test/unit_test.hpp>
 
 typedef Eigen::VectorXd EVectorXd;
@@ -102,4 +106,598 @@ BOOST_AUTO_TEST_CASE(knn_query) {
   {
     printf("%d\n", indices.at(i));
   }
-}
\ No newline at end of file
+}
+BOOST_AUTO_TEST_CASE(make_bubbles) {
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(0, 2 * M_PI);
+  limits.emplace_back(0, 2 * M_PI);
+  std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+    new NaiveGenerator(limits));
+  PqpEnvironment pqp ({"../models/two-seg/robot1_seg1.stl",
+      "../models/two-seg/robot1_seg2.stl"},
+      "../models/two-seg/dh_table_test.txt",
+      "../models/two-seg/obstacles_test.stl", generator.get(), 100);
+
+  std::vector<EVectorXd> coordinates;
+  for (int i = 0; i < 100; ++i)
+    coordinates.push_back(EVectorXd::Map(pqp.GetPoint(i), pqp.dimension()));
+
+  std::vector<std::shared_ptr<Bubble>> bubbles;
+  size_t created = pqp.MakeBubbles(coordinates, bubbles);
+  BOOST_CHECK_EQUAL(bubbles.size(), coordinates.size());
+
+  size_t expected_created = 0;
+  for (size_t i = 0; i < coordinates.size(); ++i) {
+    std::shared_ptr<Bubble> bubble;
+    bool success = pqp.MakeBubble(coordinates[i], bubble);
+    BOOST_CHECK_EQUAL(success, bubbles[i] != nullptr);
+    if (!success) continue;
+    ++expected_created;
+    BOOST_CHECK_CLOSE(bubble->distance(), bubbles[i]->distance(), 0.0001);
+    for (int k = 0; k < pqp.dimension(); ++k)
+      BOOST_CHECK_CLOSE(bubble->GetDimension(k), bubbles[i]->GetDimension(k),
+                        0.0001);
+  }
+  BOOST_CHECK_EQUAL(created, expected_created);
+}
+
+BOOST_AUTO_TEST_CASE(shared_scene) {
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(0, 2 * M_PI);
+  limits.emplace_back(0, 2 * M_PI);
+  std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+    new NaiveGenerator(limits));
+  std::shared_ptr<const PqpScene> scene (new PqpScene(
+      {"../models/two-seg/robot1_seg1.stl",
+      "../models/two-seg/robot1_seg2.stl"},
+      "../models/two-seg/dh_table_test.txt",
+      "../models/two-seg/obstacles_test.stl"));
+  PqpEnvironment first (scene, generator.get(), 100);
+  PqpEnvironment second (scene, generator.get(), 100);
+  BOOST_CHECK_EQUAL(first.dimension(), second.dimension());
+
+  const int points_num = 100;
+  std::vector<double> expected (points_num), result (points_num);
+  for (int i = 0; i < points_num; ++i) {
+    EVectorXd q (EVectorXd::Map(first.GetPoint(i), first.dimension()));
+    expected[i] = first.DistanceQuery(q);
+  }
+
+  #pragma omp parallel
+  {
+    std::unique_ptr<PqpQueryContext> context (second.NewQueryContext());
+    #pragma omp for
+    for (int i = 0; i < points_num; ++i)
+      result[i] = context->DistanceQuery(first.GetPoint(i));
+  }
+
+  for (int i = 0; i < points_num; ++i)
+    BOOST_CHECK_CLOSE(expected[i], result[i], 0.0001);
+  BOOST_CHECK_EQUAL(second.CollisionChecks(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(make_bubbles_arena) {
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(0, 2 * M_PI);
+  limits.emplace_back(0, 2 * M_PI);
+  std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+    new NaiveGenerator(limits));
+  PqpEnvironment pqp ({"../models/two-seg/robot1_seg1.stl",
+      "../models/two-seg/robot1_seg2.stl"},
+      "../models/two-seg/dh_table_test.txt",
+      "../models/two-seg/obstacles_test.stl", generator.get(), 100);
+
+  std::vector<EVectorXd> coordinates;
+  for (int i = 0; i < 100; ++i)
+    coordinates.push_back(EVectorXd::Map(pqp.GetPoint(i), pqp.dimension()));
+
+  BubbleArena<Eigen::Dynamic> arena (pqp.dimension());
+  int first;
+  pqp.MakeBubble(coordinates[0], arena, first);
+  std::vector<int> bubbles;
+  size_t created = pqp.MakeBubbles(coordinates, arena, bubbles);
+  BOOST_CHECK_EQUAL(bubbles.size(), coordinates.size());
+  BOOST_CHECK_EQUAL(arena.size(), created + (first != arena.kNull ? 1 : 0));
+
+  for (size_t i = 0; i < coordinates.size(); ++i) {
+    std::shared_ptr<Bubble> bubble;
+    bool success = pqp.MakeBubble(coordinates[i], bubble);
+    BOOST_CHECK_EQUAL(success, bubbles[i] != arena.kNull);
+    if (!success) continue;
+    BOOST_CHECK_EQUAL(arena.parent(bubbles[i]), arena.kNull);
+    BOOST_CHECK_CLOSE(bubble->distance(), arena.distance(bubbles[i]), 0.0001);
+    for (int k = 0; k < pqp.dimension(); ++k) {
+      BOOST_CHECK_EQUAL(coordinates[i][k], arena.coordinates(bubbles[i])[k]);
+      BOOST_CHECK_CLOSE(bubble->GetDimension(k),
+                        arena.dimensions(bubbles[i])[k], 0.0001);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(clearance_at_least) {
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(0, 2 * M_PI);
+  limits.emplace_back(0, 2 * M_PI);
+  std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+    new NaiveGenerator(limits));
+  PqpEnvironment pqp ({"../models/two-seg/robot1_seg1.stl",
+      "../models/two-seg/robot1_seg2.stl"},
+      "../models/two-seg/dh_table_test.txt",
+      "../models/two-seg/obstacles_test.stl", generator.get(), 100);
+
+  // Same answers as thresholding the distance, away from the threshold
+  for (double threshold : {0.01, 0.5, 2.0}) {
+    for (int i = 0; i < 100; ++i) {
+      double distance = pqp.DistanceQuery(pqp.GetPoint(i));
+      if (fabs(distance - threshold) < 1e-4) continue;
+      BOOST_CHECK_EQUAL(pqp.ClearanceAtLeast(pqp.GetPoint(i), threshold),
+                        distance >= threshold);
+    }
+  }
+}
+
+// Culling doesn't change any query result
+void CheckBroadPhase(PqpEnvironment& pqp, int points_num) {
+  std::unique_ptr<PqpQueryContext> culled (pqp.NewQueryContext()),
+    exact (pqp.NewQueryContext());
+  exact->set_broad_phase(false);
+  std::vector<double> culled_dimensions (pqp.dimension()),
+    exact_dimensions (pqp.dimension());
+  for (int i = 0; i < points_num; ++i) {
+    const double* q = pqp.GetPoint(i);
+    BOOST_CHECK_CLOSE(culled->DistanceQuery(q), exact->DistanceQuery(q),
+                      0.0001);
+    BOOST_CHECK_EQUAL(culled->CollisionQuery(q), exact->CollisionQuery(q));
+    BOOST_CHECK_EQUAL(culled->ClearanceAtLeast(q, 0.5),
+                      exact->ClearanceAtLeast(q, 0.5));
+    double culled_distance, exact_distance;
+    bool success = culled->MakeBubble(q, culled_distance,
+                                      culled_dimensions.data());
+    BOOST_CHECK_EQUAL(success, exact->MakeBubble(q, exact_distance,
+                                                 exact_dimensions.data()));
+    if (!success) continue;
+    BOOST_CHECK_CLOSE(culled_distance, exact_distance, 0.0001);
+    for (int k = 0; k < pqp.dimension(); ++k)
+      BOOST_CHECK_CLOSE(culled_dimensions[k], exact_dimensions[k], 0.0001);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(broad_phase) {
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(0, 2 * M_PI);
+  limits.emplace_back(0, 2 * M_PI);
+  std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+    new NaiveGenerator(limits));
+  PqpEnvironment pqp ({"../models/two-seg/robot1_seg1.stl",
+      "../models/two-seg/robot1_seg2.stl"},
+      "../models/two-seg/dh_table_test.txt",
+      "../models/two-seg/obstacles_test.stl", generator.get(), 100);
+  CheckBroadPhase(pqp, 100);
+}
+
+BOOST_AUTO_TEST_CASE(broad_phase_abb) {
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(-2.879793266, 2.879793266);
+  limits.emplace_back(-1.919862177, 1.919862177);
+  limits.emplace_back(-1.570796327, 1.221730476);
+  limits.emplace_back(-2.792526803, 2.792526803);
+  limits.emplace_back(-2.094395102, 2.094395102);
+  limits.emplace_back(-6.981317008, 6.981317008);
+  std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+    new NaiveGenerator(limits));
+  PqpEnvironment pqp ({"../models/abb-irb-120/1link.stl",
+      "../models/abb-irb-120/2link.stl", "../models/abb-irb-120/3link1.stl",
+      "../models/abb-irb-120/4link1.stl", "../models/abb-irb-120/5link.stl",
+      "../models/abb-irb-120/6link.stl"},
+      "../models/abb-irb-120/parameters.txt",
+      "../models/environment/obstacles_easy.stl", generator.get(), 200);
+  CheckBroadPhase(pqp, 200);
+}
+
+BOOST_AUTO_TEST_CASE(distance_upper_bound) {
+  PqpScene scene ({"../models/two-seg/robot1_seg1.stl",
+      "../models/two-seg/robot1_seg2.stl"},
+      "../models/two-seg/dh_table_test.txt",
+      "../models/two-seg/obstacles_test.stl");
+  PQP_REAL R[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}, T[3] = {0, 0, 0};
+
+  PQP_Model* obstacles = scene.obstacles()->obstacle(0).model.get();
+
+  PQP_DistanceResult exact;
+  PQP_Distance(&exact, R, T, scene.segment(0), R, T, obstacles, 0.0, 0.0);
+  BOOST_REQUIRE(exact.Distance() > 0.0);
+
+  // Loose bound gives the exact distance, tight one is reported back
+  for (double factor : {2.0, 0.5}) {
+    PQP_DistanceResult bounded;
+    bounded.upper_bound = factor * exact.Distance();
+    PQP_Distance(&bounded, R, T, scene.segment(0), R, T, obstacles, 0.0, 0.0);
+    BOOST_CHECK_CLOSE(bounded.Distance(),
+                      std::min(exact.Distance(), bounded.upper_bound), 0.0001);
+  }
+
+  // Repeated query is seeded with its own closest pair
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(0, 2 * M_PI);
+  limits.emplace_back(0, 2 * M_PI);
+  std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+    new NaiveGenerator(limits));
+  PqpEnvironment pqp ({"../models/two-seg/robot1_seg1.stl",
+      "../models/two-seg/robot1_seg2.stl"},
+      "../models/two-seg/dh_table_test.txt",
+      "../models/two-seg/obstacles_test.stl", generator.get(), 10);
+  std::unique_ptr<PqpQueryContext> context (pqp.NewQueryContext());
+  context->set_broad_phase(false);
+  for (int i = 0; i < 10; ++i) {
+    context->DistanceQuery(pqp.GetPoint(i));
+    const double rate = pqp.WarmStartHitRate();
+    const double distance = context->DistanceQuery(pqp.GetPoint(i));
+    if (distance > 0.0) BOOST_CHECK_GE(pqp.WarmStartHitRate(), rate);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(batch_tri_distance) {
+  // Batched distances agree with the pairwise ones, also for overlapping,
+  // coplanar and degenerate triangles
+  std::mt19937 random (42);
+  std::uniform_real_distribution<float> coordinate (-1.0f, 1.0f);
+  for (int i = 0; i < 2000; ++i) {
+    PQP_REAL s[3][3], t[8][3][3];
+    for (int v = 0; v < 3; ++v)
+      for (int d = 0; d < 3; ++d) s[v][d] = coordinate(random);
+    const int n = 1 + i % 8;
+    for (int k = 0; k < n; ++k)
+      for (int v = 0; v < 3; ++v)
+        for (int d = 0; d < 3; ++d)
+          t[k][v][d] = coordinate(random) * (i % 3 ? 1.0f : 0.3f) +
+              (i % 5 ? 0.0f : 1.5f);
+    if (i % 7 == 0)
+      for (int d = 0; d < 3; ++d) t[0][1][d] = t[0][0][d];
+    if (i % 11 == 0)
+      for (int v = 0; v < 3; ++v) s[v][2] = t[0][v][2] = 0.2f;
+
+    PQP_REAL p[3], q[3], expected = INFINITY;
+    for (int k = 0; k < n; ++k)
+      expected = std::min(expected, TriDist(p, q, s, t[k]));
+    PQP_REAL distance;
+    const int closest = TriDistBatch(&distance, p, q, s, t, n);
+    BOOST_REQUIRE(closest >= 0 && closest < n);
+    BOOST_CHECK_SMALL(distance - expected, 1e-4f);
+    BOOST_CHECK_SMALL(std::sqrt((p[0] - q[0]) * (p[0] - q[0]) +
+        (p[1] - q[1]) * (p[1] - q[1]) + (p[2] - q[2]) * (p[2] - q[2])) -
+        distance, 1e-4f);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(lanes_bv_overlap) {
+  // Lanes give the same answers as the pair by pair overlap test
+  std::mt19937 random (7);
+  std::uniform_real_distribution<float> coordinate (-1.0f, 1.0f);
+  for (int i = 0; i < 2000; ++i) {
+    const int n = 1 + i % PQP_LANES;
+    PQP_REAL R[PQP_LANES][3][3], T[PQP_LANES][3];
+    BV bvs1[PQP_LANES], bvs2[PQP_LANES];
+    OBB obbs1[PQP_LANES], obbs2[PQP_LANES];
+    BV *b1[PQP_LANES], *b2[PQP_LANES];
+    OBB *o1[PQP_LANES], *o2[PQP_LANES];
+    int expected = 0;
+    for (int k = 0; k < n; ++k) {
+      Eigen::Quaternionf q (coordinate(random), coordinate(random),
+                            coordinate(random), coordinate(random));
+      const Eigen::Matrix3f rotation = q.normalized().toRotationMatrix();
+      for (int row = 0; row < 3; ++row) {
+        for (int col = 0; col < 3; ++col) R[k][row][col] = rotation(row, col);
+        T[k][row] = 2.0f * coordinate(random);
+        obbs1[k].d[row] = std::fabs(coordinate(random));
+        obbs2[k].d[row] = std::fabs(coordinate(random));
+      }
+      b1[k] = &bvs1[k];
+      b2[k] = &bvs2[k];
+      o1[k] = &obbs1[k];
+      o2[k] = &obbs2[k];
+      if (BV_Overlap(R[k], T[k], b1[k], o1[k], b2[k], o2[k]))
+        expected |= 1 << k;
+    }
+    BOOST_CHECK_EQUAL(BV_OverlapLanes(R, T, b1, o1, b2, o2, n), expected);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(self_collision) {
+  const std::vector<std::string> segments {"../models/abb-irb-120/1link.stl",
+      "../models/abb-irb-120/2link.stl", "../models/abb-irb-120/3link1.stl",
+      "../models/abb-irb-120/4link1.stl", "../models/abb-irb-120/5link.stl",
+      "../models/abb-irb-120/6link.stl"};
+  std::shared_ptr<const PqpScene> plain (new PqpScene(segments,
+      "../models/abb-irb-120/parameters.txt",
+      "../models/environment/obstacles_trivial.stl"));
+  BOOST_CHECK_THROW(PqpScene(segments,
+      "../models/abb-irb-120/parameters.txt",
+      "../models/environment/obstacles_trivial.stl", "", PQP_SPLIT_MEAN,
+      PQP_BV_TYPE, {{1, 1}}), const char*);
+  std::shared_ptr<const PqpScene> scene (new PqpScene(segments,
+      "../models/abb-irb-120/parameters.txt",
+      "../models/environment/obstacles_trivial.stl", "", PQP_SPLIT_MEAN,
+      PQP_BV_TYPE, PqpScene::NonAdjacentPairs(6, 2)));
+  BOOST_CHECK_EQUAL(scene->self_collision_pairs().size(), 6u);
+
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(-2.879793266, 2.879793266);
+  limits.emplace_back(-1.919862177, 1.919862177);
+  limits.emplace_back(-1.570796327, 1.221730476);
+  limits.emplace_back(-2.792526803, 2.792526803);
+  limits.emplace_back(-2.094395102, 2.094395102);
+  limits.emplace_back(-6.981317008, 6.981317008);
+  std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+    new NaiveGenerator(limits));
+  PqpEnvironment pqp (scene, generator.get(), 500);
+  PqpQueryContext without (plain);
+
+  EVectorXd zero (EVectorXd::Zero(6));
+  BOOST_CHECK_EQUAL(pqp.CollisionQuery(zero), true);
+  CheckBroadPhase(pqp, 500);
+
+  // Self-collisions only add to obstacle collisions
+  int self_collisions = 0;
+  for (int i = 0; i < 500; ++i) {
+    const double* q = pqp.GetPoint(i);
+    const bool free = pqp.CollisionQuery(q);
+    if (!without.CollisionQuery(q)) {
+      BOOST_CHECK_EQUAL(free, false);
+    } else if (!free) {
+      ++self_collisions;
+    }
+    BOOST_CHECK_LE(pqp.DistanceQuery(q), without.DistanceQuery(q));
+  }
+  BOOST_CHECK_GT(self_collisions, 0);
+}
+
+BOOST_AUTO_TEST_CASE(obstacle_updates) {
+  std::shared_ptr<PqpScene> scene (new PqpScene(
+      {"../models/abb-irb-120/1link.stl", "../models/abb-irb-120/2link.stl",
+      "../models/abb-irb-120/3link1.stl", "../models/abb-irb-120/4link1.stl",
+      "../models/abb-irb-120/5link.stl", "../models/abb-irb-120/6link.stl"},
+      "../models/abb-irb-120/parameters.txt",
+      "../models/environment/obstacles_easy.stl"));
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(-2.879793266, 2.879793266);
+  limits.emplace_back(-1.919862177, 1.919862177);
+  limits.emplace_back(-1.570796327, 1.221730476);
+  limits.emplace_back(-2.792526803, 2.792526803);
+  limits.emplace_back(-2.094395102, 2.094395102);
+  limits.emplace_back(-6.981317008, 6.981317008);
+  std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+    new NaiveGenerator(limits));
+  const int points_num = 200;
+  PqpEnvironment pqp (scene, generator.get(), points_num);
+  std::unique_ptr<PqpQueryContext> context (pqp.NewQueryContext());
+  std::vector<double> expected (points_num);
+  std::vector<bool> expected_free (points_num);
+  for (int i = 0; i < points_num; ++i) {
+    expected[i] = context->DistanceQuery(pqp.GetPoint(i));
+    expected_free[i] = context->CollisionQuery(pqp.GetPoint(i));
+  }
+
+  // Copy of the obstacles in place keeps the queries wherever the original
+  // is moved
+  const std::shared_ptr<const ObstacleSet> original = scene->obstacles();
+  const int id = scene->AddObstacle(original->obstacle(0).model,
+      EMatrix::Identity(), PqpScene::EVector3f::Zero());
+  BOOST_CHECK_EQUAL(id, 1);
+  scene->MoveObstacle(0, EMatrix::Identity(),
+                      PqpScene::EVector3f(0, 0, 1e5));
+  for (int i = 0; i < points_num; ++i) {
+    BOOST_CHECK_CLOSE(context->DistanceQuery(pqp.GetPoint(i)) + 1.0,
+                      expected[i] + 1.0, 0.0001);
+    BOOST_CHECK_EQUAL(context->CollisionQuery(pqp.GetPoint(i)),
+                      expected_free[i]);
+  }
+
+  // Only the moved original is left, far away
+  scene->RemoveObstacle(id);
+  for (int i = 0; i < points_num; ++i) {
+    BOOST_CHECK_GE(context->DistanceQuery(pqp.GetPoint(i)), expected[i]);
+    BOOST_CHECK_EQUAL(context->CollisionQuery(pqp.GetPoint(i)), true);
+  }
+  BOOST_CHECK_THROW(scene->RemoveObstacle(id), const char*);
+
+  // Sets taken before the updates are unchanged
+  BOOST_CHECK_EQUAL(original->size(), 1);
+  BOOST_CHECK_EQUAL(original->obstacle(0).translation,
+                    PqpScene::EVector3f::Zero());
+  BOOST_CHECK_EQUAL(scene->obstacles()->size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(capsule_distance) {
+  typedef PqpScene::EVector3f EVector3f;
+  // Segment over, crossing and beside the triangle
+  EVector3f a (0, 0, 0), b (1, 0, 0), c (0, 1, 0);
+  BOOST_CHECK_CLOSE(ObstacleSet::SegmentTriangleDistance(EVector3f(0.2, 0.2, 1),
+      EVector3f(0.2, 0.2, 2), a, b, c), 1.0, 0.0001);
+  BOOST_CHECK_EQUAL(ObstacleSet::SegmentTriangleDistance(EVector3f(0.2, 0.2, -1),
+      EVector3f(0.2, 0.2, 1), a, b, c), 0.0);
+  BOOST_CHECK_CLOSE(ObstacleSet::SegmentTriangleDistance(EVector3f(-1, -2, 0),
+      EVector3f(1, -2, 0), a, b, c), 2.0, 0.0001);
+
+  // Traversal matches brute force over the obstacle triangles
+  PqpScene scene ({"../models/abb-irb-120/1link.stl",
+      "../models/abb-irb-120/2link.stl", "../models/abb-irb-120/3link1.stl",
+      "../models/abb-irb-120/4link1.stl", "../models/abb-irb-120/5link.stl",
+      "../models/abb-irb-120/6link.stl"},
+      "../models/abb-irb-120/parameters.txt",
+      "../models/environment/obstacles_easy.stl");
+  // Obstacle boxes come from the RSSs without OBBs
+  PqpScene rss_scene ({"../models/abb-irb-120/1link.stl"},
+      "../models/abb-irb-120/parameters.txt",
+      "../models/environment/obstacles_easy.stl", "", PQP_SPLIT_MEAN,
+      RSS_TYPE);
+  PQP_Model* obstacles = scene.obstacles()->obstacle(0).model.get();
+  for (int i = 0; i < 20; ++i) {
+    EVector3f begin (EVector3f::Random() * 600), end (EVector3f::Random() * 600);
+    double expected = INFINITY;
+    for (int k = 0; k < obstacles->num_tris; ++k) {
+      const Tri& tri = obstacles->tris[k];
+      expected = std::min(expected, ObstacleSet::SegmentTriangleDistance(begin,
+          end, EVector3f(tri.p1[0], tri.p1[1], tri.p1[2]),
+          EVector3f(tri.p2[0], tri.p2[1], tri.p2[2]),
+          EVector3f(tri.p3[0], tri.p3[1], tri.p3[2])));
+    }
+    BOOST_CHECK_CLOSE(scene.CapsuleDistance(begin, end, 0.0, INFINITY) + 1.0,
+                      expected + 1.0, 0.0001);
+    BOOST_CHECK_GE(scene.CapsuleDistance(begin, end, 0.0, expected / 2),
+                   expected / 2);
+    BOOST_CHECK_CLOSE(rss_scene.CapsuleDistance(begin, end, 0.0, INFINITY) +
+                      1.0, expected + 1.0, 0.0001);
+    BOOST_CHECK_LE(rss_scene.CapsuleDistanceLowerBound(begin, end, 0.0),
+                   expected);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(capsule_bubbles) {
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(-2.879793266, 2.879793266);
+  limits.emplace_back(-1.919862177, 1.919862177);
+  limits.emplace_back(-1.570796327, 1.221730476);
+  limits.emplace_back(-2.792526803, 2.792526803);
+  limits.emplace_back(-2.094395102, 2.094395102);
+  limits.emplace_back(-6.981317008, 6.981317008);
+  std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+    new NaiveGenerator(limits));
+  PqpEnvironment pqp ({"../models/abb-irb-120/1link.stl",
+      "../models/abb-irb-120/2link.stl", "../models/abb-irb-120/3link1.stl",
+      "../models/abb-irb-120/4link1.stl", "../models/abb-irb-120/5link.stl",
+      "../models/abb-irb-120/6link.stl"},
+      "../models/abb-irb-120/parameters.txt",
+      "../models/environment/obstacles_easy.stl", generator.get(), 200);
+  std::unique_ptr<PqpQueryContext> exact (pqp.NewQueryContext());
+  pqp.set_capsule_bubbles(true);
+  std::unique_ptr<PqpQueryContext> capsule (pqp.NewQueryContext());
+
+  // Capsule bubbles fit inside the exact ones
+  std::vector<double> exact_dimensions (6), capsule_dimensions (6);
+  for (int i = 0; i < 200; ++i) {
+    double exact_distance, capsule_distance;
+    const bool success = exact->MakeBubble(pqp.GetPoint(i), exact_distance,
+                                           exact_dimensions.data());
+    BOOST_CHECK_EQUAL(capsule->MakeBubble(pqp.GetPoint(i), capsule_distance,
+                                          capsule_dimensions.data()),
+                      success);
+    if (!success) continue;
+    BOOST_CHECK_LE(capsule_distance, exact_distance * (1 + 1e-6));
+    for (int k = 0; k < 6; ++k)
+      BOOST_CHECK_LE(capsule_dimensions[k],
+                     exact_dimensions[k] * (1 + 1e-6));
+  }
+  BOOST_CHECK_GT(pqp.CapsuleDistances(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(field_bubbles) {
+  std::shared_ptr<PqpScene> scene (new PqpScene(
+      {"../models/abb-irb-120/1link.stl", "../models/abb-irb-120/2link.stl",
+      "../models/abb-irb-120/3link1.stl", "../models/abb-irb-120/4link1.stl",
+      "../models/abb-irb-120/5link.stl", "../models/abb-irb-120/6link.stl"},
+      "../models/abb-irb-120/parameters.txt",
+      "../models/environment/obstacles_easy.stl"));
+  scene->BuildDistanceField(20.0, 100.0);
+  BOOST_REQUIRE(scene->distance_field() != nullptr);
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(-2.879793266, 2.879793266);
+  limits.emplace_back(-1.919862177, 1.919862177);
+  limits.emplace_back(-1.570796327, 1.221730476);
+  limits.emplace_back(-2.792526803, 2.792526803);
+  limits.emplace_back(-2.094395102, 2.094395102);
+  limits.emplace_back(-6.981317008, 6.981317008);
+  std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+    new NaiveGenerator(limits));
+  PqpEnvironment pqp (scene, generator.get(), 200);
+  std::unique_ptr<PqpQueryContext> exact (pqp.NewQueryContext());
+  pqp.set_field_bubbles(true);
+  std::unique_ptr<PqpQueryContext> field (pqp.NewQueryContext());
+
+  // Field bubbles fit inside the exact ones
+  std::vector<double> exact_dimensions (6), field_dimensions (6);
+  for (int i = 0; i < 200; ++i) {
+    double exact_distance, field_distance;
+    const bool success = exact->MakeBubble(pqp.GetPoint(i), exact_distance,
+                                           exact_dimensions.data());
+    BOOST_CHECK_EQUAL(field->MakeBubble(pqp.GetPoint(i), field_distance,
+                                        field_dimensions.data()),
+                      success);
+    if (!success) continue;
+    BOOST_CHECK_LE(field_distance, exact_distance * (1 + 1e-6));
+    for (int k = 0; k < 6; ++k)
+      BOOST_CHECK_LE(field_dimensions[k], exact_dimensions[k] * (1 + 1e-6));
+  }
+  BOOST_CHECK_GT(pqp.FieldDistances(), 0u);
+
+  // Moved obstacles drop the field, bubbles are exact again
+  scene->MoveObstacle(0, EMatrix::Identity(), 
+                      PqpScene::EVector3f(0, 0, 10));
+  BOOST_CHECK(scene->distance_field() == nullptr);
+  const size_t field_distances = pqp.FieldDistances();
+  for (int i = 0; i < 20; ++i) {
+    double exact_distance, field_distance;
+    if (!exact->MakeBubble(pqp.GetPoint(i), exact_distance,
+                           exact_dimensions.data()))
+      continue;
+    BOOST_CHECK(field->MakeBubble(pqp.GetPoint(i), field_distance,
+                                  field_dimensions.data()));
+    BOOST_CHECK_EQUAL(field_distance, exact_distance);
+  }
+  BOOST_CHECK_EQUAL(pqp.FieldDistances(), field_distances);
+}
+
+BOOST_AUTO_TEST_CASE(joint_reaches) {
+  std::shared_ptr<PqpScene> scene (new PqpScene(
+      {"../models/abb-irb-120/1link.stl", "../models/abb-irb-120/2link.stl",
+      "../models/abb-irb-120/3link1.stl", "../models/abb-irb-120/4link1.stl",
+      "../models/abb-irb-120/5link.stl", "../models/abb-irb-120/6link.stl"},
+      "../models/abb-irb-120/parameters.txt",
+      "../models/environment/obstacles_easy.stl"));
+  const std::vector<double> reaches = scene->JointReaches();
+  BOOST_REQUIRE_EQUAL(reaches.size(), scene->dimension());
+  for (size_t i = 1; i < reaches.size(); ++i)
+    BOOST_CHECK_LE(reaches[i], reaches[i - 1]);
+
+  // Turning a joint moves the segments after it no further than its reach
+  // times the angle
+  std::mt19937 random_engine (1);
+  std::uniform_real_distribution<double> angle (-M_PI, M_PI);
+  ForwardKinematics kinematics (scene->dh_table()),
+                    turned_kinematics (scene->dh_table());
+  for (int configuration = 0; configuration < 50; ++configuration) {
+    std::vector<double> q (scene->dimension());
+    for (auto& x : q) x = angle(random_engine);
+    kinematics.Compute(q.data());
+    for (size_t i = 0; i < scene->dimension(); ++i) {
+      std::vector<double> turned (q);
+      const double turn = angle(random_engine);
+      turned[i] += turn;
+      turned_kinematics.Compute(turned.data());
+      for (size_t k = i; k < scene->dimension(); ++k) {
+        for (const auto& sphere : scene->spheres(k)) {
+          const EVector point = kinematics.rotation(k) * sphere.center +
+                                kinematics.translation(k),
+                        turned_point =
+                            turned_kinematics.rotation(k) * sphere.center +
+                            turned_kinematics.translation(k);
+          BOOST_CHECK_LE((turned_point - point).norm(),
+                         reaches[i] * std::fabs(turn) * (1 + 1e-4) + 1e-3);
+        }
+      }
+    }
+  }
+
+  // Knn queries are nearest first in the metric of the reaches
+  std::vector<std::pair<double, double>> limits (6, {-M_PI, M_PI});
+  std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+    new NaiveGenerator(limits));
+  PqpEnvironment pqp (scene, generator.get(), 1000);
+  pqp.set_metric(JointMetric(reaches));
+  const std::vector<int> neighbours = pqp.KnnQuery(pqp.GetPoint(0), 10);
+  BOOST_REQUIRE_EQUAL(neighbours.size(), 10u);
+  BOOST_CHECK_EQUAL(neighbours[0], 0);
+  for (size_t i = 1; i < neighbours.size(); ++i)
+    BOOST_CHECK_LE(
+        pqp.metric().Distance(pqp.GetPoint(0), pqp.GetPoint(neighbours[i - 1])),
+        pqp.metric().Distance(pqp.GetPoint(0), pqp.GetPoint(neighbours[i])));
+}
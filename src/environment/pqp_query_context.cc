@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include "pqp_query_context.h"
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <numeric>
+
+PqpQueryContext::PqpQueryContext(const std::shared_ptr<const PqpScene>& scene,
+    const std::shared_ptr<PqpQueryCounters>& counters)
+    : scene_(scene),
+      counters_(counters != nullptr ? counters :
+                std::make_shared<PqpQueryCounters>()),
+      distance_res_(scene->dimension()),
+      // DH table may describe more joints than there are segments
+      kinematics_(std::vector<DhParameter>(scene->dh_table().begin(),
+          scene->dh_table().begin() + scene->dimension())),
+      broad_phase_(true), capsule_bubbles_(false), field_bubbles_(false),
+      min_capsule_distance_(0.0), min_field_distance_(0.0),
+      endpoints_(scene->dimension()),
+      lower_bounds_(scene->dimension(), 0.0),
+      segment_order_(scene->dimension()),
+      self_distance_res_(scene->self_collision_pairs().size()) {
+  // Warm start is kept here, so that the shared models are only read
+  for (size_t k = 0; k < self_distance_res_.size(); ++k) {
+    const auto& pair = scene_->self_collision_pairs()[k];
+    self_distance_res_[k].last_tri1 = scene_->segment(pair.first)->last_tri;
+    self_distance_res_[k].last_tri2 = scene_->segment(pair.second)->last_tri;
+  }
+}
+
+void PqpQueryContext::BroadPhase() {
+  obstacles_ = scene_->obstacles();
+  distance_field_ = scene_->distance_field();
+  if (distance_field_ && distance_field_->obstacles() != obstacles_)
+    distance_field_.reset();  // Obstacles were updated since
+  for (size_t i = 0; i < scene_->dimension(); ++i) {
+    const auto& capsule = scene_->capsule(i);
+    endpoints_[i] = kinematics_.translation(i) +
+        kinematics_.rotation(i) * capsule.first;
+    lower_bounds_[i] = broad_phase_ ? obstacles_->CapsuleDistanceLowerBound(
+        kinematics_.translation(i), endpoints_[i], capsule.second) : 0.0;
+  }
+  std::iota(segment_order_.begin(), segment_order_.end(), 0);
+  std::stable_sort(segment_order_.begin(), segment_order_.end(),
+      [this](size_t i, size_t j) {
+        return lower_bounds_[i] < lower_bounds_[j];
+      });
+}
+
+double PqpQueryContext::SearchRadius(size_t i) const {
+  return broad_phase_ ? scene_->capsule(i).second * (1.0 + kCapsuleMargin) :
+                        INFINITY;
+}
+
+PQP_DistanceResult& PqpQueryContext::ObstacleDistance(size_t i, int id) {
+  if (distance_res_[i].size() <= static_cast<size_t>(id))
+    distance_res_[i].resize(id + 1);
+  WarmStart& warm_start = distance_res_[i][id];
+  const std::shared_ptr<PQP_Model>& model = obstacles_->obstacle(id).model;
+  if (warm_start.model != model) {
+    warm_start.model = model;
+    warm_start.result.last_tri1 = scene_->segment(i)->last_tri;
+    warm_start.result.last_tri2 = model->last_tri;
+  }
+  return warm_start.result;
+}
+
+double PqpQueryContext::SegmentDistance(size_t i, double upper_bound) {
+  EMatrix R = kinematics_.rotation(i);
+  EVector3f T = kinematics_.translation(i);
+  // Nearer obstacles first, each bounded by the distance so far
+  double distance = upper_bound, limit = distance + SearchRadius(i);
+  obstacles_->Traverse(T, endpoints_[i], &limit, [&](int id) {
+    const ObstacleSet::Obstacle& obstacle = obstacles_->obstacle(id);
+    EMatrix R_obstacle = obstacle.rotation;
+    EVector3f T_obstacle = obstacle.translation;
+    distance = std::min(distance, BoundedDistance(ObstacleDistance(i, id),
+        R, T, scene_->segment(i), R_obstacle, T_obstacle,
+        obstacle.model.get(), distance));
+    limit = distance + SearchRadius(i);
+    return distance >= kMinDistanceToObstacles;
+  });
+  return distance;
+}
+
+double PqpQueryContext::BoundedDistance(PQP_DistanceResult& distance_res,
+    EMatrix& R1, EVector3f& T1, PQP_Model* model1,
+    EMatrix& R2, EVector3f& T2, PQP_Model* model2, double upper_bound) {
+  const Tri *last_tri1 = distance_res.last_tri1,
+            *last_tri2 = distance_res.last_tri2;
+  const PQP_REAL bound = std::isfinite(upper_bound) ? upper_bound : -1.0;
+  distance_res.upper_bound = bound;
+  if (PQP_Distance(&distance_res,
+      reinterpret_cast<PQP_REAL(*)[3]>(R1.data()), T1.data(), model1,
+      reinterpret_cast<PQP_REAL(*)[3]>(R2.data()), T2.data(), model2,
+      0.0, 0.0) != PQP_OK)
+    throw "PQP query problem!";
+  counters_->distance_bv_tests += distance_res.NumBVTests();
+  counters_->distance_tri_tests += distance_res.NumTriTests();
+
+  if (bound > 0.0 && distance_res.Distance() >= bound) {
+    ++counters_->bounded_distances;
+    return upper_bound;
+  }
+  if (distance_res.last_tri1 == last_tri1 &&
+      distance_res.last_tri2 == last_tri2)
+    ++counters_->warm_start_hits;
+  else
+    ++counters_->warm_start_misses;
+  return distance_res.Distance();
+}
+
+double PqpQueryContext::PairLowerBound(size_t pair) const {
+  if (!broad_phase_) return 0.0;
+  const size_t i = scene_->self_collision_pairs()[pair].first,
+               j = scene_->self_collision_pairs()[pair].second;
+  const double radii = (scene_->capsule(i).second +
+      scene_->capsule(j).second) * (1.0 + kCapsuleMargin);
+  return std::max(ObstacleSet::SegmentsDistance(kinematics_.translation(i),
+      endpoints_[i], kinematics_.translation(j), endpoints_[j]) - radii, 0.0);
+}
+
+bool PqpQueryContext::SelfDistance(double& distance) {
+  const auto& pairs = scene_->self_collision_pairs();
+  for (size_t k = 0; k < pairs.size(); ++k) {
+    if (PairLowerBound(k) >= distance) {
+      ++counters_->culled_segments;
+      continue;
+    }
+    EMatrix R1 = kinematics_.rotation(pairs[k].first),
+            R2 = kinematics_.rotation(pairs[k].second);
+    EVector3f T1 = kinematics_.translation(pairs[k].first),
+              T2 = kinematics_.translation(pairs[k].second);
+    const double pair_distance = BoundedDistance(self_distance_res_[k],
+        R1, T1, scene_->segment(pairs[k].first),
+        R2, T2, scene_->segment(pairs[k].second), distance);
+    if (pair_distance < kMinDistanceToObstacles)
+      return false;  // Too close to itself
+    distance = std::min(distance, pair_distance);
+  }
+  return true;
+}
+
+bool PqpQueryContext::SelfClearanceAtLeast(double tolerance) {
+  const auto& pairs = scene_->self_collision_pairs();
+  PQP_ToleranceResult tolerance_res;
+  for (size_t k = 0; k < pairs.size(); ++k) {
+    if (PairLowerBound(k) > tolerance) {
+      ++counters_->culled_segments;
+      continue;
+    }
+    EMatrix R1 = kinematics_.rotation(pairs[k].first),
+            R2 = kinematics_.rotation(pairs[k].second);
+    EVector3f T1 = kinematics_.translation(pairs[k].first),
+              T2 = kinematics_.translation(pairs[k].second);
+    if (PQP_Tolerance(&tolerance_res,
+      reinterpret_cast<PQP_REAL(*)[3]>(R1.data()), T1.data(),
+      scene_->segment(pairs[k].first),
+      reinterpret_cast<PQP_REAL(*)[3]>(R2.data()), T2.data(),
+      scene_->segment(pairs[k].second), tolerance) != PQP_OK)
+      throw "PQP query problem!";
+    if (tolerance_res.CloserThanTolerance())
+      return false;
+  }
+  return true;
+}
+
+bool PqpQueryContext::SelfCollisionFree() {
+  const auto& pairs = scene_->self_collision_pairs();
+  PQP_CollideResult collision_res;
+  for (size_t k = 0; k < pairs.size(); ++k) {
+    if (PairLowerBound(k) > 0.0) {
+      ++counters_->culled_segments;
+      continue;
+    }
+    EMatrix R1 = kinematics_.rotation(pairs[k].first),
+            R2 = kinematics_.rotation(pairs[k].second);
+    EVector3f T1 = kinematics_.translation(pairs[k].first),
+              T2 = kinematics_.translation(pairs[k].second);
+    if (PQP_Collide(&collision_res,
+      reinterpret_cast<PQP_REAL(*)[3]>(R1.data()), T1.data(),
+      scene_->segment(pairs[k].first),
+      reinterpret_cast<PQP_REAL(*)[3]>(R2.data()), T2.data(),
+      scene_->segment(pairs[k].second), PQP_FIRST_CONTACT) != PQP_OK)
+      throw "PQP query problem!";
+    if (collision_res.NumPairs())
+      return false;  // Self-collision
+  }
+  return true;
+}
+
+bool PqpQueryContext::MakeBubble(const double* coordinates, double& distance,
+    double* dimensions) {
+  ++counters_->bubbles;
+  kinematics_.Compute(coordinates);
+  BroadPhase();
+
+  const size_t dimension = scene_->dimension();
+  distance = INFINITY;
+
+  // Finding minimal distance to obstacles, segments bounded further than it
+  // can't change it
+  for (size_t k = 0; k < dimension; ++k) {
+    const size_t i = segment_order_[k];
+    if (lower_bounds_[i] >= distance) {
+      counters_->culled_segments += dimension - k;
+      break;
+    }
+    double segment_distance;
+    if (field_bubbles_ && distance_field_) {
+      segment_distance = distance_field_->DistanceLowerBound(
+          scene_->spheres(i), kinematics_.rotation(i),
+          kinematics_.translation(i));
+      if (segment_distance < distance && segment_distance <
+          std::max(min_field_distance_, kMinDistanceToObstacles)) {
+        // Field bound too small to be useful
+        ++counters_->field_fallbacks;
+        segment_distance = SegmentDistance(i, distance);
+      } else {
+        ++counters_->field_distances;
+      }
+    } else if (capsule_bubbles_) {
+      segment_distance = obstacles_->CapsuleDistance(kinematics_.translation(i),
+          endpoints_[i], scene_->capsule(i).second * (1.0 + kCapsuleMargin),
+          distance);
+      if (segment_distance < distance && segment_distance <
+          std::max(min_capsule_distance_, kMinDistanceToObstacles)) {
+        // Capsule bound too small to be useful
+        ++counters_->capsule_fallbacks;
+        segment_distance = SegmentDistance(i, distance);
+      } else {
+        ++counters_->capsule_distances;
+      }
+    } else {
+      segment_distance = SegmentDistance(i, distance);
+    }
+    if (segment_distance < kMinDistanceToObstacles)
+      return false;  // Too close to obstacle
+    distance = std::min(distance, segment_distance);
+  }
+  // Relative motion of two segments is bounded alike, so the closest pair
+  // limits the bubble as an obstacle would
+  if (!SelfDistance(distance))
+    return false;
+
+  // Update bubble dimensions - joint i moves capsules i and onwards, each
+  // covered by its furthest endpoint from the joint axis
+  for (size_t i = 0; i < dimension; ++i) {
+    double axis_distance = 0.0, prev_radius = 0.0;
+    for (size_t k = i; k < dimension; ++k) {
+      const EVector3f endpoint (kinematics_.ToBase(i, endpoints_[k]));
+      const double radius = sqrt(endpoint(0) * endpoint(0) +
+                                 endpoint(1) * endpoint(1));
+      if (!std::isfinite(radius)) continue;  // Degenerate capsule
+
+      axis_distance = std::max(axis_distance, scene_->capsule(k).second +
+                               std::max(radius, prev_radius));
+      prev_radius = radius;
+    }
+    dimensions[i] = axis_distance > 0.0 ? distance / axis_distance : INFINITY;
+  }
+  return true;
+}
+
+double PqpQueryContext::DistanceQuery(const double* q) {
+  double min_distance = INFINITY;  // Initialized at infinity
+  kinematics_.Compute(q);
+  BroadPhase();
+
+  const size_t dimension = scene_->dimension();
+  for (size_t k = 0; k < dimension; ++k) {
+    const size_t i = segment_order_[k];
+    if (lower_bounds_[i] >= min_distance) {
+      counters_->culled_segments += dimension - k;
+      break;
+    }
+    const double segment_distance = SegmentDistance(i, min_distance);
+    if (segment_distance < kMinDistanceToObstacles)
+      return 0;  // Too close to obstacle, return 0
+    min_distance = std::min(min_distance, segment_distance);
+  }
+  if (!SelfDistance(min_distance))
+    return 0;  // Too close to itself, return 0
+
+  return min_distance;
+}
+
+bool PqpQueryContext::ClearanceAtLeast(const double* q, double threshold) {
+  if (threshold <= 0.0) return true;
+  // Tolerance traversal stops at the first pair closer than tolerance
+  PQP_ToleranceResult tolerance_res;
+  const double tolerance = std::max(threshold, kMinDistanceToObstacles);
+  kinematics_.Compute(q);
+  BroadPhase();
+
+  const size_t dimension = scene_->dimension();
+  for (size_t k = 0; k < dimension; ++k) {
+    const size_t i = segment_order_[k];
+    if (lower_bounds_[i] > tolerance) {
+      counters_->culled_segments += dimension - k;
+      break;
+    }
+    EMatrix R = kinematics_.rotation(i);
+    EVector3f T = kinematics_.translation(i);
+    bool clear = true;
+    double limit = tolerance + SearchRadius(i);
+    obstacles_->Traverse(T, endpoints_[i], &limit, [&](int id) {
+      const ObstacleSet::Obstacle& obstacle = obstacles_->obstacle(id);
+      EMatrix R_obstacle = obstacle.rotation;
+      EVector3f T_obstacle = obstacle.translation;
+      if (PQP_Tolerance(&tolerance_res,
+        reinterpret_cast<PQP_REAL(*)[3]>(R.data()), T.data(),
+        scene_->segment(i),
+        reinterpret_cast<PQP_REAL(*)[3]>(R_obstacle.data()),
+        T_obstacle.data(), obstacle.model.get(), tolerance) != PQP_OK)
+        throw "PQP query problem!";
+      clear = !tolerance_res.CloserThanTolerance();
+      return clear;
+    });
+    if (!clear)
+      return false;
+  }
+
+  return SelfClearanceAtLeast(tolerance);
+}
+
+bool PqpQueryContext::CollisionQuery(const double* q) {
+  ++counters_->collision_checks;
+  PQP_CollideResult collision_res;
+  kinematics_.Compute(q);
+  BroadPhase();
+
+  const size_t dimension = scene_->dimension();
+  for (size_t k = 0; k < dimension; ++k) {
+    const size_t i = segment_order_[k];
+    if (lower_bounds_[i] > 0.0) {
+      counters_->culled_segments += dimension - k;
+      break;
+    }
+    EMatrix R = kinematics_.rotation(i);
+    EVector3f T = kinematics_.translation(i);
+    bool collision_free = true;
+    double limit = SearchRadius(i);
+    obstacles_->Traverse(T, endpoints_[i], &limit, [&](int id) {
+      const ObstacleSet::Obstacle& obstacle = obstacles_->obstacle(id);
+      EMatrix R_obstacle = obstacle.rotation;
+      EVector3f T_obstacle = obstacle.translation;
+      if (PQP_Collide(&collision_res,
+        reinterpret_cast<PQP_REAL(*)[3]>(R.data()), T.data(),
+        scene_->segment(i),
+        reinterpret_cast<PQP_REAL(*)[3]>(R_obstacle.data()),
+        T_obstacle.data(), obstacle.model.get(), PQP_FIRST_CONTACT) != PQP_OK)
+        throw "PQP query problem!";
+      collision_free = !collision_res.NumPairs();
+      return collision_free;
+    });
+    if (!collision_free)
+      return false;  // Collision
+  }
+
+  return SelfCollisionFree();
+}
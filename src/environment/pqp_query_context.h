@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef PQP_QUERY_CONTEXT_H_INCLUDED
+#define PQP_QUERY_CONTEXT_H_INCLUDED
+
+#include <cmath>
+#include <PQP/PQP.h>
+#include <Eigen/Dense>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include "../bubble.h"
+#include "../bubble_arena.h"
+
+#include "pqp_scene.h"
+
+// Query statistics, shared by all contexts of an environment
+struct PqpQueryCounters {
+  PqpQueryCounters()
+      : bubbles(0), collision_checks(0), culled_segments(0),
+        warm_start_hits(0), warm_start_misses(0), bounded_distances(0),
+        capsule_distances(0), capsule_fallbacks(0), field_distances(0),
+        field_fallbacks(0), distance_bv_tests(0), distance_tri_tests(0) {}
+
+  std::atomic<size_t> bubbles, collision_checks;
+  // Segment and segment pair queries skipped by the broad phase
+  std::atomic<size_t> culled_segments;
+  // Distance queries whose warm start pair stayed the closest one, or not,
+  // and those cut off by the distance upper bound
+  std::atomic<size_t> warm_start_hits, warm_start_misses, bounded_distances;
+  // Capsule bubble segment distances used, and replaced by exact ones
+  std::atomic<size_t> capsule_distances, capsule_fallbacks;
+  // Field bubble segment distances used, and replaced by exact ones
+  std::atomic<size_t> field_distances, field_fallbacks;
+  // Traversal cost of the exact distance queries
+  std::atomic<size_t> distance_bv_tests, distance_tri_tests;
+};
+
+// Proximity queries against a shared scene. The context keeps the distance
+// query warm start of every segment and obstacle, so a single context must
+// only be used by one thread at a time - each thread should own its
+// context. Segments of the scene's self-collision pairs are obstacles to
+// each other.
+class PqpQueryContext {
+ public:
+  typedef Eigen::Matrix<float, 3, 3, Eigen::RowMajor> EMatrix;
+  typedef Eigen::Vector3f EVector3f;
+
+  explicit PqpQueryContext(const std::shared_ptr<const PqpScene>& scene,
+      const std::shared_ptr<PqpQueryCounters>& counters = nullptr);
+
+  const PqpScene& scene() const { return *scene_; }
+  // Computes bubble distance and dimensions at coordinates, arrays are of
+  // the scene dimension - returns false upon failure
+  bool MakeBubble(const double* coordinates, double& distance,
+    double* dimensions);
+  // Creates bubble - returns false upon failure
+  template <int N>
+  bool MakeBubble(const Eigen::Matrix<double, N, 1>& coordinates,
+      std::shared_ptr<BubbleT<N>>& bubble) {
+    bubble.reset(new BubbleT<N>(coordinates));
+    if (MakeBubble(coordinates.data(), bubble->distance(),
+                   bubble->dimensions().data()))
+      return true;
+    bubble.reset();
+    return false;
+  }
+  // Creates bubble in the arena at handle - returns false upon failure
+  template <int N>
+  bool MakeBubble(BubbleArena<N>& arena, int bubble) {
+    return MakeBubble(arena.coordinates(bubble).data(),
+                      arena.distance(bubble),
+                      arena.dimensions(bubble).data());
+  }
+  // Performs distance query - returns smallest distance to obstacles
+  double DistanceQuery(const double* q);
+  template <int N>
+  double DistanceQuery(const Eigen::Matrix<double, N, 1>& q) {
+    return DistanceQuery(q.data());
+  }
+  // Checks distance to obstacles against threshold without computing it -
+  // distances under the minimal one count as 0, as in DistanceQuery
+  bool ClearanceAtLeast(const double* q, double threshold);
+  template <int N>
+  bool ClearanceAtLeast(const Eigen::Matrix<double, N, 1>& q,
+      double threshold) {
+    return ClearanceAtLeast(q.data(), threshold);
+  }
+  // Performs collision check - returns false upon collision
+  bool CollisionQuery(const double* q);
+  template <int N>
+  bool CollisionQuery(const Eigen::Matrix<double, N, 1>& q) {
+    return CollisionQuery(q.data());
+  }
+  // Broad phase culls segments far from obstacles and segment pairs far
+  // from each other, enabled by default
+  void set_broad_phase(bool broad_phase) { broad_phase_ = broad_phase; }
+  // Capsule bubbles measure segment distances from their bounding capsules,
+  // smaller but much cheaper than the exact ones. Capsule distances less
+  // than min_capsule_distance are replaced by exact ones. Disabled by
+  // default.
+  void set_capsule_bubbles(bool capsule_bubbles,
+                           double min_capsule_distance = 0.0) {
+    capsule_bubbles_ = capsule_bubbles;
+    min_capsule_distance_ = min_capsule_distance;
+  }
+  // Field bubbles measure segment distances from their spheres in the
+  // scene's distance field, smaller but cheaper than the exact ones. Field
+  // distances less than min_field_distance are replaced by exact ones.
+  // Without a field of the current obstacles bubbles are made as if
+  // disabled. Take precedence over capsule bubbles, disabled by default.
+  void set_field_bubbles(bool field_bubbles,
+                         double min_field_distance = 0.0) {
+    field_bubbles_ = field_bubbles;
+    min_field_distance_ = min_field_distance;
+  }
+
+ private:
+  const double kMinDistanceToObstacles = 0.1;
+  // Relative growth of capsule radii in the self-collision broad phase
+  const double kCapsuleMargin = 1e-5;
+
+  // Takes the scene obstacles and their distance field for the query and
+  // computes segment capsules and their distance lower bounds for the last
+  // queried configuration, ordering segments by the lower bounds
+  void BroadPhase();
+  // Obstacles closer than distance to segment i have their root boxes
+  // closer than distance plus this to its capsule axis, all do without the
+  // broad phase
+  double SearchRadius(size_t i) const;
+  // Distance result of segment i and obstacle id, holding the closest pair
+  // of their previous query
+  PQP_DistanceResult& ObstacleDistance(size_t i, int id);
+  // Distance of segment i to obstacles, warm started with the closest pairs
+  // of the previous query - exact if less than upper bound, otherwise at
+  // least upper bound
+  double SegmentDistance(size_t i, double upper_bound);
+  // Warm started distance query, bounded as SegmentDistance
+  double BoundedDistance(PQP_DistanceResult& distance_res,
+                         EMatrix& R1, EVector3f& T1, PQP_Model* model1,
+                         EMatrix& R2, EVector3f& T2, PQP_Model* model2,
+                         double upper_bound);
+  // Lower bound of the distance between the capsules of self-collision pair
+  double PairLowerBound(size_t pair) const;
+  // Self-collision pairs of the last queried configuration, the obstacle
+  // queries have to be done first. SelfDistance lowers distance to the
+  // closest pair distance - returns false if a pair is too close.
+  bool SelfDistance(double& distance);
+  bool SelfClearanceAtLeast(double tolerance);
+  // Returns false upon self-collision
+  bool SelfCollisionFree();
+
+  // Distance result of a segment and an obstacle. The model is held, so
+  // that a warm start is never taken from another model reusing the id.
+  struct WarmStart {
+    std::shared_ptr<PQP_Model> model;
+    PQP_DistanceResult result;
+  };
+
+  std::shared_ptr<const PqpScene> scene_;
+  std::shared_ptr<PqpQueryCounters> counters_;
+  // Obstacles of the last query and their field, null if there is none
+  std::shared_ptr<const ObstacleSet> obstacles_;
+  std::shared_ptr<const DistanceField> distance_field_;
+  // Distance results of every segment, indexed by obstacle id
+  std::vector<std::vector<WarmStart>> distance_res_;
+  // Frames of the last queried configuration
+  ForwardKinematics kinematics_;
+  bool broad_phase_, capsule_bubbles_, field_bubbles_;
+  double min_capsule_distance_, min_field_distance_;
+  // Segment capsule endpoints in the world frame and distance lower bounds
+  std::vector<EVector3f> endpoints_;
+  std::vector<double> lower_bounds_;
+  // Segments by increasing lower bound
+  std::vector<size_t> segment_order_;
+  // One distance result per self-collision pair
+  std::vector<PQP_DistanceResult> self_distance_res_;
+};
+
+#endif  // PQP_QUERY_CONTEXT_H_INCLUDED
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#include "pqp_scene.h"
+
+#include <Eigen/Dense>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+
+#include "model_parser.h"
+
+PqpScene::PqpScene(const std::vector<std::string>& robot_model_files,
+                   const std::string& dh_table_file,
+                   const std::string& obstacles_model_file,
+                   const std::string& bvh_cache_dir,
+                   int obstacles_split_rule, int bv_type,
+                   const SegmentPairs& self_collision_pairs)
+    : bvh_cache_dir_(bvh_cache_dir),
+      obstacles_split_rule_(obstacles_split_rule), bv_type_(bv_type),
+      obstacles_(std::make_shared<const ObstacleSet>()),
+      self_collision_pairs_(self_collision_pairs) {
+  if (!LoadRobotParameters(dh_table_file)) throw "DH table problem!";
+  if (!LoadRobotModel(robot_model_files, bvh_cache_dir, bv_type))
+    throw "Robot model problem!";
+  for (const auto& pair : self_collision_pairs_)
+    if (pair.first >= dimension() || pair.second >= dimension() ||
+        pair.first == pair.second)
+      throw "Self-collision pair problem!";
+  AddObstacle(obstacles_model_file, EMatrix::Identity(), EVector3f::Zero());
+}
+
+bool PqpScene::LoadRobotModel(
+      const std::vector<std::string>& robot_model_files,
+      const std::string& bvh_cache_dir, int bv_type) {
+  try {
+    ModelParser parser (bvh_cache_dir, PQP_SPLIT_MEAN, bv_type);
+    EMatrix R = EMatrix::Identity();
+    EVector3f T (0.0, 0.0, 0.0);
+
+    int segments_index = 0;
+    for (const auto& model_file : robot_model_files) {
+      if (segments_index >= 1)
+        dh_table_[segments_index - 1].InverseTransform(R, T);
+
+
+      double axis_length, radius;
+      EVector3f axis = dh_table_[segments_index].translation();
+      axis.normalize();
+
+      segments_.emplace_back(parser.GetTransformModel(model_file, R, T,
+          axis, &axis_length, &radius));
+      capsules_.emplace_back(axis * axis_length, radius);
+      spheres_.push_back(DistanceField::BoundingSpheres(*segments_.back(),
+                                                        kSegmentSpheres));
+      ++segments_index;
+    }
+
+    return true;
+  } catch (...) {
+    throw;
+  }
+  return false;  // Input file not present
+}
+
+std::vector<double> PqpScene::JointReaches() const {
+  // Segments i onwards are within the capsule of segment i or within the
+  // reach of segment i + 1 from its frame, the DH translation away
+  std::vector<double> reaches (dimension());
+  double reach = 0.0;
+  for (size_t i = dimension(); i-- > 0;) {
+    reach = std::max(capsules_[i].first.norm() + capsules_[i].second,
+                     dh_table_[i].translation().norm() + reach);
+    reaches[i] = reach;
+  }
+  return reaches;
+}
+
+// TODO(hamza): Add limits parsing
+bool PqpScene::LoadRobotParameters(const std::string& parameters_file) {
+  std::ifstream input_file (parameters_file.c_str());
+  if (input_file) {
+    try {
+      input_file.seekg(0, std::ios::end);            // End of file
+      std::streampos length (input_file.tellg());    // Read the size
+      input_file.seekg(0, std::ios::beg);            // Return to beginning
+
+      std::vector<char> buffer (length);
+      input_file.read(&buffer[0], length);
+
+      // Move buffer to stringstream parser
+      std::stringstream parser;
+      parser.rdbuf()->pubsetbuf(&buffer[0], length);
+
+      double theta, d, a, alpha;
+      while (!parser.eof()) {
+        parser >> theta >> d >> a >> alpha;
+        dh_table_.emplace_back(theta, d, a, alpha);
+      }
+
+      return true;
+    }
+    catch(...) {
+      throw "File error!";
+    }
+  }
+  return false;  // Input file not present
+}
+
+int PqpScene::AddObstacle(const std::string& model_file,
+    const EMatrix& rotation, const EVector3f& translation) {
+  ModelParser parser (bvh_cache_dir_, obstacles_split_rule_, bv_type_);
+  return AddObstacle(std::shared_ptr<PQP_Model>(parser.GetModel(model_file)),
+                     rotation, translation);
+}
+
+int PqpScene::AddObstacle(const std::shared_ptr<PQP_Model>& model,
+    const EMatrix& rotation, const EVector3f& translation) {
+  std::lock_guard<std::mutex> lock (update_mutex_);
+  int id;
+  std::atomic_store(&obstacles_,
+                    obstacles()->Add(model, rotation, translation, &id));
+  std::atomic_store(&distance_field_, std::shared_ptr<const DistanceField>());
+  return id;
+}
+
+void PqpScene::RemoveObstacle(int id) {
+  std::lock_guard<std::mutex> lock (update_mutex_);
+  std::atomic_store(&obstacles_, obstacles()->Remove(id));
+  std::atomic_store(&distance_field_, std::shared_ptr<const DistanceField>());
+}
+
+void PqpScene::MoveObstacle(int id, const EMatrix& rotation,
+    const EVector3f& translation) {
+  std::lock_guard<std::mutex> lock (update_mutex_);
+  std::atomic_store(&obstacles_,
+                    obstacles()->Move(id, rotation, translation));
+  std::atomic_store(&distance_field_, std::shared_ptr<const DistanceField>());
+}
+
+void PqpScene::BuildDistanceField(double cell_size, double band) {
+  std::lock_guard<std::mutex> lock (update_mutex_);
+  std::atomic_store(&distance_field_, std::shared_ptr<const DistanceField>(
+      new DistanceField(obstacles(), cell_size, band, bvh_cache_dir_)));
+}
+
+PqpScene::SegmentPairs PqpScene::NonAdjacentPairs(size_t dimension,
+    size_t allowed_adjacency) {
+  SegmentPairs pairs;
+  for (size_t i = 0; i < dimension; ++i)
+    for (size_t j = i + allowed_adjacency + 1; j < dimension; ++j)
+      pairs.emplace_back(i, j);
+  return pairs;
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2015 Hamza Merzić
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+*/
+#ifndef PQP_SCENE_H_INCLUDED
+#define PQP_SCENE_H_INCLUDED
+
+#include <cmath>
+#include <PQP/PQP.h>
+#include <Eigen/Dense>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "dh_parameter.h"
+#include "distance_field.h"
+#include "obstacle_set.h"
+
+// Robot segments, DH table and obstacles loaded once. The scene is not
+// modified by queries, so a single instance can be shared by any number of
+// query contexts and environments running in different threads. Obstacles
+// may be added, removed and moved while it is shared - every query runs
+// against the obstacle set of the moment it started.
+class PqpScene {
+ public:
+  typedef Eigen::Vector3f EVector3f;
+  typedef std::vector<std::pair<size_t, size_t>> SegmentPairs;
+
+  // Built models are cached in bvh_cache_dir unless it is empty, obstacle
+  // hierarchies are built with obstacles_split_rule and all of them with the
+  // bv_type BVs - see ModelParser. Distance and clearance queries need
+  // RSS_TYPE, collision queries either type. The obstacles model file is
+  // the first obstacle, placed at the origin. Segments of every self-collision
+  // pair are checked against each other, see NonAdjacentPairs.
+  PqpScene(const std::vector<std::string>& robot_model_files,
+           const std::string& dh_table_file,
+           const std::string& obstacles_model_file,
+           const std::string& bvh_cache_dir = "",
+           int obstacles_split_rule = PQP_SPLIT_MEAN,
+           int bv_type = PQP_BV_TYPE,
+           const SegmentPairs& self_collision_pairs = SegmentPairs());
+
+  size_t dimension() const { return segments_.size(); }
+  PQP_Model* segment(size_t i) const { return segments_.at(i).get(); }
+  const DhParameter& dh_parameter(size_t i) const { return dh_table_.at(i); }
+  const std::vector<DhParameter>& dh_table() const { return dh_table_; }
+  // Obstacles at the moment, later updates leave the returned set unchanged
+  std::shared_ptr<const ObstacleSet> obstacles() const {
+    return std::atomic_load(&obstacles_);
+  }
+  // Adds the obstacle model file, built as the obstacles model file is, or
+  // the built model, placed in the world by rotation and translation -
+  // returns the obstacle id
+  int AddObstacle(const std::string& model_file, const EMatrix& rotation,
+                  const EVector3f& translation);
+  int AddObstacle(const std::shared_ptr<PQP_Model>& model,
+                  const EMatrix& rotation, const EVector3f& translation);
+  void RemoveObstacle(int id);
+  void MoveObstacle(int id, const EMatrix& rotation,
+                    const EVector3f& translation);
+  // Samples the distance field of the obstacles at the moment, cell_size
+  // apart within band of their surfaces - see DistanceField. Fields are
+  // cached along with the built models, obstacle updates drop the field.
+  void BuildDistanceField(double cell_size, double band);
+  // Field of the obstacles at the moment, null if there is none
+  std::shared_ptr<const DistanceField> distance_field() const {
+    return std::atomic_load(&distance_field_);
+  }
+  // Segment bounding capsule - axis vector and radius
+  const std::pair<EVector3f, double>& capsule(size_t i) const {
+    return capsules_.at(i);
+  }
+  // Bounds of the distances from joint i's axis to segments i onwards, the
+  // most they move per radian of the joint. As joint weights, the metric
+  // approximates displacements in the workspace.
+  std::vector<double> JointReaches() const;
+  // Spheres covering segment i, in its frame
+  const std::vector<DistanceField::Sphere>& spheres(size_t i) const {
+    return spheres_.at(i);
+  }
+  // Segment pairs checked for self-collision, fixed by the constructor
+  const SegmentPairs& self_collision_pairs() const {
+    return self_collision_pairs_;
+  }
+  // Pairs of segments more than allowed_adjacency joints apart
+  static SegmentPairs NonAdjacentPairs(size_t dimension,
+                                       size_t allowed_adjacency = 1);
+  // Capsule distances to the obstacles at the moment, see ObstacleSet
+  double CapsuleDistanceLowerBound(const EVector3f& begin,
+                                   const EVector3f& end, double radius) const {
+    return obstacles()->CapsuleDistanceLowerBound(begin, end, radius);
+  }
+  double CapsuleDistance(const EVector3f& begin, const EVector3f& end,
+                         double radius, double upper_bound) const {
+    return obstacles()->CapsuleDistance(begin, end, radius, upper_bound);
+  }
+
+ private:
+  // Spheres covering each segment, at most
+  const size_t kSegmentSpheres = 64;
+
+  bool LoadRobotModel(const std::vector<std::string>& robot_mode_files,
+                      const std::string& bvh_cache_dir, int bv_type);
+  bool LoadRobotParameters(const std::string& parameters_file);
+
+  // Obstacle models are built as set up by the constructor
+  const std::string bvh_cache_dir_;
+  const int obstacles_split_rule_, bv_type_;
+  // Replaced as a whole by updates, which are serialized by the mutex
+  std::shared_ptr<const ObstacleSet> obstacles_;
+  std::shared_ptr<const DistanceField> distance_field_;
+  std::mutex update_mutex_;
+  std::vector<std::unique_ptr<PQP_Model>> segments_;
+  std::vector<DhParameter> dh_table_;
+  std::vector<std::pair<EVector3f, double>> capsules_;
+  std::vector<std::vector<DistanceField::Sphere>> spheres_;
+  const SegmentPairs self_collision_pairs_;
+};
+
+#endif  // PQP_SCENE_H_INCLUDED
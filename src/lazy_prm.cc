@@ -21,33 +21,119 @@
 #include <fstream>
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <omp.h>
 
 namespace lazyprm {
 
-bool LazyPrm::ConnectPoints(int point1_index, int point2_index) {
+std::vector<int> BisectionOrder(int count) {
+  int bits = 0;
+  while ((1 << bits) <= count) ++bits;
+
+  std::vector<int> order;
+  order.reserve(std::max(count, 0));
+  for (int i = 1; i < (1 << bits); ++i) {
+    // Reversing the bits of i gives the van der Corput sequence
+    int index = 0;
+    for (int bit = 0; bit < bits; ++bit)
+      if (i & (1 << bit)) index |= 1 << (bits - 1 - bit);
+    if (index <= count) order.push_back(index);
+  }
+  return order;
+}
+
+template <int N>
+LazyPrmT<N>::LazyPrmT(PqpEnvironment* pqp_environment, const EVectorNd& start,
+                      const EVectorNd& end, int knn_num, double step_size,
+                      double collision_limit, bool bisection_order,
+                      int validation_threads)
+    : PrmTreeT<N>(pqp_environment, start, end, knn_num),
+      step_size_(step_size),  // interpolation step size
+      bisection_order_(bisection_order),
+      parents_(std::vector<int>(this->space_size_, -1)), // -1 => no parent
+      connects_(0), adds_(0) {  // Logged parameters
+  if (validation_threads > 1)
+    for (int i = 0; i < validation_threads; ++i)
+      contexts_.push_back(pqp_environment_->NewQueryContext());
+}
+
+template <int N>
+bool LazyPrmT<N>::ConnectPoints(int point1_index, int point2_index) {
   ++connects_;
-  EVectorXd point1 = GetCoordinates(point1_index),
-            point2 = GetCoordinates(point2_index),
-            direction = (point2 - point1).normalized();
+  EVectorNd point1 = GetCoordinates(point1_index),
+            point2 = GetCoordinates(point2_index);
+  const JointMetric& metric = pqp_environment_->metric();
+  const double length = metric.Distance(point1, point2);
 
-  EVectorXd temp_point = point1 + direction * step_size_;
-  while ((point2 - temp_point).norm() > step_size_) {
-    if (!pqp_environment_->CollisionQuery(temp_point))
-      return false;
-    temp_point += direction * step_size_;
+  // Interpolation points point1 + k * step for 0 < k < count + 1, the last
+  // one further than step size from point2 in the metric
+  const int count = std::max(
+      static_cast<int>(std::ceil(length / step_size_)) - 2, 0);
+  std::vector<int> order;
+  if (bisection_order_) {
+    order = BisectionOrder(count);
+  } else {
+    order.resize(count);
+    std::iota(order.begin(), order.end(), 1);
+  }
+
+  size_t checks = 0;
+  if (!ValidatePoints(point1,
+                      metric.Difference(point1, point2) * (step_size_ / length),
+                      order, checks)) {
+    rejection_checks_.push_back(checks);
+    return false;
   }
 
   parents_.at(point2_index) = point1_index;
   return true;
 }
 
-bool LazyPrm::AddPointToTree(int point_index, double extra_weight) {
+template <int N>
+bool LazyPrmT<N>::ValidatePoints(const EVectorNd& point1,
+                                 const EVectorNd& step,
+                                 const std::vector<int>& order,
+                                 size_t& checks) {
+  if (contexts_.empty()) {
+    for (int k : order) {
+      ++checks;
+      if (!pqp_environment_->CollisionQuery(EVectorNd(point1 + k * step)))
+        return false;
+    }
+    return true;
+  }
+
+  // Chunks are checked concurrently, the rest of a chunk is skipped once a
+  // collision is found
+  const int chunk_size = kChunkPerThread * contexts_.size();
+  std::atomic<bool> collision (false);
+  std::atomic<size_t> chunk_checks (0);
+  for (size_t begin = 0; begin < order.size() && !collision;
+       begin += chunk_size) {
+    const int end = std::min(begin + chunk_size, order.size());
+    #pragma omp parallel for schedule(static, 1) num_threads(contexts_.size())
+    for (int i = begin; i < end; ++i) {
+      if (collision) continue;
+      ++chunk_checks;
+      if (!contexts_.at(omp_get_thread_num())->CollisionQuery(
+              EVectorNd(point1 + order[i] * step)))
+        collision = true;
+    }
+  }
+  checks += chunk_checks;
+  return !collision;
+}
+
+template <int N>
+bool LazyPrmT<N>::AddPointToTree(int point_index, double extra_weight) {
   if (visited_.at(point_index)) return false;
   ++adds_;
   visited_.at(point_index) = true;
   pqp_environment_->RemovePoint(point_index);
 
-  EVectorXd current_point_coordinates = GetCoordinates(point_index);
+  EVectorNd current_point_coordinates = GetCoordinates(point_index);
   std::vector<int> query_indices = pqp_environment_->KnnQuery(
       current_point_coordinates, knn_num_);
 
@@ -56,11 +142,11 @@ bool LazyPrm::AddPointToTree(int point_index, double extra_weight) {
       // Skips visited points
       continue;
 
-    EVectorXd query_cords = GetCoordinates(query_index);
+    EVectorNd query_cords = GetCoordinates(query_index);
     if (pqp_environment_->CollisionQuery(query_cords)) {
       pq_.emplace(point_index, query_index,
-          (end_ - query_cords).norm() +
-          (start_ - query_cords).norm(),
+          pqp_environment_->metric().Distance(end_, query_cords) +
+          pqp_environment_->metric().Distance(start_, query_cords),
           0 /*extra_weight + 0.25 // hard-coded weight gain*/);
     }
     else {
@@ -72,9 +158,10 @@ bool LazyPrm::AddPointToTree(int point_index, double extra_weight) {
   return true;
 }
 
-bool LazyPrm::BuildTree(const std::string& log_filename) {
+template <int N>
+bool LazyPrmT<N>::BuildTree(const std::string& log_filename) {
   std::cout << "**********BUILD STARTED**********" << std::endl;
-  EVectorXd start_coordinates = GetCoordinates(start_index_),
+  EVectorNd start_coordinates = GetCoordinates(start_index_),
             end_coordinates = GetCoordinates(end_index_);
   if (!pqp_environment_->CollisionQuery(start_coordinates)) {
     std::cout << "Collision at the initial configuration!" << std::endl;
@@ -109,6 +196,18 @@ bool LazyPrm::BuildTree(const std::string& log_filename) {
         std::endl;
   }
 
+  size_t rejection_checks = 0;
+  log << "Rejection checks:";
+  for (size_t checks : rejection_checks_) {
+    rejection_checks += checks;
+    log << " " << checks;
+  }
+  log << std::endl;
+  std::cout << "Rejected edges: " << rejection_checks_.size() <<
+    ", checks per rejected edge: " << (rejection_checks_.empty() ? 0.0 :
+    static_cast<double>(rejection_checks) / rejection_checks_.size()) <<
+    std::endl;
+
   if (parents_.at(end_index_) != -1) {
     std::cout << "**********BUILD SUCCESSFULL**********" << std::endl;
     std::cout << "Collision checks: " << pqp_environment_->CollisionChecks() <<
@@ -130,7 +229,8 @@ bool LazyPrm::BuildTree(const std::string& log_filename) {
   }
 }
 
-void LazyPrm::GeneratePath(const std::string& filename) {
+template <int N>
+void LazyPrmT<N>::GeneratePath(const std::string& filename) {
   auto trajectory_it = parents_.at(end_index_);
   if (trajectory_it == -1) {
     std::cout << "Trajectory writing unsuccessful!" << std::endl;
@@ -148,12 +248,23 @@ void LazyPrm::GeneratePath(const std::string& filename) {
     std::endl << "RL = Robolink()" << std::endl << std::endl <<
     "robot = RL.Item('ABB IRB 120-3/0.6')" << std::endl;
 
-  std::vector<EVectorXd> trajectory_deg;
-  trajectory_deg.push_back(180 * GetCoordinates(end_index_) / M_PI);
+  std::vector<int> trajectory_indices (1, end_index_);
   while (trajectory_it != -1) {
-    trajectory_deg.push_back(180 * GetCoordinates(trajectory_it) / M_PI);
+    trajectory_indices.push_back(trajectory_it);
     trajectory_it = parents_.at(trajectory_it);
   }
+  // Waypoints follow the checked edges, the shorter way around wrapped
+  // joints rather than between the raw coordinates. The trajectory is
+  // stored from the end, as it is written backwards.
+  const JointMetric& metric = pqp_environment_->metric();
+  std::vector<EVectorNd, Eigen::aligned_allocator<EVectorNd>> trajectory_deg (
+      trajectory_indices.size());
+  EVectorNd waypoint = GetCoordinates(trajectory_indices.back());
+  for (size_t i = trajectory_indices.size(); i-- > 0;) {
+    waypoint += metric.Difference(waypoint,
+                                  GetCoordinates(trajectory_indices[i]));
+    trajectory_deg[i] = 180 * waypoint / M_PI;
+  }
 
   file << "robot.setJoints([";
   for (unsigned i = 0; i < trajectory_deg.rbegin()->size() - 1; ++i) {
@@ -175,4 +286,28 @@ void LazyPrm::GeneratePath(const std::string& filename) {
                "--------------------------------" << std::endl << std::endl;
 }
 
+template class LazyPrmT<2>;
+template class LazyPrmT<6>;
+template class LazyPrmT<Eigen::Dynamic>;
+
+std::unique_ptr<PrmTreeInterface> CreateLazyPrm(
+    PqpEnvironment* pqp_environment, const Eigen::VectorXd& start,
+    const Eigen::VectorXd& end, int knn_num, double step_size,
+    double collision_limit, bool bisection_order, int validation_threads) {
+  switch (start.size()) {
+    case 2:
+      return std::unique_ptr<PrmTreeInterface>(new LazyPrmT<2>(
+          pqp_environment, start, end, knn_num, step_size, collision_limit,
+          bisection_order, validation_threads));
+    case 6:
+      return std::unique_ptr<PrmTreeInterface>(new LazyPrmT<6>(
+          pqp_environment, start, end, knn_num, step_size, collision_limit,
+          bisection_order, validation_threads));
+    default:
+      return std::unique_ptr<PrmTreeInterface>(new LazyPrm(
+          pqp_environment, start, end, knn_num, step_size, collision_limit,
+          bisection_order, validation_threads));
+  }
+}
+
 }  // namespace lazyprm
@@ -44,19 +44,22 @@ struct EdgeCompareFunctor {
   }
 };
 
-class LazyPrm : PrmTree {
+// Indices 1..count in van der Corput order - each index halves the largest
+// interval left unchecked between 0 and count + 1
+std::vector<int> BisectionOrder(int count);
+
+template <int N>
+class LazyPrmT : public PrmTreeT<N> {
  public:
-  typedef Eigen::VectorXd EVectorXd;
-  LazyPrm(PqpEnvironment* pqp_environment, EVectorXd& start, EVectorXd& end,
-            int knn_num,  // Number of nearest neighbors
-            double step_size = 0.005, // Interpolation step size
-            double collision_limit = 0.005  // Distance query overhead
-            )
-      : PrmTree(pqp_environment, start, end, knn_num),
-        step_size_(step_size),  // interpolation step size
-        parents_(std::vector<int>(space_size_, -1)), // -1 => no parent
-        connects_(0), adds_(0) // Logged parameters
-        {}
+  typedef typename PrmTreeT<N>::EVectorNd EVectorNd;
+  LazyPrmT(PqpEnvironment* pqp_environment, const EVectorNd& start,
+           const EVectorNd& end,
+           int knn_num,  // Number of nearest neighbors
+           double step_size = 0.005, // Interpolation step in the metric
+           double collision_limit = 0.005,  // Distance query overhead
+           bool bisection_order = false,  // Order of interpolation checks
+           int validation_threads = 1  // Threads checking an edge
+           );
 
   virtual bool ConnectPoints(int point1_index, int point2_index);
   virtual bool AddPointToTree(int point_index, double extra_weight = 0);
@@ -64,12 +67,44 @@ class LazyPrm : PrmTree {
   virtual void GeneratePath(const std::string& filename);
 
  private:
+  using PrmTreeT<N>::pqp_environment_;
+  using PrmTreeT<N>::start_;
+  using PrmTreeT<N>::end_;
+  using PrmTreeT<N>::start_index_;
+  using PrmTreeT<N>::end_index_;
+  using PrmTreeT<N>::knn_num_;
+  using PrmTreeT<N>::visited_;
+  using PrmTreeT<N>::GetCoordinates;
+
+  // Interpolation points checked concurrently by every validation thread
+  const int kChunkPerThread = 8;
+
+  // Checks interpolation points of an edge in order, stopping at the first
+  // collision - returns false upon collision
+  bool ValidatePoints(const EVectorNd& point1, const EVectorNd& step,
+                      const std::vector<int>& order, size_t& checks);
+
   double step_size_;
+  bool bisection_order_;
   std::vector<int> parents_;
+  // Query context of every validation thread, empty if validating serially
+  std::vector<std::unique_ptr<PqpQueryContext>> contexts_;
   size_t connects_, adds_;
+  // Collision checks made by every rejected edge
+  std::vector<size_t> rejection_checks_;
   std::priority_queue<Edge, std::vector<Edge>, EdgeCompareFunctor> pq_;
 };
 
+typedef LazyPrmT<Eigen::Dynamic> LazyPrm;
+
+// Creates the planner specialized for the dimension of start, falling back
+// to the dynamic size one for dimensions without specialization
+std::unique_ptr<PrmTreeInterface> CreateLazyPrm(
+    PqpEnvironment* pqp_environment, const Eigen::VectorXd& start,
+    const Eigen::VectorXd& end, int knn_num, double step_size = 0.005,
+    double collision_limit = 0.005, bool bisection_order = false,
+    int validation_threads = 1);
+
 }  // namespace lazyprm
 
 #endif  // LAZY_PRM_H_INCLUDED
@@ -20,6 +20,7 @@
 #include "lazy_prm.h"
 
 #include <vector>
+#include <algorithm>
 #include <memory>
 #include <cmath>
 #include <chrono>
@@ -34,6 +35,19 @@ using namespace lazyprm;
 
 typedef Eigen::VectorXd EVectorXd;
 
+BOOST_AUTO_TEST_CASE(bisection_order) {
+  std::vector<int> order = BisectionOrder(7), expected {4, 2, 6, 1, 5, 3, 7};
+  BOOST_CHECK_EQUAL_COLLECTIONS(order.begin(), order.end(), expected.begin(),
+                                expected.end());
+
+  // Every index once, for counts other than powers of two less one
+  order = BisectionOrder(10);
+  std::sort(order.begin(), order.end());
+  for (int i = 0; i < 10; ++i)
+    BOOST_CHECK_EQUAL(order.at(i), i + 1);
+  BOOST_CHECK_EQUAL(BisectionOrder(0).empty(), true);
+}
+
 BOOST_AUTO_TEST_CASE(build) {
   auto start_t = std::chrono::steady_clock::now();
   std::vector<std::pair<double, double>> limits;
@@ -465,4 +479,49 @@ BOOST_AUTO_TEST_CASE(initialcol6) {
   BOOST_CHECK_EQUAL(lazy_prm.BuildTree("lazy_col6"), false);
 }
 
+BOOST_AUTO_TEST_CASE(dispatch_twoseg) {
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(0, 3.1416);
+  limits.emplace_back(-2.618, 2.618);
+  EVectorXd start (2); start << 0.0, 0.0;
+  EVectorXd end (2); end << 1.9897, 0.0;
 
+  // Specialized and dynamic size planners
+  for (bool fixed : {true, false}) {
+    std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+      new HaltonGenerator(limits));
+    std::unique_ptr<PqpEnvironment> pqp (new PqpEnvironment(
+        {"models/two-seg/bmp_seg1.stl", "models/two-seg/bmp_seg2.stl"},
+        "models/two-seg/bmp_dh_table.txt",
+        "models/environment/obstacles_twoseg.stl",
+        generator.release(), 1000));
+    std::unique_ptr<PrmTreeInterface> lazy_prm;
+    if (fixed)
+      lazy_prm = CreateLazyPrm(pqp.release(), start, end, 15);
+    else
+      lazy_prm.reset(new LazyPrm(pqp.release(), start, end, 15));
+    BOOST_CHECK_EQUAL(lazy_prm->BuildTree("lazy_twoseg"), true);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(bisection_twoseg) {
+  std::vector<std::pair<double, double>> limits;
+  limits.emplace_back(0, 3.1416);
+  limits.emplace_back(-2.618, 2.618);
+  EVectorXd start (2); start << 0.0, 0.0;
+  EVectorXd end (2); end << 1.9897, 0.0;
+
+  // Serial and parallel validation
+  for (int threads : {1, 4}) {
+    std::unique_ptr<RandomSpaceGeneratorInterface> generator (
+      new HaltonGenerator(limits));
+    std::unique_ptr<PqpEnvironment> pqp (new PqpEnvironment(
+        {"models/two-seg/bmp_seg1.stl", "models/two-seg/bmp_seg2.stl"},
+        "models/two-seg/bmp_dh_table.txt",
+        "models/environment/obstacles_twoseg.stl",
+        generator.release(), 1000));
+    std::unique_ptr<PrmTreeInterface> lazy_prm (CreateLazyPrm(
+        pqp.release(), start, end, 15, 0.005, 0.005, true, threads));
+    BOOST_CHECK_EQUAL(lazy_prm->BuildTree("lazy_twoseg"), true);
+  }
+}
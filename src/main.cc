@@ -28,11 +28,17 @@
 #include "random_generator/naive_generator.h"
 #include "random_generator/halton_generator.h"
 
-using ::bubbleprm::BubblePrm;
-using ::lazyprm::LazyPrm;
+using ::bubbleprm::CreateBubblePrm;
+using ::lazyprm::CreateLazyPrm;
 
 typedef Eigen::VectorXd EVectorXd;
 
+// Built model hierarchies are reused by every trial and across runs
+const char kBvhCacheDir[] = "models/bvh_cache";
+// Bubbles need distances, lazy PRM only collision checks, so each keeps just
+// the bounding volumes its queries test
+const int kBubbleBvType = RSS_TYPE, kLazyBvType = OBB_TYPE;
+
 int main() {
   // Limits
   std::vector<std::pair<double, double>> limits;
@@ -43,6 +49,10 @@ int main() {
   limits.emplace_back(-2.094395102, 2.094395102);
   limits.emplace_back(-6.981317008, 6.981317008);
 
+  // ABB segments more than two joints apart are checked against each other,
+  // the wrist segments two joints apart nearly touch already at zero
+  const auto abb_self_collision_pairs = PqpScene::NonAdjacentPairs(6, 2);
+
   std::vector<std::pair<double, double>> limits_twoseg;
   limits_twoseg.emplace_back(0, 3.1416);
   limits_twoseg.emplace_back(-2.618, 2.618);
@@ -153,11 +163,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_trivial.stl",
-        generator.release(), 1000));
-    BubblePrm bubble_prm (pqp.release(), start_trivial1, end_trivial1, 10);
+        generator.release(), 1000, kBvhCacheDir, kBubbleBvType,
+        abb_self_collision_pairs));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_trivial1,
+        end_trivial1, 10);
 
     std::string logname ("logs/bubble_trivial1/bubble" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -180,11 +192,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_trivial.stl",
-        generator.release(), 1000));
-    BubblePrm bubble_prm (pqp.release(), start_trivial1, end_trivial1, 10);
+        generator.release(), 1000, kBvhCacheDir, kBubbleBvType,
+        abb_self_collision_pairs));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_trivial1,
+        end_trivial1, 10);
 
     std::string logname ("logs/bubble_trivial1h/bubble" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -207,11 +221,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_trivial.stl",
-        generator.release(), 1200));
-    BubblePrm bubble_prm (pqp.release(), start_trivial2, end_trivial2, 15);
+        generator.release(), 1200, kBvhCacheDir, kBubbleBvType,
+        abb_self_collision_pairs));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_trivial2,
+        end_trivial2, 15);
 
     std::string logname ("logs/bubble_trivial2/bubble" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -234,11 +250,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_trivial.stl",
-        generator.release(), 1200));
-    BubblePrm bubble_prm (pqp.release(), start_trivial2, end_trivial2, 15);
+        generator.release(), 1200, kBvhCacheDir, kBubbleBvType,
+        abb_self_collision_pairs));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_trivial2,
+        end_trivial2, 15);
 
     std::string logname ("logs/bubble_trivial2h/bubble" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -261,11 +279,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_easy.stl",
-        generator.release(), 2000));
-    BubblePrm bubble_prm (pqp.release(), start_easy1, end_easy1, 20);
+        generator.release(), 2000, kBvhCacheDir, kBubbleBvType,
+        abb_self_collision_pairs));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_easy1,
+        end_easy1, 20);
 
     std::string logname ("logs/bubble_easy1/bubble" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -288,11 +308,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_easy.stl",
-        generator.release(), 2000));
-    BubblePrm bubble_prm (pqp.release(), start_easy1, end_easy1, 20);
+        generator.release(), 2000, kBvhCacheDir, kBubbleBvType,
+        abb_self_collision_pairs));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_easy1,
+        end_easy1, 20);
 
     std::string logname ("logs/bubble_easy1h/bubble" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -315,11 +337,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_easy.stl",
-        generator.release(), 2200));
-    BubblePrm bubble_prm (pqp.release(), start_easy2, end_easy2, 25);
+        generator.release(), 2200, kBvhCacheDir, kBubbleBvType,
+        abb_self_collision_pairs));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_easy2,
+        end_easy2, 25);
 
     std::string logname ("logs/bubble_easy2/bubble" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -342,11 +366,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_easy.stl",
-        generator.release(), 2200));
-    BubblePrm bubble_prm (pqp.release(), start_easy2, end_easy2, 25);
+        generator.release(), 2200, kBvhCacheDir, kBubbleBvType,
+        abb_self_collision_pairs));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_easy2,
+        end_easy2, 25);
 
     std::string logname ("logs/bubble_easy2h/bubble" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -369,11 +395,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_hard.stl",
-        generator.release(), 4000));
-    BubblePrm bubble_prm (pqp.release(), start_hard1, end_hard1, 60);
+        generator.release(), 4000, kBvhCacheDir, kBubbleBvType,
+        abb_self_collision_pairs));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_hard1,
+        end_hard1, 60);
 
     std::string logname ("logs/bubble_hard1/bubble" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -396,11 +424,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_hard.stl",
-        generator.release(), 4000));
-    BubblePrm bubble_prm (pqp.release(), start_hard1, end_hard1, 60);
+        generator.release(), 4000, kBvhCacheDir, kBubbleBvType,
+        abb_self_collision_pairs));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_hard1,
+        end_hard1, 60);
 
     std::string logname ("logs/bubble_hard1h/bubble" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -423,11 +453,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_hard.stl",
-        generator.release(), 4000));
-    BubblePrm bubble_prm (pqp.release(), start_hard2, end_hard2, 60);
+        generator.release(), 4000, kBvhCacheDir, kBubbleBvType,
+        abb_self_collision_pairs));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_hard2,
+        end_hard2, 60);
 
     std::string logname ("logs/bubble_hard2/bubble" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -450,11 +482,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_hard.stl",
-        generator.release(), 4000));
-    BubblePrm bubble_prm (pqp.release(), start_hard2, end_hard2, 60);
+        generator.release(), 4000, kBvhCacheDir, kBubbleBvType,
+        abb_self_collision_pairs));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_hard2,
+        end_hard2, 60);
 
     std::string logname ("logs/bubble_hard2h/bubble" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -477,11 +511,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_trivial.stl",
-        generator.release(), 1000));
-    LazyPrm lazy_prm (pqp.release(), start_trivial1, end_trivial1, 10);
+        generator.release(), 1000, kBvhCacheDir, kLazyBvType,
+        abb_self_collision_pairs));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_trivial1,
+        end_trivial1, 10);
 
     std::string logname ("logs/lazy_trivial1/bubble" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -504,11 +540,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_trivial.stl",
-        generator.release(), 1000));
-    LazyPrm lazy_prm (pqp.release(), start_trivial1, end_trivial1, 10);
+        generator.release(), 1000, kBvhCacheDir, kLazyBvType,
+        abb_self_collision_pairs));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_trivial1,
+        end_trivial1, 10);
 
     std::string logname ("logs/lazy_trivial1h/bubble" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -531,11 +569,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_trivial.stl",
-        generator.release(), 1200));
-    LazyPrm lazy_prm (pqp.release(), start_trivial2, end_trivial2, 15);
+        generator.release(), 1200, kBvhCacheDir, kLazyBvType,
+        abb_self_collision_pairs));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_trivial2,
+        end_trivial2, 15);
 
     std::string logname ("logs/lazy_trivial2/bubble" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -558,11 +598,13 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_trivial.stl",
-        generator.release(), 1200));
-    LazyPrm lazy_prm (pqp.release(), start_trivial2, end_trivial2, 15);
+        generator.release(), 1200, kBvhCacheDir, kLazyBvType,
+        abb_self_collision_pairs));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_trivial2,
+        end_trivial2, 15);
 
     std::string logname ("logs/lazy_trivial2h/bubble" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -585,11 +627,12 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_easy.stl",
-        generator.release(), 2000));
-    LazyPrm lazy_prm (pqp.release(), start_easy1, end_easy1, 20);
+        generator.release(), 2000, kBvhCacheDir, kLazyBvType,
+        abb_self_collision_pairs));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_easy1, end_easy1, 20);
 
     std::string logname ("logs/lazy_easy1/bubble" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -612,11 +655,12 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_easy.stl",
-        generator.release(), 2000));
-    LazyPrm lazy_prm (pqp.release(), start_easy1, end_easy1, 20);
+        generator.release(), 2000, kBvhCacheDir, kLazyBvType,
+        abb_self_collision_pairs));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_easy1, end_easy1, 20);
 
     std::string logname ("logs/lazy_easy1h/bubble" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -639,11 +683,12 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_easy.stl",
-        generator.release(), 2200));
-    LazyPrm lazy_prm (pqp.release(), start_easy2, end_easy2, 25);
+        generator.release(), 2200, kBvhCacheDir, kLazyBvType,
+        abb_self_collision_pairs));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_easy2, end_easy2, 25);
 
     std::string logname ("logs/lazy_easy2/bubble" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -666,11 +711,12 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_easy.stl",
-        generator.release(), 2200));
-    LazyPrm lazy_prm (pqp.release(), start_easy2, end_easy2, 25);
+        generator.release(), 2200, kBvhCacheDir, kLazyBvType,
+        abb_self_collision_pairs));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_easy2, end_easy2, 25);
 
     std::string logname ("logs/lazy_easy2h/bubble" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -693,11 +739,12 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_hard.stl",
-        generator.release(), 4000));
-    LazyPrm lazy_prm (pqp.release(), start_hard1, end_hard1, 60);
+        generator.release(), 4000, kBvhCacheDir, kLazyBvType,
+        abb_self_collision_pairs));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_hard1, end_hard1, 60);
 
     std::string logname ("logs/lazy_hard1/bubble" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -720,11 +767,12 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_hard.stl",
-        generator.release(), 4000));
-    LazyPrm lazy_prm (pqp.release(), start_hard1, end_hard1, 60);
+        generator.release(), 4000, kBvhCacheDir, kLazyBvType,
+        abb_self_collision_pairs));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_hard1, end_hard1, 60);
 
     std::string logname ("logs/lazy_hard1h/bubble" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -747,11 +795,12 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_hard.stl",
-        generator.release(), 4000));
-    LazyPrm lazy_prm (pqp.release(), start_hard2, end_hard2, 60);
+        generator.release(), 4000, kBvhCacheDir, kLazyBvType,
+        abb_self_collision_pairs));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_hard2, end_hard2, 60);
 
     std::string logname ("logs/lazy_hard2/bubble" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -774,11 +823,12 @@ int main() {
         "models/abb-irb-120/5link.stl", "models/abb-irb-120/6link.stl"},
         "models/abb-irb-120/parameters.txt",
         "models/environment/obstacles_hard.stl",
-        generator.release(), 4000));
-    LazyPrm lazy_prm (pqp.release(), start_hard2, end_hard2, 60);
+        generator.release(), 4000, kBvhCacheDir, kLazyBvType,
+        abb_self_collision_pairs));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_hard2, end_hard2, 60);
 
     std::string logname ("logs/lazy_hard2h/bubble" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -799,10 +849,11 @@ int main() {
         {"models/two-seg/bmp_seg1.stl", "models/two-seg/bmp_seg2.stl"},
         "models/two-seg/bmp_dh_table.txt",
         "models/environment/obstacles_twoseg.stl",
-        generator.release(), 1000));
-    BubblePrm bubble_prm (pqp.release(), start_twoseg, end_twoseg, 15);
+        generator.release(), 1000, kBvhCacheDir, kBubbleBvType));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_twoseg,
+        end_twoseg, 15);
     std::string logname ("logs/twossegbbbb/" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -823,11 +874,12 @@ int main() {
         {"models/two-seg/bmp_seg1.stl", "models/two-seg/bmp_seg2.stl"},
         "models/two-seg/bmp_dh_table.txt",
         "models/environment/obstacles_twoseg.stl",
-        generator.release(), 1000));
-    BubblePrm bubble_prm (pqp.release(), start_twoseg, end_twoseg, 15);
+        generator.release(), 1000, kBvhCacheDir, kBubbleBvType));
+    auto bubble_prm = CreateBubblePrm(pqp.release(), start_twoseg,
+        end_twoseg, 15);
 
     std::string logname ("logs/twosegbh/" + std::to_string(i));
-    if(bubble_prm.BuildTree(logname)) {
+    if(bubble_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -848,11 +900,11 @@ int main() {
         {"models/two-seg/bmp_seg1.stl", "models/two-seg/bmp_seg2.stl"},
         "models/two-seg/bmp_dh_table.txt",
         "models/environment/obstacles_twoseg.stl",
-        generator.release(), 1000));
-    LazyPrm lazy_prm (pqp.release(), start_twoseg, end_twoseg, 15);
+        generator.release(), 1000, kBvhCacheDir, kLazyBvType));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_twoseg, end_twoseg, 15);
 
     std::string logname ("logs/twosegl/" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -873,11 +925,11 @@ int main() {
         {"models/two-seg/bmp_seg1.stl", "models/two-seg/bmp_seg2.stl"},
         "models/two-seg/bmp_dh_table.txt",
         "models/environment/obstacles_twoseg.stl",
-        generator.release(), 1000));
-    LazyPrm lazy_prm (pqp.release(), start_twoseg, end_twoseg, 15);
+        generator.release(), 1000, kBvhCacheDir, kLazyBvType));
+    auto lazy_prm = CreateLazyPrm(pqp.release(), start_twoseg, end_twoseg, 15);
 
     std::string logname ("logs/twoseglh/" + std::to_string(i));
-    if(lazy_prm.BuildTree(logname)) {
+    if(lazy_prm->BuildTree(logname)) {
       auto end_t = std::chrono::steady_clock::now();
       auto duration = end_t - start_t;
       timing += std::chrono::duration <double, std::milli> (duration).count();
@@ -24,32 +24,46 @@
 
 #include "environment/pqp_environment.h"
 
-class PrmTree {
+// Planner operations, independent of the configuration space dimension
+class PrmTreeInterface {
  public:
-  typedef Eigen::VectorXd EVectorXd;
-  PrmTree(PqpEnvironment* pqp_environment, EVectorXd& start, EVectorXd& end,
-          int knn_num)
+  virtual ~PrmTreeInterface() {}
+
+  virtual bool ConnectPoints(int point1_index, int point2_index) = 0;
+  virtual bool AddPointToTree(int point_index, double extra_weight = 0) = 0;
+  virtual bool BuildTree(const std::string& log_filename) = 0;
+  virtual void GeneratePath(const std::string& filename) = 0;
+};
+
+// Planner over an N dimensional configuration space, N is Eigen::Dynamic if
+// it is known only at runtime
+template <int N>
+class PrmTreeT : public PrmTreeInterface {
+ public:
+  typedef Eigen::Matrix<double, N, 1> EVectorNd;
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  PrmTreeT(PqpEnvironment* pqp_environment, const EVectorNd& start,
+           const EVectorNd& end, int knn_num)
       : pqp_environment_(pqp_environment), start_(start), end_(end),
-        start_index_(pqp_environment_->AddPoint(start)),
-        end_index_(pqp_environment_->AddPoint(end)), knn_num_(knn_num),
+        start_index_(pqp_environment_->AddPoint(start_)),
+        end_index_(pqp_environment_->AddPoint(end_)), knn_num_(knn_num),
         space_size_(pqp_environment->sample_space_size() + 2),
         visited_(std::vector<bool>(space_size_, false)) {}
 
-  virtual EVectorXd GetCoordinates(int point_index) const {
-    return EVectorXd::Map(pqp_environment_->GetPoint(point_index),
+  virtual EVectorNd GetCoordinates(int point_index) const {
+    return EVectorNd::Map(pqp_environment_->GetPoint(point_index),
         pqp_environment_->dimension());
   }
-  virtual bool ConnectPoints(int point1_index, int point2_index) = 0;
-  virtual bool AddPointToTree(int point_index, double extra_weight) = 0;
-  virtual bool BuildTree(const std::string& log_filename) = 0;
-  virtual void GeneratePath(const std::string& filename) = 0;
 
  protected:
   std::unique_ptr<PqpEnvironment> pqp_environment_;
-  EVectorXd start_, end_;
+  EVectorNd start_, end_;  // Copied into the sample space
   int start_index_, end_index_;
   int knn_num_, space_size_;
   std::vector<bool> visited_;
 };
 
+typedef PrmTreeT<Eigen::Dynamic> PrmTree;
+
 #endif  // PRM_TREE_H_INCLUDED
@@ -18,12 +18,15 @@
 
 NaiveGenerator::NaiveGenerator(
     const std::vector<std::pair<double, double>>& limits)
+    : NaiveGenerator(limits, std::random_device()()) {}
+
+NaiveGenerator::NaiveGenerator(
+    const std::vector<std::pair<double, double>>& limits, unsigned seed)
     : space_dimension_(limits.size()) {
   for (auto& limit : limits)
     distributions_.emplace_back(limit.first, limit.second);
 
-  std::random_device rd;
-  random_engine_.seed(rd());
+  random_engine_.seed(seed);
 }
 
 std::vector<double> NaiveGenerator::CreatePoint() {
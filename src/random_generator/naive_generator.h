@@ -27,6 +27,9 @@
 class NaiveGenerator : public RandomSpaceGeneratorInterface {
  public:
   explicit NaiveGenerator(const std::vector<std::pair<double, double>>& limits);
+  // Generators of the same seed create the same points
+  NaiveGenerator(const std::vector<std::pair<double, double>>& limits,
+                 unsigned seed);
   std::vector<double> CreatePoint();
   // Sample space is kept as single array of points
   // Array is of [num_points * dimension x 1] dimension
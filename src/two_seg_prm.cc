@@ -27,13 +27,13 @@ bool TwoSegPrm::ConnectPoints(int point1_index, int point2_index) {
   int step_number = static_cast<int>((point2 - point1).norm() / step_size_);
   int steps = 0;
   while (steps <= step_number) {
-    if (pqp_environment_->DistanceQuery(point_iterator) < collision_limit_)
+    if (!pqp_environment_->ClearanceAtLeast(point_iterator, collision_limit_))
       return false;
     point_iterator += point_step;
     ++steps;
   }
 
-  return pqp_environment_->DistanceQuery(point2) >= collision_limit_;
+  return pqp_environment_->ClearanceAtLeast(point2, collision_limit_);
 }
 
 bool TwoSegPrm::AddPointToTree(int point_index, double extra_weight) {